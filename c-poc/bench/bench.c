@@ -0,0 +1,324 @@
+/*
+ * Microbenchmarks for the hot paths of webview.h, jsmn.h and my_cb().
+ *
+ *   make && ./bench [-f filter] [-r rounds] [-t min_ms] [-c cpu]
+ *
+ * Each benchmark is calibrated to run at least min_ms per round, then run
+ * rounds times. One JSON object per benchmark goes to stdout:
+ *
+ *   {"name":"jsmn_parse/batch","ops":4096,"rounds":7,"ns_per_op":...,
+ *    "ns_per_op_min":...,"bytes_per_op":...,"mb_per_s":...}
+ *
+ * Inputs are generated, never random: runs compare across commits. Pin a
+ * CPU with -c to cut the noise further.
+ *
+ * my_cb() is the one of main-myexample.c, included below with its main()
+ * renamed. Its sampler is replaced by one that completes each job without
+ * running it, so the numbers are the decode and hand-off, not fork().
+ */
+#define SAMPLER_HEADER
+#define main webview_example_main
+#include "../main-myexample.c"
+#undef main
+
+#include <sched.h>
+
+struct bench {
+  const char *name;
+  void (*run)(size_t iters);
+  const char **input; /* For bytes_per_op, or NULL */
+};
+
+static volatile size_t sink;
+
+/* ---- The sampler of my_cb(): jobs complete at once, nothing runs ---- */
+
+struct sampler {
+  struct webview *w;
+};
+
+struct sampler *sampler_new(struct webview *w,
+                            const struct sampler_config *config) {
+  struct sampler *s = calloc(1, sizeof(struct sampler));
+  (void)config;
+  s->w = w;
+  return s;
+}
+
+void sampler_free(struct sampler *s) { free(s); }
+
+void sampler_submit(struct sampler *s, sampler_job_fn job,
+                    webview_dispatch_fn done, void *arg) {
+  (void)job;
+  if (done != NULL) {
+    done(s->w, arg);
+  }
+}
+
+unsigned int sampler_add_provider(struct sampler *s, int interval_ms,
+                                  sampler_job_fn sample,
+                                  webview_dispatch_fn publish, void *arg) {
+  (void)s, (void)interval_ms, (void)sample, (void)publish, (void)arg;
+  return 0;
+}
+
+void sampler_remove_provider(struct sampler *s, unsigned int id) {
+  (void)s, (void)id;
+}
+
+void sampler_set_background(struct sampler *s, int interval_ms) {
+  (void)s, (void)interval_ms;
+}
+
+void sampler_call_normal(struct sampler *s, sampler_job_fn fn, void *arg) {
+  (void)s;
+  fn(arg);
+}
+
+void sampler_set_log(sampler_log_fn fn, void *arg) { (void)fn, (void)arg; }
+struct sampler_job *sampler_defer(void) { return NULL; }
+void sampler_finish(struct sampler_job *j) { (void)j; }
+
+/* ---- Inputs ---- */
+
+static const char *payload_small;
+static const char *payload_batch;
+static const char *payload_table;
+static const char *text_short;
+static const char *text_long;
+static const char *css;
+
+static char *build(size_t size, const char *head, const char *item,
+                   const char *tail, int count) {
+  char *s = malloc(size);
+  size_t len = 0;
+  int i;
+  len += sprintf(s + len, "%s", head);
+  for (i = 0; i < count; i++) {
+    len += sprintf(s + len, i > 0 ? "," : "");
+    len += sprintf(s + len, item, i, i, i % 100);
+  }
+  sprintf(s + len, "%s", tail);
+  return s;
+}
+
+static void inputs(void) {
+  payload_small = "{\"exec\":[\"wmctrl\",\"-lp\"],\"exec_and_read\":[\"date\"],"
+                  "\"id\":1}";
+  /* A page batching its commands: 200 of them in one invoke */
+  payload_batch = build(64 * 1024, "{",
+                        "\"exec\":[\"xbacklight\",\"-set\",\"%d\"],"
+                        "\"exec_and_read\":[\"cat\",\"/sys/class/x/%d\"]",
+                        ",\"env\":[\"LANG=C\"],\"id\":7}", 200);
+  /* A data table sent back to the native side, ~256 KB */
+  payload_table = build(512 * 1024, "{\"rows\":[",
+                        "{\"id\":%d,\"name\":\"process-%d with a longer "
+                        "description \\\"quoted\\\" text\",\"cmd\":\"/usr/"
+                        "bin/some-binary --flag=value\",\"cpu\":%d.5}",
+                        "]}", 2000);
+  text_short = "document.getElementById('clock').textContent = \"12:00\";";
+  text_long = build(256 * 1024, "",
+                    "<div class=\"row-%d\">it's row %d & \\ %d</div>\n", "",
+                    2500);
+  css = build(128 * 1024, "",
+              ".row-%d > .cell::after { content: \"%d\"; width: %dpx; }\n",
+              "", 1000);
+}
+
+/* ---- Benchmarks ---- */
+
+static void js_encode(const char *s, size_t iters) {
+  static char *out;
+  static size_t cap;
+  size_t i;
+  for (i = 0; i < iters; i++) {
+    int n = webview_js_encode(s, NULL, 0);
+    if ((size_t)n > cap) {
+      cap = n;
+      out = realloc(out, cap);
+    }
+    sink += webview_js_encode(s, out, n);
+  }
+}
+
+static void bench_js_encode_short(size_t iters) { js_encode(text_short, iters); }
+static void bench_js_encode_long(size_t iters) { js_encode(text_long, iters); }
+
+static void bench_inject_css(size_t iters) {
+  size_t i;
+  for (i = 0; i < iters; i++) {
+    char *js = webview_css_script(css);
+    sink += js[0];
+    free(js);
+  }
+}
+
+static void parse(const char *js, size_t iters, int simd) {
+  static jsmntok_t *tokens;
+  static unsigned int ntokens = 256;
+  size_t len = strlen(js), i;
+  for (i = 0; i < iters; i++) {
+    jsmn_parser p;
+    int n;
+    for (;;) {
+      if (tokens == NULL) {
+        tokens = malloc(ntokens * sizeof(jsmntok_t));
+      }
+      jsmn_init(&p);
+      n = simd ? jsmn_parse_simd(&p, js, len, tokens, ntokens)
+               : jsmn_parse(&p, js, len, tokens, ntokens);
+      if (n != JSMN_ERROR_NOMEM) {
+        break;
+      }
+      ntokens *= 2;
+      free(tokens);
+      tokens = NULL;
+    }
+    sink += n;
+  }
+}
+
+static void bench_jsmn_small(size_t iters) { parse(payload_small, iters, 0); }
+static void bench_jsmn_batch(size_t iters) { parse(payload_batch, iters, 0); }
+static void bench_jsmn_table(size_t iters) { parse(payload_table, iters, 0); }
+static void bench_simd_small(size_t iters) { parse(payload_small, iters, 1); }
+static void bench_simd_batch(size_t iters) { parse(payload_batch, iters, 1); }
+static void bench_simd_table(size_t iters) { parse(payload_table, iters, 1); }
+
+static struct webview bench_webview;
+
+static void my_cb_run(const char *js, size_t iters) {
+  size_t i;
+  for (i = 0; i < iters; i++) {
+    my_cb(&bench_webview, js);
+  }
+}
+
+static void bench_my_cb_small(size_t iters) { my_cb_run(payload_small, iters); }
+static void bench_my_cb_batch(size_t iters) { my_cb_run(payload_batch, iters); }
+
+static void dispatch_fn(struct webview *w, void *arg) {
+  (void)w;
+  sink += (size_t)arg;
+}
+
+/* Queue and drain in bursts, as a sampler thread would */
+static void dispatch_burst(size_t iters, size_t burst) {
+  size_t i = 0;
+  while (i < iters) {
+    size_t j;
+    for (j = 0; j < burst && i < iters; j++, i++) {
+      webview_dispatch(&bench_webview, dispatch_fn, (void *)i);
+    }
+    while (g_main_context_iteration(NULL, FALSE)) {
+    }
+  }
+}
+
+static void bench_dispatch_1(size_t iters) { dispatch_burst(iters, 1); }
+static void bench_dispatch_64(size_t iters) { dispatch_burst(iters, 64); }
+
+static const struct bench benches[] = {
+    {"webview_js_encode/short", bench_js_encode_short, &text_short},
+    {"webview_js_encode/long", bench_js_encode_long, &text_long},
+    {"webview_inject_css/build", bench_inject_css, &css},
+    {"jsmn_parse/small", bench_jsmn_small, &payload_small},
+    {"jsmn_parse/batch", bench_jsmn_batch, &payload_batch},
+    {"jsmn_parse/table", bench_jsmn_table, &payload_table},
+    {"jsmn_parse_simd/small", bench_simd_small, &payload_small},
+    {"jsmn_parse_simd/batch", bench_simd_batch, &payload_batch},
+    {"jsmn_parse_simd/table", bench_simd_table, &payload_table},
+    {"my_cb/small", bench_my_cb_small, &payload_small},
+    {"my_cb/batch", bench_my_cb_batch, &payload_batch},
+    {"webview_dispatch/1", bench_dispatch_1, NULL},
+    {"webview_dispatch/64", bench_dispatch_64, NULL},
+};
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void measure(FILE *out, const struct bench *b, int rounds,
+                    double min_ns) {
+  size_t iters = 1;
+  double t, ns[64];
+  size_t bytes = b->input != NULL ? strlen(*b->input) : 0;
+  int r;
+  /* Calibrate; this also warms up caches and the allocator */
+  for (;;) {
+    t = now_ns();
+    b->run(iters);
+    t = now_ns() - t;
+    if (t >= min_ns || iters >= ((size_t)1 << 30)) {
+      break;
+    }
+    iters *= t > 0 && min_ns / t < 10 ? 2 : 10;
+  }
+  for (r = 0; r < rounds; r++) {
+    t = now_ns();
+    b->run(iters);
+    ns[r] = (now_ns() - t) / iters;
+  }
+  qsort(ns, rounds, sizeof(double), cmp_double);
+  fprintf(out,
+          "{\"name\":\"%s\",\"ops\":%zu,\"rounds\":%d,\"ns_per_op\":%.1f,"
+          "\"ns_per_op_min\":%.1f,\"bytes_per_op\":%zu,\"mb_per_s\":%.1f}\n",
+          b->name, iters, rounds, ns[rounds / 2], ns[0], bytes,
+          bytes > 0 ? bytes * 1e3 / ns[rounds / 2] : 0.0);
+  fflush(out);
+}
+
+int main(int argc, char **argv) {
+  const char *filter = NULL;
+  int rounds = 7, min_ms = 100, cpu = -1, opt;
+  size_t i;
+  FILE *out;
+  while ((opt = getopt(argc, argv, "f:r:t:c:")) != -1) {
+    switch (opt) {
+    case 'f': filter = optarg; break;
+    case 'r': rounds = atoi(optarg); break;
+    case 't': min_ms = atoi(optarg); break;
+    case 'c': cpu = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-f filter] [-r rounds] [-t min_ms] [-c cpu]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+  if (rounds < 1 || rounds > 64) {
+    rounds = 7;
+  }
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+      perror("sched_setaffinity");
+    }
+  }
+
+  /* my_cb() prints what it gets: keep that out of the results */
+  out = fdopen(dup(STDOUT_FILENO), "w");
+  if (out == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+    perror("stdout");
+    return 1;
+  }
+
+  inputs();
+  bench_webview.priv.queue = g_async_queue_new();
+  sampler = sampler_new(&bench_webview, NULL);
+
+  for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+    if (filter == NULL || strstr(benches[i].name, filter) != NULL) {
+      measure(out, &benches[i], rounds, min_ms * 1e6);
+    }
+  }
+  return 0;
+}
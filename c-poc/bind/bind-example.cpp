@@ -0,0 +1,74 @@
+/*
+ * webview-bind.hpp end to end: a page calls C++ functions of every supported
+ * argument and result type, checks what comes back and reports to done().
+ *
+ *   make && ./bind-example      in a window
+ *   make check                  headless, under xvfb-run when there is no
+ *                               display; exits 0 only if every call matched
+ */
+#define WEBVIEW_IMPLEMENTATION
+#include <cmath>
+#include <limits>
+
+#include "../webview-bind.hpp"
+
+static struct webview view;
+static int failures = -1;
+
+static int add(int a, int b) { return a + b; }
+static long twice(long v) { return 2 * v; }
+static double third(double v) { return v / 3; }
+static double not_a_number() { return std::numeric_limits<double>::quiet_NaN(); }
+static bool negate(bool v) { return !v; }
+static std::string greet(std::string who) { return "Hello \"" + who + "\""; }
+static webview_bind::json echo(webview_bind::json v) { return v; }
+
+static void done(int failed, std::string report) {
+  printf("%s\n", report.c_str());
+  failures = failed;
+  webview_terminate(&view);
+}
+
+#define PAGE                                                                   \
+  "data:text/html,<script>"                                                    \
+  "var c=controller,r=[],f=0;"                                                 \
+  "function t(n,p,want){return p.then(function(v){"                            \
+  "var ok=JSON.stringify(v)===JSON.stringify(want);f+=!ok;"                    \
+  "r.push((ok?'ok   ':'FAIL ')+n+' '+JSON.stringify(v));});}"                 \
+  "Promise.all([t('add',c.add(1,2),3),"                                        \
+  "t('twice',c.twice(21),42),"                                                 \
+  "t('third',c.third(1),1/3),"                                                 \
+  "t('nan',c.notANumber(),null),"                                              \
+  "t('negate',c.negate(false),true),"                                          \
+  "t('greet',c.greet('<\\/script>'),'Hello \"<\\/script>\"'),"                 \
+  "t('echo',c.echo({a:[1,'x']}),{a:[1,'x']}),"                                 \
+  "c.add('x',1).then(function(){f++;r.push('FAIL bad types resolved');},"      \
+  "function(){r.push('ok   bad types rejected');})"                            \
+  "]).then(function(){c.done(f,r.join('\\n'));});"                             \
+  "</script>"
+
+int main(int argc, char **argv) {
+  view.title = "bind-example";
+  view.url = PAGE;
+  view.width = 400;
+  view.height = 300;
+  view.headless = argc > 1 && strcmp(argv[1], "--headless") == 0;
+  if (webview_init(&view) != 0) {
+    fprintf(stderr, "bind-example: no display\n");
+    return 2;
+  }
+  webview_bind::binder controller(&view, "controller");
+  controller.bind("add", add)
+      .bind("twice", twice)
+      .bind("third", third)
+      .bind("notANumber", not_a_number)
+      .bind("negate", negate)
+      .bind("greet", greet)
+      .bind("echo", echo)
+      .bind("done", done);
+  controller.inject();
+  while (webview_loop(&view, 1) == 0) {
+  }
+  webview_exit(&view);
+  return failures == 0 ? 0 : 1;
+}
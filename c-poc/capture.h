@@ -0,0 +1,283 @@
+/*
+ * Pooled, growable buffers for the output of child processes.
+ *
+ * Output is read straight into the buffer in large chunks and, once complete,
+ * published under a URL nobody can guess, for one reader. The page then
+ * fetches it by reference (capture://<id>-<key>) and the buffer goes back to the pool when WebKit is done
+ * with it: the bytes are copied once by read() and once more into WebKit,
+ * never in between.
+ */
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef CAPTURE_STATIC
+#define CAPTURE_API static
+#else
+#define CAPTURE_API extern
+#endif
+
+/* First allocation, and the size of each read() */
+#define CAPTURE_CHUNK (64 * 1024)
+/* Buffers bigger than this are not kept in the pool */
+#define CAPTURE_POOL_MAX_CAP (4 * 1024 * 1024)
+#define CAPTURE_POOL_SIZE 8
+/* Published captures waiting to be fetched; older ones get dropped */
+#define CAPTURE_SLOTS 64
+/* "capture://<id>-<key>" and its NUL */
+#define CAPTURE_URL_MAX 40
+
+/* Told how much more (or, negative, less) memory the capture holds */
+typedef void (*capture_mem_fn)(void *owner, ssize_t delta);
+
+struct capture {
+  char *data;
+  size_t len;
+  size_t cap;
+  int refs;
+  unsigned int id;
+  unsigned long long key; /* Random, the secret part of its URL */
+  int reader;             /* The only one capture_take() gives it to */
+  struct capture *next;
+  capture_mem_fn mem; /* Or NULL */
+  void *owner;
+};
+
+/**
+ * Gets an empty buffer from the pool, with one reference.
+ */
+CAPTURE_API struct capture *capture_new(void);
+
+CAPTURE_API void capture_ref(struct capture *c);
+
+/**
+ * Charges the buffer to owner while the capture is in use: mem(owner, cap)
+ * now, then each time it grows, and minus all of it on the last unref.
+ */
+CAPTURE_API void capture_set_owner(struct capture *c, capture_mem_fn mem,
+                                   void *owner);
+
+/**
+ * Drops a reference. The last one returns the buffer to the pool.
+ */
+CAPTURE_API void capture_unref(struct capture *c);
+
+/**
+ * Makes room for at least n more bytes at data + len.
+ * Returns 0, or -1 when out of memory.
+ */
+CAPTURE_API int capture_reserve(struct capture *c, size_t n);
+
+/**
+ * Appends everything readable from fd until EOF. Returns the number of
+ * bytes read, or -1 on error (what was read so far is kept).
+ */
+CAPTURE_API ssize_t capture_read_fd(struct capture *c, int fd);
+
+/**
+ * Publishes a complete capture for reader, an id of the caller's such as the
+ * window it is for, and writes its URL to url (CAPTURE_URL_MAX bytes).
+ * Returns its id (never 0). The capture keeps the reference of the caller
+ * until it is taken back.
+ */
+CAPTURE_API unsigned int capture_publish(struct capture *c, int reader,
+                                         char *url);
+
+/**
+ * Takes the capture at url out, along with its reference, or NULL if there
+ * is no such capture (anymore) or it is not for reader, which leaves it be.
+ */
+CAPTURE_API struct capture *capture_take(const char *url, int reader);
+
+#ifndef CAPTURE_HEADER
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/random.h>
+#include <unistd.h>
+
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct capture *capture_pool = NULL;
+static int capture_pool_len = 0;
+static struct capture *capture_slots[CAPTURE_SLOTS];
+static unsigned int capture_last_id = 0;
+
+CAPTURE_API struct capture *capture_new(void) {
+  struct capture *c;
+  pthread_mutex_lock(&capture_lock);
+  c = capture_pool;
+  if (c != NULL) {
+    capture_pool = c->next;
+    capture_pool_len--;
+  }
+  pthread_mutex_unlock(&capture_lock);
+  if (c == NULL) {
+    c = (struct capture *)calloc(1, sizeof(struct capture));
+    if (c == NULL) {
+      return NULL;
+    }
+  }
+  c->len = 0;
+  c->refs = 1;
+  c->id = 0;
+  c->next = NULL;
+  c->mem = NULL;
+  c->owner = NULL;
+  return c;
+}
+
+CAPTURE_API void capture_ref(struct capture *c) {
+  __atomic_add_fetch(&c->refs, 1, __ATOMIC_RELAXED);
+}
+
+CAPTURE_API void capture_set_owner(struct capture *c, capture_mem_fn mem,
+                                   void *owner) {
+  c->mem = mem;
+  c->owner = owner;
+  if (mem != NULL && c->cap > 0) {
+    mem(owner, (ssize_t)c->cap);
+  }
+}
+
+CAPTURE_API void capture_unref(struct capture *c) {
+  if (__atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+    return;
+  }
+  /* Pooled or freed, it is nobody's any more */
+  if (c->mem != NULL && c->cap > 0) {
+    c->mem(c->owner, -(ssize_t)c->cap);
+  }
+  c->mem = NULL;
+  if (c->cap <= CAPTURE_POOL_MAX_CAP) {
+    pthread_mutex_lock(&capture_lock);
+    if (capture_pool_len < CAPTURE_POOL_SIZE) {
+      c->next = capture_pool;
+      capture_pool = c;
+      capture_pool_len++;
+      c = NULL;
+    }
+    pthread_mutex_unlock(&capture_lock);
+  }
+  if (c != NULL) {
+    free(c->data);
+    free(c);
+  }
+}
+
+CAPTURE_API int capture_reserve(struct capture *c, size_t n) {
+  size_t cap = c->cap > 0 ? c->cap : CAPTURE_CHUNK;
+  char *data;
+  if (c->len + n <= c->cap) {
+    return 0;
+  }
+  while (cap < c->len + n) {
+    cap *= 2;
+  }
+  /* Past the mmap threshold glibc grows blocks with mremap(): no copy */
+  data = (char *)realloc(c->data, cap);
+  if (data == NULL) {
+    return -1;
+  }
+  if (c->mem != NULL) {
+    c->mem(c->owner, (ssize_t)(cap - c->cap));
+  }
+  c->data = data;
+  c->cap = cap;
+  return 0;
+}
+
+CAPTURE_API ssize_t capture_read_fd(struct capture *c, int fd) {
+  size_t start = c->len;
+  for (;;) {
+    ssize_t count;
+    if (capture_reserve(c, CAPTURE_CHUNK) != 0) {
+      return -1;
+    }
+    count = read(fd, c->data + c->len, c->cap - c->len);
+    if (count == 0) {
+      break;
+    }
+    if (count == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    c->len += count;
+  }
+  return (ssize_t)(c->len - start);
+}
+
+/* A fresh secret, from /dev/urandom where getrandom() is missing */
+static unsigned long long capture_new_key(void) {
+  unsigned long long key = 0;
+  ssize_t n;
+  int fd;
+  while ((n = getrandom(&key, sizeof(key), 0)) == -1 && errno == EINTR) {
+  }
+  if (n == (ssize_t)sizeof(key)) {
+    return key;
+  }
+  fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+  if (fd != -1) {
+    n = read(fd, &key, sizeof(key));
+    close(fd);
+  }
+  return key;
+}
+
+CAPTURE_API unsigned int capture_publish(struct capture *c, int reader,
+                                         char *url) {
+  struct capture *old;
+  unsigned long long key = capture_new_key();
+  pthread_mutex_lock(&capture_lock);
+  if (++capture_last_id == 0) {
+    capture_last_id = 1;
+  }
+  c->id = capture_last_id;
+  c->key = key;
+  c->reader = reader;
+  snprintf(url, CAPTURE_URL_MAX, "capture://%u-%016llx", c->id, c->key);
+  old = capture_slots[c->id % CAPTURE_SLOTS];
+  capture_slots[c->id % CAPTURE_SLOTS] = c;
+  pthread_mutex_unlock(&capture_lock);
+  /* Never fetched: the page lost interest */
+  if (old != NULL) {
+    capture_unref(old);
+  }
+  return c->id;
+}
+
+CAPTURE_API struct capture *capture_take(const char *url, int reader) {
+  struct capture *c;
+  unsigned int id;
+  unsigned long long key;
+  if (sscanf(url, "capture://%u-%16llx", &id, &key) != 2) {
+    return NULL;
+  }
+  pthread_mutex_lock(&capture_lock);
+  c = capture_slots[id % CAPTURE_SLOTS];
+  if (c != NULL && c->id == id && c->key == key && c->reader == reader) {
+    capture_slots[id % CAPTURE_SLOTS] = NULL;
+  } else {
+    c = NULL;
+  }
+  pthread_mutex_unlock(&capture_lock);
+  return c;
+}
+
+#endif /* CAPTURE_HEADER */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,225 @@
+/*
+ * Invoke channels: for continuous controls, where only the last value counts.
+ *
+ * A slider sends a message per step of the drag; run in order, each one
+ * would do work that the next already overrides. Messages on a channel are
+ * run one at a time instead, and while one runs, or waits for its turn, a
+ * newer one replaces it:
+ *
+ *   CHANNEL_LATEST    as soon as the one before has finished
+ *   CHANNEL_DEBOUNCE  once no newer message came for param ms
+ *   CHANNEL_THROTTLE  at most param times a second, the last one included
+ *
+ *   struct channels *c = channels_new(&webview, run_cb, NULL);
+ *   channels_offer(c, "brightness", CHANNEL_THROTTLE, 20, msg);
+ *
+ * run_cb gets the message when its turn comes and returns how many pieces of
+ * work it started that finish later: each one reports with channels_done(),
+ * and the next message waits for all of them. All on the GTK thread.
+ */
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include "webview.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef CHANNEL_STATIC
+#define CHANNEL_API static
+#else
+#define CHANNEL_API extern
+#endif
+
+enum channel_policy {
+  CHANNEL_LATEST,
+  CHANNEL_DEBOUNCE, /* param: quiet time, in ms */
+  CHANNEL_THROTTLE, /* param: runs per second */
+};
+
+struct channels;
+
+typedef int (*channel_run_fn)(struct channels *c, const char *name,
+                              const char *msg, void *arg);
+
+CHANNEL_API struct channels *channels_new(struct webview *w, channel_run_fn run,
+                                          void *arg);
+
+/**
+ * Frees the channels. Messages still waiting are dropped.
+ */
+CHANNEL_API void channels_free(struct channels *c);
+
+/**
+ * Queues msg on channel name, in place of the message waiting there, if
+ * any. The policy is the one of the newest message. Runs msg right away when
+ * the channel is free.
+ */
+CHANNEL_API void channels_offer(struct channels *c, const char *name,
+                                enum channel_policy policy, int param,
+                                const char *msg);
+
+/**
+ * One piece of the work of the message run last on name has finished.
+ */
+CHANNEL_API void channels_done(struct channels *c, const char *name);
+
+/**
+ * Messages offered so far, and those replaced before they ran.
+ */
+CHANNEL_API void channels_stats(struct channels *c, unsigned long *offered,
+                                unsigned long *dropped);
+
+#ifndef CHANNEL_HEADER
+#include <stdlib.h>
+#include <string.h>
+
+struct channel {
+  struct channels *owner;
+  char *name;
+  char *pending; /* The newest message, not run yet; NULL when none */
+  enum channel_policy policy;
+  int param;
+  int busy;          /* Pieces of work of the last run still going */
+  gint64 last_run_us;
+  unsigned int timer; /* Debounce or throttle wait, 0 when none */
+};
+
+struct channels {
+  struct webview *w;
+  channel_run_fn run;
+  void *arg;
+  GHashTable *channels; /* name -> struct channel */
+  unsigned long offered;
+  unsigned long dropped;
+};
+
+static void channel_free(gpointer arg) {
+  struct channel *ch = (struct channel *)arg;
+  if (ch->timer != 0) {
+    webview_timer_remove(ch->owner->w, ch->timer);
+  }
+  free(ch->pending);
+  free(ch->name);
+  free(ch);
+}
+
+CHANNEL_API struct channels *channels_new(struct webview *w, channel_run_fn run,
+                                          void *arg) {
+  struct channels *c = (struct channels *)calloc(1, sizeof(struct channels));
+  if (c == NULL) {
+    return NULL;
+  }
+  c->w = w;
+  c->run = run;
+  c->arg = arg;
+  c->channels = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                      channel_free);
+  return c;
+}
+
+CHANNEL_API void channels_free(struct channels *c) {
+  if (c == NULL) {
+    return;
+  }
+  g_hash_table_destroy(c->channels);
+  free(c);
+}
+
+static int channel_timer_cb(struct webview *w, void *arg);
+
+/* Runs the waiting message, if its turn has come */
+static void channel_pump(struct channel *ch) {
+  gint64 now, wait_us;
+  char *msg;
+  if (ch->pending == NULL || ch->busy > 0 || ch->timer != 0) {
+    return;
+  }
+  now = g_get_monotonic_time();
+  if (ch->policy == CHANNEL_THROTTLE && ch->param > 0) {
+    wait_us = ch->last_run_us + G_USEC_PER_SEC / ch->param - now;
+    if (wait_us > 0) {
+      ch->timer = webview_timer_add(ch->owner->w, (int)((wait_us + 999) / 1000),
+                                    WEBVIEW_TIMER_URGENT, channel_timer_cb, ch);
+      return;
+    }
+  }
+  msg = ch->pending;
+  ch->pending = NULL;
+  ch->last_run_us = now;
+  ch->busy = ch->owner->run(ch->owner, ch->name, msg, ch->owner->arg);
+  free(msg);
+}
+
+static int channel_timer_cb(struct webview *w, void *arg) {
+  struct channel *ch = (struct channel *)arg;
+  (void)w;
+  ch->timer = 0;
+  channel_pump(ch);
+  return 0;
+}
+
+CHANNEL_API void channels_offer(struct channels *c, const char *name,
+                                enum channel_policy policy, int param,
+                                const char *msg) {
+  struct channel *ch =
+      (struct channel *)g_hash_table_lookup(c->channels, name);
+  char *copy = strdup(msg);
+  if (copy == NULL) {
+    return;
+  }
+  if (ch == NULL) {
+    ch = (struct channel *)calloc(1, sizeof(struct channel));
+    if (ch == NULL || (ch->name = strdup(name)) == NULL) {
+      free(ch);
+      free(copy);
+      return;
+    }
+    ch->owner = c;
+    g_hash_table_insert(c->channels, ch->name, ch);
+  }
+  c->offered++;
+  if (ch->pending != NULL) {
+    c->dropped++;
+    free(ch->pending);
+  }
+  ch->pending = copy;
+  ch->policy = policy;
+  ch->param = param;
+  if (policy == CHANNEL_DEBOUNCE) {
+    /* Every message starts the quiet time over */
+    if (ch->timer != 0) {
+      webview_timer_remove(c->w, ch->timer);
+    }
+    ch->timer = webview_timer_add(c->w, param > 0 ? param : 1,
+                                  WEBVIEW_TIMER_URGENT, channel_timer_cb, ch);
+    return;
+  }
+  channel_pump(ch);
+}
+
+CHANNEL_API void channels_done(struct channels *c, const char *name) {
+  struct channel *ch =
+      (struct channel *)g_hash_table_lookup(c->channels, name);
+  if (ch == NULL || ch->busy == 0) {
+    return;
+  }
+  if (--ch->busy == 0) {
+    channel_pump(ch);
+  }
+}
+
+CHANNEL_API void channels_stats(struct channels *c, unsigned long *offered,
+                                unsigned long *dropped) {
+  *offered = c->offered;
+  *dropped = c->dropped;
+}
+
+#endif /* CHANNEL_HEADER */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CHANNEL_H */
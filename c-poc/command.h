@@ -0,0 +1,228 @@
+/*
+ * Runs programs straight from an argv array with posix_spawn (vfork-based in
+ * glibc), no /bin/sh in between, with explicit stdio fds and environment.
+ * Each one leads a process group of its own, so that whatever it starts in
+ * turn goes with it when it is killed.
+ */
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef COMMAND_STATIC
+#define COMMAND_API static
+#else
+#define COMMAND_API extern
+#endif
+
+/**
+ * Starts argv[0] (looked up in PATH when it has no slash) with arguments argv.
+ * in_fd, out_fd and err_fd become the child's stdin, stdout and stderr, -1
+ * leaves ours. envp is the complete environment, NULL passes ours. The child
+ * leads a new process group, whose id is its pid.
+ * Returns 0 and stores the child pid in *pid, or returns an errno value.
+ */
+COMMAND_API int command_spawn(char *const argv[], char *const envp[],
+                              int in_fd, int out_fd, int err_fd, pid_t *pid);
+
+/**
+ * Waits for pid. Returns its exit code, 128 + signal if it was killed, or -1.
+ */
+COMMAND_API int command_wait(pid_t pid);
+
+/**
+ * Same, also filling usage, if not NULL, with what the child used (wait4()).
+ */
+COMMAND_API int command_wait_usage(pid_t pid, struct rusage *usage);
+
+/**
+ * Waits for pid to end, but leaves it to command_wait(): until then its pid,
+ * and so its process group, cannot be given to another process, and
+ * command_kill() cannot hit the wrong one. Returns 0, or -1.
+ */
+COMMAND_API int command_wait_exit(pid_t pid);
+
+/**
+ * A file descriptor that polls readable once pid has ended, for a main loop
+ * to watch instead of a thread blocked in command_wait_exit() (pidfd_open(),
+ * Linux 5.3). It does not reap pid either; close() it when done. Returns -1
+ * where the kernel has none: poll command_exited() then.
+ */
+COMMAND_API int command_exit_fd(pid_t pid);
+
+/**
+ * 1 if pid has ended, 0 if it still runs, -1 on error. Does not wait, and
+ * leaves pid to command_wait() as command_wait_exit() does.
+ */
+COMMAND_API int command_exited(pid_t pid);
+
+/**
+ * Sends sig to the process group of pid, as started by command_spawn().
+ * Returns 0, or -1 with errno set.
+ */
+COMMAND_API int command_kill(pid_t pid, int sig);
+
+/**
+ * Like system(), but for an argv array: spawns, waits and returns command_wait().
+ */
+COMMAND_API int command_run(char *const argv[], char *const envp[]);
+
+/**
+ * Builds an environment made of ours plus the "KEY=VALUE" entries of extra,
+ * which win over ours. Only the array is allocated, the strings are borrowed
+ * from environ and extra: free() it once the child has been spawned.
+ */
+COMMAND_API char **command_env(char *const extra[], int nextra);
+
+#ifndef COMMAND_HEADER
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+COMMAND_API int command_spawn(char *const argv[], char *const envp[],
+                              int in_fd, int out_fd, int err_fd, pid_t *pid) {
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t none;
+  int r;
+
+  posix_spawn_file_actions_init(&actions);
+  if (in_fd >= 0) {
+    posix_spawn_file_actions_adddup2(&actions, in_fd, 0);
+  }
+  if (out_fd >= 0) {
+    posix_spawn_file_actions_adddup2(&actions, out_fd, 1);
+  }
+  if (err_fd >= 0) {
+    posix_spawn_file_actions_adddup2(&actions, err_fd, 2);
+  }
+
+  /* GTK may have signals blocked in this thread, the child wants none */
+  posix_spawnattr_init(&attr);
+  sigemptyset(&none);
+  posix_spawnattr_setsigmask(&attr, &none);
+  posix_spawnattr_setpgroup(&attr, 0);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETPGROUP);
+
+  r = posix_spawnp(pid, argv[0], &actions, &attr, argv,
+                   envp != NULL ? envp : environ);
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+  return r;
+}
+
+COMMAND_API int command_wait(pid_t pid) {
+  return command_wait_usage(pid, NULL);
+}
+
+COMMAND_API int command_wait_usage(pid_t pid, struct rusage *usage) {
+  int status;
+  while (wait4(pid, &status, 0, usage) == -1) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  }
+  if (WIFSIGNALED(status)) {
+    return 128 + WTERMSIG(status);
+  }
+  return -1;
+}
+
+COMMAND_API int command_wait_exit(pid_t pid) {
+  siginfo_t info;
+  while (waitid(P_PID, (id_t)pid, &info, WEXITED | WNOWAIT) == -1) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+COMMAND_API int command_exit_fd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+  (void)pid;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+COMMAND_API int command_exited(pid_t pid) {
+  siginfo_t info;
+  info.si_pid = 0;
+  while (waitid(P_PID, (id_t)pid, &info, WEXITED | WNOWAIT | WNOHANG) == -1) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+  return info.si_pid != 0;
+}
+
+COMMAND_API int command_kill(pid_t pid, int sig) {
+  return kill(-pid, sig);
+}
+
+COMMAND_API int command_run(char *const argv[], char *const envp[]) {
+  pid_t pid;
+  if (command_spawn(argv, envp, -1, -1, -1, &pid) != 0) {
+    return -1;
+  }
+  return command_wait(pid);
+}
+
+COMMAND_API char **command_env(char *const extra[], int nextra) {
+  int n = 0;
+  int i, j;
+  char **env;
+  while (environ[n] != NULL) {
+    n++;
+  }
+  env = (char **)malloc((n + nextra + 1) * sizeof(char *));
+  if (env == NULL) {
+    return NULL;
+  }
+  int count = 0;
+  for (i = 0; i < n; i++) {
+    /* Skip ours when extra overrides it */
+    size_t keylen = strcspn(environ[i], "=");
+    for (j = 0; j < nextra; j++) {
+      if (strncmp(environ[i], extra[j], keylen) == 0 &&
+          extra[j][keylen] == '=') {
+        break;
+      }
+    }
+    if (j == nextra) {
+      env[count++] = environ[i];
+    }
+  }
+  for (j = 0; j < nextra; j++) {
+    env[count++] = extra[j];
+  }
+  env[count] = NULL;
+  return env;
+}
+
+#endif /* COMMAND_HEADER */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COMMAND_H */
@@ -0,0 +1,420 @@
+/*
+ * Native side of keyed data binding: key -> value entries that are pushed to
+ * the page only when they change.
+ *
+ * Values are kept JSON-encoded. databind_set*() compares the new value with
+ * the current one and only marks the key dirty when it differs;
+ * databind_flush() then builds one script carrying just the dirty keys:
+ *
+ *   window.__databind.u({"clock":"12:00:01","battery.Percentage":87})
+ *
+ * On the page (DATABIND_RUNTIME, installed as an init script) each key
+ * updates the element bound to it, if its text changed, and calls the
+ * observers registered with window.databind.observe(key, fn). Elements are
+ * bound with databind_bind() or just with a data-bind="key" attribute.
+ */
+#ifndef DATABIND_H
+#define DATABIND_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef DATABIND_STATIC
+#define DATABIND_API static
+#else
+#define DATABIND_API extern
+#endif
+
+#define DATABIND_RUNTIME                                                       \
+  "(function(){var d=window.__databind={v:{},e:{},n:{},o:{},"                  \
+  "u:function(v,b){var k;if(b){for(k in b){d.e[k]=b[k];delete d.n[k];}}"      \
+  "for(k in v){d.v[k]=v[k];d.a(k);}},"                                         \
+  "a:function(k){var v=d.v[k],n=d.n[k],i,o=d.o[k];"                            \
+  "if(!n||!n.isConnected){n=d.e[k]?document.getElementById(d.e[k]):"          \
+  "document.querySelector('[data-bind=\"'+CSS.escape(k)+'\"]');"             \
+  "if(n)d.n[k]=n;}"                                                            \
+  "if(n){var t=v===null?'':String(v);if(n.textContent!==t)n.textContent=t;}"  \
+  "if(o){for(i=0;i<o.length;i++)o[i](v,k);}}};"                                \
+  "window.databind={get:function(k){return d.v[k];},"                          \
+  "observe:function(k,f){(d.o[k]=d.o[k]||[]).push(f);if(k in d.v)f(d.v[k],k);}};" \
+  "document.addEventListener('DOMContentLoaded',function(){"                   \
+  "for(var k in d.v)d.a(k);});})()"
+
+struct databind;
+
+typedef void (*databind_notify_fn)(struct databind *db, void *arg);
+typedef void (*databind_each_fn)(const char *key, const char *json,
+                                 const char *element_id, void *arg);
+
+/**
+ * Creates an empty store. notify, if not NULL, is called each time the store
+ * goes from clean to dirty: that is the moment to schedule a flush.
+ */
+DATABIND_API struct databind *databind_new(databind_notify_fn notify,
+                                           void *arg);
+DATABIND_API void databind_free(struct databind *db);
+
+/**
+ * Sets key to a value that is already JSON (a number, true, "a string"...).
+ * Returns 1 if the value changed, 0 if not, -1 when out of memory.
+ */
+DATABIND_API int databind_set(struct databind *db, const char *key,
+                              const char *json);
+DATABIND_API int databind_set_string(struct databind *db, const char *key,
+                                     const char *s);
+DATABIND_API int databind_set_number(struct databind *db, const char *key,
+                                     double v);
+
+/**
+ * Binds key to the element with the given id, instead of [data-bind=key].
+ */
+DATABIND_API int databind_bind(struct databind *db, const char *key,
+                               const char *element_id);
+
+/**
+ * Returns the JSON value of key, or NULL.
+ */
+DATABIND_API const char *databind_get(struct databind *db, const char *key);
+
+/**
+ * Returns the script that pushes the dirty keys (free() it) and marks them
+ * clean, or NULL when there is nothing to push.
+ */
+DATABIND_API char *databind_flush(struct databind *db);
+
+/**
+ * Marks every key dirty, for a page that lost its state (reload, crash).
+ */
+DATABIND_API void databind_touch_all(struct databind *db);
+
+/**
+ * Calls fn for every key, in the order they were added. json is NULL for a
+ * key that was bound but never set, element_id NULL for one that was not
+ * bound with databind_bind().
+ */
+DATABIND_API void databind_foreach(struct databind *db, databind_each_fn fn,
+                                   void *arg);
+
+/**
+ * Writes s at out as a JSON string, NUL-terminated. Returns the number of
+ * bytes written, without the NUL; out needs 6 * strlen(s) + 3 bytes.
+ */
+DATABIND_API size_t databind_escape(char *out, const char *s);
+
+#ifndef DATABIND_HEADER
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct databind_entry {
+  char *key;
+  char *value;   /* JSON, as last set */
+  char *element; /* Bound element id, or NULL */
+  int dirty;
+  int bound;     /* The binding still has to be sent */
+};
+
+struct databind {
+  struct databind_entry *entries;
+  size_t len;
+  size_t cap;
+  /* Open addressing, entry index + 1, 0 is free */
+  size_t *index;
+  size_t index_cap;
+  /* Dirty entries, so that a flush costs what changed, not the whole store */
+  size_t *dirty;
+  size_t ndirty;
+  databind_notify_fn notify;
+  void *arg;
+};
+
+static size_t databind_hash(const char *key) {
+  size_t h = 2166136261u;
+  for (; *key; key++) {
+    h = (h ^ (unsigned char)*key) * 16777619u;
+  }
+  return h;
+}
+
+DATABIND_API struct databind *databind_new(databind_notify_fn notify,
+                                           void *arg) {
+  struct databind *db = (struct databind *)calloc(1, sizeof(struct databind));
+  if (db == NULL) {
+    return NULL;
+  }
+  db->notify = notify;
+  db->arg = arg;
+  return db;
+}
+
+DATABIND_API void databind_free(struct databind *db) {
+  size_t i;
+  if (db == NULL) {
+    return;
+  }
+  for (i = 0; i < db->len; i++) {
+    free(db->entries[i].key);
+    free(db->entries[i].value);
+    free(db->entries[i].element);
+  }
+  free(db->entries);
+  free(db->index);
+  free(db->dirty);
+  free(db);
+}
+
+static int databind_rehash(struct databind *db, size_t cap) {
+  size_t *index = (size_t *)calloc(cap, sizeof(size_t));
+  size_t i;
+  if (index == NULL) {
+    return -1;
+  }
+  for (i = 0; i < db->len; i++) {
+    size_t h = databind_hash(db->entries[i].key) & (cap - 1);
+    while (index[h] != 0) {
+      h = (h + 1) & (cap - 1);
+    }
+    index[h] = i + 1;
+  }
+  free(db->index);
+  db->index = index;
+  db->index_cap = cap;
+  return 0;
+}
+
+static struct databind_entry *databind_lookup(struct databind *db,
+                                              const char *key, int create) {
+  size_t h;
+  if (db->index_cap > 0) {
+    h = databind_hash(key) & (db->index_cap - 1);
+    while (db->index[h] != 0) {
+      struct databind_entry *e = &db->entries[db->index[h] - 1];
+      if (strcmp(e->key, key) == 0) {
+        return e;
+      }
+      h = (h + 1) & (db->index_cap - 1);
+    }
+  }
+  if (!create) {
+    return NULL;
+  }
+  if (db->len == db->cap) {
+    size_t cap = db->cap > 0 ? db->cap * 2 : 16;
+    struct databind_entry *entries = (struct databind_entry *)realloc(
+        db->entries, cap * sizeof(struct databind_entry));
+    size_t *dirty = (size_t *)realloc(db->dirty, cap * sizeof(size_t));
+    if (entries != NULL) {
+      db->entries = entries;
+    }
+    if (dirty != NULL) {
+      db->dirty = dirty;
+    }
+    if (entries == NULL || dirty == NULL) {
+      return NULL;
+    }
+    db->cap = cap;
+  }
+  /* Keep the table at most half full */
+  if ((db->len + 1) * 2 > db->index_cap &&
+      databind_rehash(db, db->index_cap > 0 ? db->index_cap * 2 : 32) != 0) {
+    return NULL;
+  }
+  struct databind_entry *e = &db->entries[db->len];
+  memset(e, 0, sizeof(*e));
+  e->key = strdup(key);
+  if (e->key == NULL) {
+    return NULL;
+  }
+  h = databind_hash(key) & (db->index_cap - 1);
+  while (db->index[h] != 0) {
+    h = (h + 1) & (db->index_cap - 1);
+  }
+  db->index[h] = ++db->len;
+  return e;
+}
+
+static void databind_mark(struct databind *db, struct databind_entry *e) {
+  if (e->dirty) {
+    return;
+  }
+  e->dirty = 1;
+  db->dirty[db->ndirty++] = e - db->entries;
+  if (db->ndirty == 1 && db->notify != NULL) {
+    db->notify(db, db->arg);
+  }
+}
+
+DATABIND_API int databind_set(struct databind *db, const char *key,
+                              const char *json) {
+  struct databind_entry *e = databind_lookup(db, key, 1);
+  char *value;
+  if (e == NULL) {
+    return -1;
+  }
+  if (e->value != NULL && strcmp(e->value, json) == 0) {
+    return 0;
+  }
+  value = strdup(json);
+  if (value == NULL) {
+    return -1;
+  }
+  free(e->value);
+  e->value = value;
+  databind_mark(db, e);
+  return 1;
+}
+
+DATABIND_API size_t databind_escape(char *out, const char *s) {
+  size_t n = 0;
+  out[n++] = '"';
+  for (; *s; s++) {
+    unsigned char c = (unsigned char)*s;
+    if (c == '"' || c == '\\') {
+      out[n++] = '\\';
+      out[n++] = c;
+    } else if (c < 0x20 || c == '<' || c == '>' || c == '\'') {
+      n += sprintf(out + n, "\\u%04x", c);
+    } else {
+      out[n++] = c;
+    }
+  }
+  out[n++] = '"';
+  out[n] = '\0';
+  return n;
+}
+
+DATABIND_API int databind_set_string(struct databind *db, const char *key,
+                                     const char *s) {
+  char stack[256];
+  size_t need = strlen(s) * 6 + 3;
+  char *json = need <= sizeof(stack) ? stack : (char *)malloc(need);
+  int r;
+  if (json == NULL) {
+    return -1;
+  }
+  databind_escape(json, s);
+  r = databind_set(db, key, json);
+  if (json != stack) {
+    free(json);
+  }
+  return r;
+}
+
+DATABIND_API int databind_set_number(struct databind *db, const char *key,
+                                     double v) {
+  char json[32];
+  snprintf(json, sizeof(json), "%.17g", v);
+  return databind_set(db, key, json);
+}
+
+DATABIND_API int databind_bind(struct databind *db, const char *key,
+                               const char *element_id) {
+  struct databind_entry *e = databind_lookup(db, key, 1);
+  char *element;
+  if (e == NULL) {
+    return -1;
+  }
+  element = strdup(element_id);
+  if (element == NULL) {
+    return -1;
+  }
+  free(e->element);
+  e->element = element;
+  e->bound = 1;
+  databind_mark(db, e);
+  return 0;
+}
+
+DATABIND_API const char *databind_get(struct databind *db, const char *key) {
+  struct databind_entry *e = databind_lookup(db, key, 0);
+  return e != NULL ? e->value : NULL;
+}
+
+DATABIND_API char *databind_flush(struct databind *db) {
+  size_t i, size = sizeof("window.__databind.u({},{})");
+  int bindings = 0;
+  char *js, *p;
+  if (db->ndirty == 0) {
+    return NULL;
+  }
+  for (i = 0; i < db->ndirty; i++) {
+    struct databind_entry *e = &db->entries[db->dirty[i]];
+    size += strlen(e->key) * 6 + 4;
+    size += e->value != NULL ? strlen(e->value) + 1 : 0;
+    if (e->bound) {
+      size += strlen(e->key) * 6 + strlen(e->element) * 6 + 8;
+      bindings = 1;
+    }
+  }
+  js = p = (char *)malloc(size);
+  if (js == NULL) {
+    return NULL;
+  }
+  strcpy(js, "window.__databind.u({");
+  p = js + strlen(js);
+  for (i = 0; i < db->ndirty; i++) {
+    struct databind_entry *e = &db->entries[db->dirty[i]];
+    if (e->value == NULL) {
+      continue;
+    }
+    if (p[-1] != '{') {
+      *p++ = ',';
+    }
+    p += databind_escape(p, e->key);
+    *p++ = ':';
+    p = stpcpy(p, e->value);
+  }
+  *p++ = '}';
+  if (bindings) {
+    p = stpcpy(p, ",{");
+    for (i = 0; i < db->ndirty; i++) {
+      struct databind_entry *e = &db->entries[db->dirty[i]];
+      if (!e->bound) {
+        continue;
+      }
+      if (p[-1] != '{') {
+        *p++ = ',';
+      }
+      p += databind_escape(p, e->key);
+      *p++ = ':';
+      p += databind_escape(p, e->element);
+      e->bound = 0;
+    }
+    *p++ = '}';
+  }
+  strcpy(p, ")");
+  for (i = 0; i < db->ndirty; i++) {
+    db->entries[db->dirty[i]].dirty = 0;
+  }
+  db->ndirty = 0;
+  return js;
+}
+
+DATABIND_API void databind_touch_all(struct databind *db) {
+  size_t i;
+  for (i = 0; i < db->len; i++) {
+    if (db->entries[i].element != NULL) {
+      db->entries[i].bound = 1;
+    }
+    databind_mark(db, &db->entries[i]);
+  }
+}
+
+DATABIND_API void databind_foreach(struct databind *db, databind_each_fn fn,
+                                   void *arg) {
+  size_t i;
+  for (i = 0; i < db->len; i++) {
+    fn(db->entries[i].key, db->entries[i].value, db->entries[i].element, arg);
+  }
+}
+
+#endif /* DATABIND_HEADER */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DATABIND_H */
@@ -0,0 +1,629 @@
+/*
+ * D-Bus properties mirrored into the databind store.
+ *
+ * Each watched object gets one GetAll when its service appears on the bus,
+ * then only the org.freedesktop.DBus.Properties.PropertiesChanged signals
+ * it emits. Properties land in the store as "<prefix>.<Property>", JSON
+ * encoded, so the page reads them with window.databind.get() or a
+ * data-bind attribute and nothing goes to the bus on the read path:
+ *
+ *   dbus_bridge_watch(b, G_BUS_TYPE_SYSTEM, "org.freedesktop.UPower",
+ *                     "/org/freedesktop/UPower/devices/battery_BAT0",
+ *                     "org.freedesktop.UPower.Device", "battery");
+ *   ...
+ *   <span data-bind="battery.Percentage"></span>
+ *
+ * Method calls go out asynchronously on the same connections, one per bus
+ * for the whole process, and their replies come back as JSON:
+ *
+ *   dbus_bridge_call(b, G_BUS_TYPE_SESSION, "org.freedesktop.Notifications",
+ *                    "/org/freedesktop/Notifications",
+ *                    "org.freedesktop.Notifications", "Notify",
+ *                    "(susssasa{sv}i)",
+ *                    "('app', 0, '', 'Hello', '', [], {}, 5000)",
+ *                    req, reply_cb, arg);
+ *
+ * Everything runs on the GTK thread, the one the store belongs to. The
+ * connections are opened asynchronously on first use, so that a slow or
+ * missing bus never blocks it: watches and calls made meanwhile wait for
+ * the connection and go out once it is there.
+ */
+#ifndef DBUS_BRIDGE_H
+#define DBUS_BRIDGE_H
+
+#include "webview.h"
+#include "databind.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef DBUS_BRIDGE_STATIC
+#define DBUS_BRIDGE_API static
+#else
+#define DBUS_BRIDGE_API extern
+#endif
+
+struct dbus_bridge;
+
+/**
+ * Gets the reply to a call: json is the array of the values returned, or
+ * NULL and error says why.
+ */
+typedef void (*dbus_bridge_reply_fn)(struct dbus_bridge *b, long req,
+                                     const char *json, const char *error,
+                                     void *arg);
+
+DBUS_BRIDGE_API struct dbus_bridge *dbus_bridge_new(struct databind *db);
+DBUS_BRIDGE_API void dbus_bridge_free(struct dbus_bridge *b);
+
+/**
+ * Mirrors the properties of interface on the object at path, owned by name.
+ * Returns 0, or -1 if the bus is already known not to be available; one
+ * still connecting fails later, in the log (dbus_bridge_set_log()).
+ */
+DBUS_BRIDGE_API int dbus_bridge_watch(struct dbus_bridge *b, GBusType bus,
+                                      const char *name, const char *path,
+                                      const char *interface,
+                                      const char *prefix);
+
+/**
+ * Calls a method without waiting for it. args is a tuple in the GVariant
+ * text format, "(1, 'two')", or NULL for none; signature, if not NULL, is
+ * its type, "(us)", for where the text alone is ambiguous. reply, if not
+ * NULL, is called with req once the reply is there, or on error, errors in
+ * args and in connecting to the bus included.
+ */
+DBUS_BRIDGE_API void dbus_bridge_call(struct dbus_bridge *b, GBusType bus,
+                                      const char *dest, const char *path,
+                                      const char *interface,
+                                      const char *method,
+                                      const char *signature, const char *args,
+                                      long req, dbus_bridge_reply_fn reply,
+                                      void *arg);
+
+/* Where failures nobody waits for go (a watch's bus or GetAll); stderr by
+ * default */
+typedef void (*dbus_bridge_log_fn)(const char *s, void *arg);
+
+DBUS_BRIDGE_API void dbus_bridge_set_log(dbus_bridge_log_fn fn, void *arg);
+
+/**
+ * Appends v to out as JSON: dictionaries with string keys become objects,
+ * other containers arrays, and 64 bit integers plain numbers.
+ */
+DBUS_BRIDGE_API void dbus_bridge_json(GString *out, GVariant *v);
+
+#ifndef DBUS_BRIDGE_HEADER
+#include <stdarg.h>
+#include <string.h>
+
+#define DBUS_BRIDGE_PROPERTIES "org.freedesktop.DBus.Properties"
+
+struct dbus_bridge_watch {
+  struct dbus_bridge *bridge;
+  /* NULL until the connection to bus_type is there */
+  GDBusConnection *bus;
+  GBusType bus_type;
+  char *name;
+  char *path;
+  char *interface;
+  char *prefix;
+  guint signal;
+  guint watcher;
+  GCancellable *cancel;
+  struct dbus_bridge_watch *next;
+};
+
+struct dbus_bridge_call {
+  struct dbus_bridge *bridge;
+  long req;
+  dbus_bridge_reply_fn reply;
+  void *arg;
+  /* The rest only while it waits for its bus */
+  char *dest;
+  char *path;
+  char *interface;
+  char *method;
+  GVariant *params;
+};
+
+struct dbus_bridge {
+  struct databind *db;
+  struct dbus_bridge_watch *watches;
+  /* Indexed by GBusType, opened on first use and kept */
+  GDBusConnection *buses[3];
+  /* Also by GBusType: 0 not asked for yet, 1 connecting, 2 open, -1 failed */
+  int bus_state[3];
+  /* The calls made while their bus was connecting, in order */
+  GQueue pending[3];
+  /* For the calls still waiting for a reply */
+  GCancellable *cancel;
+  /* Scratch buffers, reused for every property */
+  GString *key;
+  GString *json;
+};
+
+DBUS_BRIDGE_API struct dbus_bridge *dbus_bridge_new(struct databind *db) {
+  struct dbus_bridge *b = g_new0(struct dbus_bridge, 1);
+  b->db = db;
+  b->cancel = g_cancellable_new();
+  b->key = g_string_sized_new(64);
+  b->json = g_string_sized_new(256);
+  return b;
+}
+
+static void dbus_bridge_call_free(struct dbus_bridge_call *c) {
+  g_free(c->dest);
+  g_free(c->path);
+  g_free(c->interface);
+  g_free(c->method);
+  if (c->params != NULL) {
+    g_variant_unref(c->params);
+  }
+  g_free(c);
+}
+
+DBUS_BRIDGE_API void dbus_bridge_free(struct dbus_bridge *b) {
+  struct dbus_bridge_watch *w, *next;
+  struct dbus_bridge_call *c;
+  int i;
+  if (b == NULL) {
+    return;
+  }
+  /* Also stops the connections still being opened */
+  g_cancellable_cancel(b->cancel);
+  g_object_unref(b->cancel);
+  for (w = b->watches; w != NULL; w = next) {
+    next = w->next;
+    /* A GetAll still in flight completes with G_IO_ERROR_CANCELLED */
+    g_cancellable_cancel(w->cancel);
+    g_object_unref(w->cancel);
+    if (w->bus != NULL) {
+      g_bus_unwatch_name(w->watcher);
+      g_dbus_connection_signal_unsubscribe(w->bus, w->signal);
+    }
+    g_free(w->name);
+    g_free(w->path);
+    g_free(w->interface);
+    g_free(w->prefix);
+    g_free(w);
+  }
+  for (i = 0; i < 3; i++) {
+    if (b->buses[i] != NULL) {
+      g_object_unref(b->buses[i]);
+    }
+    while ((c = (struct dbus_bridge_call *)g_queue_pop_head(&b->pending[i])) !=
+           NULL) {
+      dbus_bridge_call_free(c);
+    }
+  }
+  g_string_free(b->key, TRUE);
+  g_string_free(b->json, TRUE);
+  g_free(b);
+}
+
+static dbus_bridge_log_fn dbus_bridge_log_cb = NULL;
+static void *dbus_bridge_log_arg = NULL;
+
+DBUS_BRIDGE_API void dbus_bridge_set_log(dbus_bridge_log_fn fn, void *arg) {
+  dbus_bridge_log_cb = fn;
+  dbus_bridge_log_arg = arg;
+}
+
+static void dbus_bridge_log(const char *format, ...) {
+  char buf[512];
+  va_list ap;
+  va_start(ap, format);
+  vsnprintf(buf, sizeof(buf), format, ap);
+  va_end(ap);
+  if (dbus_bridge_log_cb != NULL) {
+    dbus_bridge_log_cb(buf, dbus_bridge_log_arg);
+  } else {
+    fprintf(stderr, "dbus-bridge: %s\n", buf);
+  }
+}
+
+static void dbus_bridge_escape(GString *out, const char *s) {
+  gsize at = out->len;
+  g_string_set_size(out, at + strlen(s) * 6 + 3);
+  g_string_truncate(out, at + databind_escape(out->str + at, s));
+}
+
+DBUS_BRIDGE_API void dbus_bridge_json(GString *out, GVariant *v) {
+  GVariantIter iter;
+  GVariant *child;
+  int first = 1;
+  switch (g_variant_classify(v)) {
+  case G_VARIANT_CLASS_BOOLEAN:
+    g_string_append(out, g_variant_get_boolean(v) ? "true" : "false");
+    break;
+  case G_VARIANT_CLASS_BYTE:
+    g_string_append_printf(out, "%u", g_variant_get_byte(v));
+    break;
+  case G_VARIANT_CLASS_INT16:
+    g_string_append_printf(out, "%d", g_variant_get_int16(v));
+    break;
+  case G_VARIANT_CLASS_UINT16:
+    g_string_append_printf(out, "%u", g_variant_get_uint16(v));
+    break;
+  case G_VARIANT_CLASS_INT32:
+    g_string_append_printf(out, "%d", g_variant_get_int32(v));
+    break;
+  case G_VARIANT_CLASS_UINT32:
+    g_string_append_printf(out, "%u", g_variant_get_uint32(v));
+    break;
+  case G_VARIANT_CLASS_INT64:
+    g_string_append_printf(out, "%" G_GINT64_FORMAT, g_variant_get_int64(v));
+    break;
+  case G_VARIANT_CLASS_UINT64:
+    g_string_append_printf(out, "%" G_GUINT64_FORMAT, g_variant_get_uint64(v));
+    break;
+  case G_VARIANT_CLASS_HANDLE:
+    g_string_append_printf(out, "%d", g_variant_get_handle(v));
+    break;
+  case G_VARIANT_CLASS_DOUBLE: {
+    double d = g_variant_get_double(v);
+    /* JSON has no NaN or Infinity */
+    if (d != d || d - d != 0) {
+      g_string_append(out, "null");
+    } else {
+      g_string_append_printf(out, "%.17g", d);
+    }
+    break;
+  }
+  case G_VARIANT_CLASS_STRING:
+  case G_VARIANT_CLASS_OBJECT_PATH:
+  case G_VARIANT_CLASS_SIGNATURE:
+    dbus_bridge_escape(out, g_variant_get_string(v, NULL));
+    break;
+  case G_VARIANT_CLASS_VARIANT:
+    child = g_variant_get_variant(v);
+    dbus_bridge_json(out, child);
+    g_variant_unref(child);
+    break;
+  case G_VARIANT_CLASS_MAYBE:
+    child = g_variant_get_maybe(v);
+    if (child == NULL) {
+      g_string_append(out, "null");
+    } else {
+      dbus_bridge_json(out, child);
+      g_variant_unref(child);
+    }
+    break;
+  case G_VARIANT_CLASS_ARRAY:
+  case G_VARIANT_CLASS_TUPLE:
+  case G_VARIANT_CLASS_DICT_ENTRY: {
+    const GVariantType *t = g_variant_get_type(v);
+    /* a{s*} and a{o*} are objects, anything else is an array */
+    int object = g_variant_type_is_array(t) &&
+                 g_variant_type_is_dict_entry(g_variant_type_element(t)) &&
+                 (g_variant_type_equal(
+                      g_variant_type_key(g_variant_type_element(t)),
+                      G_VARIANT_TYPE_STRING) ||
+                  g_variant_type_equal(
+                      g_variant_type_key(g_variant_type_element(t)),
+                      G_VARIANT_TYPE_OBJECT_PATH));
+    g_string_append_c(out, object ? '{' : '[');
+    g_variant_iter_init(&iter, v);
+    while ((child = g_variant_iter_next_value(&iter)) != NULL) {
+      if (!first) {
+        g_string_append_c(out, ',');
+      }
+      first = 0;
+      if (object) {
+        GVariant *key = g_variant_get_child_value(child, 0);
+        GVariant *value = g_variant_get_child_value(child, 1);
+        dbus_bridge_escape(out, g_variant_get_string(key, NULL));
+        g_string_append_c(out, ':');
+        dbus_bridge_json(out, value);
+        g_variant_unref(key);
+        g_variant_unref(value);
+      } else {
+        dbus_bridge_json(out, child);
+      }
+      g_variant_unref(child);
+    }
+    g_string_append_c(out, object ? '}' : ']');
+    break;
+  }
+  }
+}
+
+/* Stores every entry of an a{sv} of properties */
+static void dbus_bridge_store(struct dbus_bridge_watch *w, GVariant *props) {
+  struct dbus_bridge *b = w->bridge;
+  GVariantIter iter;
+  const char *name;
+  GVariant *value;
+  g_variant_iter_init(&iter, props);
+  while (g_variant_iter_next(&iter, "{&sv}", &name, &value)) {
+    g_string_assign(b->key, w->prefix);
+    g_string_append_c(b->key, '.');
+    g_string_append(b->key, name);
+    g_string_truncate(b->json, 0);
+    dbus_bridge_json(b->json, value);
+    databind_set(b->db, b->key->str, b->json->str);
+    g_variant_unref(value);
+  }
+}
+
+static void dbus_bridge_get_all_cb(GObject *source, GAsyncResult *res,
+                                   gpointer arg) {
+  GError *err = NULL;
+  GVariant *reply =
+      g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &err);
+  GVariant *props;
+  if (reply == NULL) {
+    if (!g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      struct dbus_bridge_watch *w = (struct dbus_bridge_watch *)arg;
+      dbus_bridge_log("GetAll %s %s: %s", w->path, w->interface,
+                      err->message);
+    }
+    g_error_free(err);
+    return;
+  }
+  props = g_variant_get_child_value(reply, 0);
+  dbus_bridge_store((struct dbus_bridge_watch *)arg, props);
+  g_variant_unref(props);
+  g_variant_unref(reply);
+}
+
+static void dbus_bridge_get_all(struct dbus_bridge_watch *w) {
+  g_dbus_connection_call(w->bus, w->name, w->path, DBUS_BRIDGE_PROPERTIES,
+                         "GetAll", g_variant_new("(s)", w->interface),
+                         G_VARIANT_TYPE("(a{sv})"), G_DBUS_CALL_FLAGS_NONE, -1,
+                         w->cancel, dbus_bridge_get_all_cb, w);
+}
+
+static void dbus_bridge_changed_cb(GDBusConnection *bus, const char *sender,
+                                   const char *path, const char *interface,
+                                   const char *signal, GVariant *params,
+                                   gpointer arg) {
+  struct dbus_bridge_watch *w = (struct dbus_bridge_watch *)arg;
+  GVariant *changed, *invalidated;
+  if (!g_variant_is_of_type(params, G_VARIANT_TYPE("(sa{sv}as)"))) {
+    return;
+  }
+  changed = g_variant_get_child_value(params, 1);
+  invalidated = g_variant_get_child_value(params, 2);
+  dbus_bridge_store(w, changed);
+  /* Invalidated means "changed, ask me": rare, one GetAll covers them all */
+  if (g_variant_n_children(invalidated) > 0) {
+    dbus_bridge_get_all(w);
+  }
+  g_variant_unref(changed);
+  g_variant_unref(invalidated);
+}
+
+/* At startup and whenever the service comes back, with fresh values */
+static void dbus_bridge_appeared_cb(GDBusConnection *bus, const char *name,
+                                    const char *owner, gpointer arg) {
+  dbus_bridge_get_all((struct dbus_bridge_watch *)arg);
+}
+
+/* Subscribes once the connection is there */
+static void dbus_bridge_watch_start(struct dbus_bridge_watch *w,
+                                    GDBusConnection *conn) {
+  w->bus = conn;
+  /* Subscribe first, so that no change falls between GetAll and the match */
+  w->signal = g_dbus_connection_signal_subscribe(
+      conn, w->name, DBUS_BRIDGE_PROPERTIES, "PropertiesChanged", w->path,
+      w->interface, G_DBUS_SIGNAL_FLAGS_NONE, dbus_bridge_changed_cb, w, NULL);
+  w->watcher = g_bus_watch_name_on_connection(
+      conn, w->name, G_BUS_NAME_WATCHER_FLAGS_NONE, dbus_bridge_appeared_cb,
+      NULL, w, NULL);
+}
+
+static void dbus_bridge_send(struct dbus_bridge *b, GDBusConnection *conn,
+                             const char *dest, const char *path,
+                             const char *interface, const char *method,
+                             GVariant *params, long req,
+                             dbus_bridge_reply_fn reply, void *arg);
+
+struct dbus_bridge_connect {
+  struct dbus_bridge *bridge;
+  GBusType bus;
+};
+
+static void dbus_bridge_bus_cb(GObject *source, GAsyncResult *res,
+                               gpointer arg) {
+  struct dbus_bridge_connect *connect = (struct dbus_bridge_connect *)arg;
+  struct dbus_bridge *b = connect->bridge;
+  GBusType bus = connect->bus;
+  struct dbus_bridge_watch *w;
+  struct dbus_bridge_call *c;
+  GError *err = NULL;
+  GDBusConnection *conn = g_bus_get_finish(res, &err);
+  g_free(connect);
+  if (conn == NULL &&
+      g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    /* The bridge is gone, and its queue with it */
+    g_error_free(err);
+    return;
+  }
+  b->buses[bus] = conn;
+  b->bus_state[bus] = conn != NULL ? 2 : -1;
+  if (conn == NULL) {
+    dbus_bridge_log("%s", err->message);
+  }
+  for (w = b->watches; w != NULL && conn != NULL; w = w->next) {
+    if (w->bus == NULL && w->bus_type == bus) {
+      dbus_bridge_watch_start(w, conn);
+    }
+  }
+  while ((c = (struct dbus_bridge_call *)g_queue_pop_head(&b->pending[bus])) !=
+         NULL) {
+    if (conn != NULL) {
+      dbus_bridge_send(b, conn, c->dest, c->path, c->interface, c->method,
+                       c->params, c->req, c->reply, c->arg);
+    } else if (c->reply != NULL) {
+      c->reply(b, c->req, NULL, err->message, c->arg);
+    }
+    dbus_bridge_call_free(c);
+  }
+  if (err != NULL) {
+    g_error_free(err);
+  }
+  (void)source;
+}
+
+/*
+ * The shared connection, one per bus for the whole process: NULL while it
+ * is being opened, which the first call starts without waiting for it.
+ */
+static GDBusConnection *dbus_bridge_bus(struct dbus_bridge *b, GBusType *bus) {
+  struct dbus_bridge_connect *connect;
+  if (*bus < 0 || *bus > 2) {
+    *bus = G_BUS_TYPE_SESSION;
+  }
+  if (b->bus_state[*bus] == 0) {
+    b->bus_state[*bus] = 1;
+    connect = g_new(struct dbus_bridge_connect, 1);
+    connect->bridge = b;
+    connect->bus = *bus;
+    g_bus_get(*bus, b->cancel, dbus_bridge_bus_cb, connect);
+  }
+  return b->buses[*bus];
+}
+
+DBUS_BRIDGE_API int dbus_bridge_watch(struct dbus_bridge *b, GBusType bus,
+                                      const char *name, const char *path,
+                                      const char *interface,
+                                      const char *prefix) {
+  struct dbus_bridge_watch *w;
+  GDBusConnection *conn = dbus_bridge_bus(b, &bus);
+  if (b->bus_state[bus] < 0) {
+    return -1;
+  }
+  w = g_new0(struct dbus_bridge_watch, 1);
+  w->bridge = b;
+  w->bus_type = bus;
+  w->name = g_strdup(name);
+  w->path = g_strdup(path);
+  w->interface = g_strdup(interface);
+  w->prefix = g_strdup(prefix);
+  w->cancel = g_cancellable_new();
+  if (conn != NULL) {
+    dbus_bridge_watch_start(w, conn);
+  }
+  w->next = b->watches;
+  b->watches = w;
+  return 0;
+}
+
+static void dbus_bridge_call_cb(GObject *source, GAsyncResult *res,
+                                gpointer arg) {
+  struct dbus_bridge_call *c = (struct dbus_bridge_call *)arg;
+  GError *err = NULL;
+  GVariant *reply =
+      g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &err);
+  if (reply != NULL) {
+    GString *json = c->bridge->json;
+    g_string_truncate(json, 0);
+    dbus_bridge_json(json, reply);
+    c->reply(c->bridge, c->req, json->str, NULL, c->arg);
+    g_variant_unref(reply);
+  } else {
+    /* Cancelled: the bridge is gone */
+    if (!g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      c->reply(c->bridge, c->req, NULL, err->message, c->arg);
+    }
+    g_error_free(err);
+  }
+  g_free(c);
+}
+
+static void dbus_bridge_send(struct dbus_bridge *b, GDBusConnection *conn,
+                             const char *dest, const char *path,
+                             const char *interface, const char *method,
+                             GVariant *params, long req,
+                             dbus_bridge_reply_fn reply, void *arg) {
+  struct dbus_bridge_call *c;
+  if (reply == NULL) {
+    /* Nobody waits for the reply: don't even ask for one */
+    GDBusMessage *msg =
+        g_dbus_message_new_method_call(dest, path, interface, method);
+    g_dbus_message_set_body(msg, params);
+    g_dbus_message_set_flags(msg, G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED);
+    g_dbus_connection_send_message(conn, msg, G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+                                   NULL, NULL);
+    g_object_unref(msg);
+  } else {
+    c = g_new0(struct dbus_bridge_call, 1);
+    c->bridge = b;
+    c->req = req;
+    c->reply = reply;
+    c->arg = arg;
+    g_dbus_connection_call(conn, dest, path, interface, method, params, NULL,
+                           G_DBUS_CALL_FLAGS_NONE, -1, b->cancel,
+                           dbus_bridge_call_cb, c);
+  }
+}
+
+DBUS_BRIDGE_API void dbus_bridge_call(struct dbus_bridge *b, GBusType bus,
+                                      const char *dest, const char *path,
+                                      const char *interface,
+                                      const char *method,
+                                      const char *signature, const char *args,
+                                      long req, dbus_bridge_reply_fn reply,
+                                      void *arg) {
+  GError *err = NULL;
+  GVariant *params = NULL;
+  struct dbus_bridge_call *c;
+  GDBusConnection *conn = dbus_bridge_bus(b, &bus);
+  if (b->bus_state[bus] < 0) {
+    err = g_error_new(G_IO_ERROR, G_IO_ERROR_NOT_CONNECTED,
+                      "The bus is not available");
+  } else if (signature != NULL && !g_variant_type_string_is_valid(signature)) {
+    err = g_error_new(G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                      "Bad signature '%s'", signature);
+  }
+  if (err == NULL && args != NULL) {
+    params = g_variant_parse(signature != NULL ? G_VARIANT_TYPE(signature)
+                                               : NULL,
+                             args, NULL, NULL, &err);
+    if (params != NULL && !g_variant_is_of_type(params, G_VARIANT_TYPE_TUPLE)) {
+      /* A single argument given without its tuple */
+      GVariant *one = params;
+      params = g_variant_ref_sink(g_variant_new_tuple(&one, 1));
+      g_variant_unref(one);
+    }
+  }
+  if (err != NULL) {
+    if (reply != NULL) {
+      reply(b, req, NULL, err->message, arg);
+    }
+    g_error_free(err);
+    return;
+  }
+  if (conn == NULL) {
+    /* Still connecting: keep it, params included, for when it is there */
+    c = g_new0(struct dbus_bridge_call, 1);
+    c->bridge = b;
+    c->req = req;
+    c->reply = reply;
+    c->arg = arg;
+    c->dest = g_strdup(dest);
+    c->path = g_strdup(path);
+    c->interface = g_strdup(interface);
+    c->method = g_strdup(method);
+    c->params = params;
+    g_queue_push_tail(&b->pending[bus], c);
+    return;
+  }
+  dbus_bridge_send(b, conn, dest, path, interface, method, params, req, reply,
+                   arg);
+  /* Parsed values are not floating: neither call took them over */
+  if (params != NULL) {
+    g_variant_unref(params);
+  }
+}
+
+#endif /* DBUS_BRIDGE_HEADER */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DBUS_BRIDGE_H */
@@ -1,9 +1,6 @@
 
-./webview-example&
-/bin/sleep 0.3
-
-#wmctrl -r e182d4d56ea0fe8601cc65486e757ebf -b add,fullscreen
-#wmctrl -r e182d4d56ea0fe8601cc65486e757ebf -b add,below
-wmctrl -r e182d4d56ea0fe8601cc65486e757ebf -b add,skip_taskbar
+# The window sets its role for the window manager itself, before it is first
+# mapped: no sleep, no wmctrl, no lookup by title
+./webview-example --window-hints maximized,below,sticky,skip_taskbar,skip_pager&
 
 #xdotool search --name e182d4d56ea0fe8601cc65486e757ebf behave %@ focus exec ./wmctrl-stuff.sh
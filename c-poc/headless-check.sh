@@ -0,0 +1,9 @@
+#!/bin/sh
+# Renders a widget page offscreen under Xvfb and keeps the PNG and frame times
+# Usage: ./headless-check.sh file:///path/to/page.html [outdir]
+
+OUT=${2:-headless-out}
+mkdir -p $OUT
+xvfb-run -a -s "-screen 0 1920x1080x24" \
+    ./webview-example --headless $OUT/frame.png --size 1920x1080 --scale 1 \
+                      --frame-log $OUT/frames.csv --url $1
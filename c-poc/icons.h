@@ -0,0 +1,313 @@
+/*
+ * Application icons and image thumbnails for the page, looked up once.
+ *
+ *   struct icons *icons = icons_new(4 * 1024 * 1024);
+ *   icons_register(icons, &webview);
+ *
+ *   <img src="icon:///48/firefox">
+ *   <img src="icon:///32@2/org.gnome.Nautilus">     (32 px at scale 2)
+ *   <img src="icon:///128/%2Fhome%2Fme%2Fphoto.jpg"> (a file, escaped)
+ *
+ * The name is anything g_icon_new_for_string() takes: an icon name, a path or
+ * a file:// URI. It is resolved through the GTK icon theme, decoded at that
+ * size off the GTK thread, and kept as PNG in an LRU of at most max_bytes.
+ * Responses carry Cache-Control, so WebKit does not even ask again for a
+ * while. A theme change empties the cache.
+ */
+#ifndef ICONS_H
+#define ICONS_H
+
+#include "webview.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef ICONS_STATIC
+#define ICONS_API static
+#else
+#define ICONS_API extern
+#endif
+
+#define ICONS_SCHEME "icon"
+/* How long WebKit may reuse a response without asking again */
+#define ICONS_MAX_AGE_S 3600
+#define ICONS_MAX_SIZE 1024
+#define ICONS_MAX_SCALE 4
+
+struct icons;
+
+ICONS_API struct icons *icons_new(size_t max_bytes);
+
+/**
+ * Frees the cache. Lookups still in flight keep what they need.
+ */
+ICONS_API void icons_free(struct icons *icons);
+
+/**
+ * Serves icon:///<size>[@<scale>]/<name> to the page of w.
+ */
+ICONS_API void icons_register(struct icons *icons, struct webview *w);
+
+/**
+ * Hits and misses so far, and the bytes cached now.
+ */
+ICONS_API void icons_stats(struct icons *icons, unsigned long *hits,
+                           unsigned long *misses, size_t *bytes);
+
+#ifndef ICONS_HEADER
+#include <stdlib.h>
+#include <string.h>
+
+struct icons_entry {
+  char *key;
+  GBytes *png;
+  GList *link; /* In lru */
+};
+
+struct icons {
+  int refs; /* The owner's, and one per lookup in flight */
+  GHashTable *entries; /* "size@scale/name" -> struct icons_entry */
+  GQueue lru;          /* Most recently used first */
+  size_t bytes;
+  size_t max_bytes;
+  GtkIconTheme *theme;
+  gulong changed_id;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned int theme_gen; /* Bumped by each theme change */
+};
+
+struct icons_lookup {
+  struct icons *icons;
+  char *key;
+  WebKitURISchemeRequest *request;
+  unsigned int theme_gen; /* When it started */
+};
+
+static void icons_entry_free(gpointer arg) {
+  struct icons_entry *e = (struct icons_entry *)arg;
+  g_free(e->key);
+  g_bytes_unref(e->png);
+  g_free(e);
+}
+
+static void icons_clear(struct icons *icons) {
+  g_hash_table_remove_all(icons->entries);
+  g_queue_clear(&icons->lru);
+  icons->bytes = 0;
+}
+
+static void icons_theme_changed_cb(GtkIconTheme *theme, gpointer arg) {
+  struct icons *icons = (struct icons *)arg;
+  (void)theme;
+  icons->theme_gen++;
+  icons_clear(icons);
+}
+
+static void icons_unref(struct icons *icons) {
+  if (--icons->refs > 0) {
+    return;
+  }
+  g_hash_table_destroy(icons->entries);
+  g_queue_clear(&icons->lru);
+  g_free(icons);
+}
+
+ICONS_API struct icons *icons_new(size_t max_bytes) {
+  struct icons *icons = g_new0(struct icons, 1);
+  icons->refs = 1;
+  icons->entries =
+      g_hash_table_new_full(g_str_hash, g_str_equal, NULL, icons_entry_free);
+  g_queue_init(&icons->lru);
+  icons->max_bytes = max_bytes;
+  icons->theme = gtk_icon_theme_get_default();
+  icons->changed_id = g_signal_connect(icons->theme, "changed",
+                                       G_CALLBACK(icons_theme_changed_cb),
+                                       icons);
+  return icons;
+}
+
+ICONS_API void icons_free(struct icons *icons) {
+  if (icons == NULL) {
+    return;
+  }
+  g_signal_handler_disconnect(icons->theme, icons->changed_id);
+  icons->theme = NULL;
+  icons_clear(icons);
+  icons_unref(icons);
+}
+
+ICONS_API void icons_stats(struct icons *icons, unsigned long *hits,
+                           unsigned long *misses, size_t *bytes) {
+  *hits = icons->hits;
+  *misses = icons->misses;
+  *bytes = icons->bytes;
+}
+
+static void icons_respond(WebKitURISchemeRequest *request, GBytes *png) {
+  GInputStream *stream = g_memory_input_stream_new_from_bytes(png);
+#if WEBKIT_CHECK_VERSION(2, 36, 0)
+  WebKitURISchemeResponse *response =
+      webkit_uri_scheme_response_new(stream, g_bytes_get_size(png));
+  SoupMessageHeaders *headers =
+      soup_message_headers_new(SOUP_MESSAGE_HEADERS_RESPONSE);
+  char cache[48];
+  snprintf(cache, sizeof(cache), "max-age=%d", ICONS_MAX_AGE_S);
+  soup_message_headers_append(headers, "Cache-Control", cache);
+  webkit_uri_scheme_response_set_content_type(response, "image/png");
+  webkit_uri_scheme_response_set_http_headers(response, headers);
+  webkit_uri_scheme_request_finish_with_response(request, response);
+  g_object_unref(response);
+#else
+  webkit_uri_scheme_request_finish(request, stream, g_bytes_get_size(png),
+                                   "image/png");
+#endif
+  g_object_unref(stream);
+}
+
+static void icons_fail(WebKitURISchemeRequest *request, const char *path,
+                       const char *why) {
+  GError *error = g_error_new(G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "%s: %s",
+                              path, why);
+  webkit_uri_scheme_request_finish_error(request, error);
+  g_error_free(error);
+}
+
+static void icons_add(struct icons *icons, char *key, GBytes *png) {
+  struct icons_entry *e =
+      (struct icons_entry *)g_hash_table_lookup(icons->entries, key);
+  /* Two requests for it may have been in flight */
+  if (e != NULL) {
+    g_queue_delete_link(&icons->lru, e->link);
+    icons->bytes -= g_bytes_get_size(e->png);
+    g_hash_table_remove(icons->entries, key);
+  }
+  e = g_new(struct icons_entry, 1);
+  e->key = key;
+  e->png = g_bytes_ref(png);
+  g_queue_push_head(&icons->lru, e);
+  e->link = icons->lru.head;
+  g_hash_table_insert(icons->entries, e->key, e);
+  icons->bytes += g_bytes_get_size(png);
+  while (icons->bytes > icons->max_bytes && icons->lru.length > 1) {
+    struct icons_entry *old = (struct icons_entry *)g_queue_pop_tail(&icons->lru);
+    icons->bytes -= g_bytes_get_size(old->png);
+    g_hash_table_remove(icons->entries, old->key);
+  }
+}
+
+static void icons_loaded_cb(GObject *source, GAsyncResult *result,
+                            gpointer arg) {
+  struct icons_lookup *l = (struct icons_lookup *)arg;
+  GError *error = NULL;
+  GdkPixbuf *pixbuf =
+      gtk_icon_info_load_icon_finish(GTK_ICON_INFO(source), result, &error);
+  gchar *data = NULL;
+  gsize len = 0;
+  if (pixbuf != NULL &&
+      gdk_pixbuf_save_to_buffer(pixbuf, &data, &len, "png", &error, NULL)) {
+    GBytes *png = g_bytes_new_take(data, len);
+    /* Not an icon of the theme before the last change */
+    if (l->icons->max_bytes > 0 && l->icons->theme != NULL &&
+        l->theme_gen == l->icons->theme_gen) {
+      icons_add(l->icons, l->key, png);
+      l->key = NULL;
+    }
+    icons_respond(l->request, png);
+    g_bytes_unref(png);
+  } else {
+    icons_fail(l->request, l->key, error != NULL ? error->message : "no icon");
+  }
+  if (pixbuf != NULL) {
+    g_object_unref(pixbuf);
+  }
+  if (error != NULL) {
+    g_error_free(error);
+  }
+  g_object_unref(source);
+  g_object_unref(l->request);
+  icons_unref(l->icons);
+  g_free(l->key);
+  g_free(l);
+}
+
+/* "48/firefox" or "32@2/org.gnome.Nautilus" */
+static int icons_parse(const char *path, int *size, int *scale,
+                       char **name) {
+  char *end;
+  while (*path == '/') {
+    path++;
+  }
+  *size = (int)strtol(path, &end, 10);
+  *scale = 1;
+  if (*end == '@') {
+    *scale = (int)strtol(end + 1, &end, 10);
+  }
+  if (*end != '/' || end[1] == '\0' || *size < 1 || *size > ICONS_MAX_SIZE ||
+      *scale < 1 || *scale > ICONS_MAX_SCALE) {
+    return -1;
+  }
+  *name = g_uri_unescape_string(end + 1, NULL);
+  return *name != NULL ? 0 : -1;
+}
+
+static void icons_scheme_cb(WebKitURISchemeRequest *request, gpointer arg) {
+  struct icons *icons = (struct icons *)arg;
+  const char *path = webkit_uri_scheme_request_get_path(request);
+  struct icons_entry *e;
+  struct icons_lookup *l;
+  GtkIconInfo *info;
+  GIcon *icon;
+  char *name, *key;
+  int size, scale;
+  if (icons_parse(path, &size, &scale, &name) != 0) {
+    icons_fail(request, path, "expected icon:///<size>[@<scale>]/<name>");
+    return;
+  }
+  key = g_strdup_printf("%d@%d/%s", size, scale, name);
+  e = (struct icons_entry *)g_hash_table_lookup(icons->entries, key);
+  if (e != NULL) {
+    icons->hits++;
+    g_queue_unlink(&icons->lru, e->link);
+    g_queue_push_head_link(&icons->lru, e->link);
+    icons_respond(request, e->png);
+    g_free(key);
+    g_free(name);
+    return;
+  }
+  icons->misses++;
+  icon = g_icon_new_for_string(name, NULL);
+  info = icon != NULL ? gtk_icon_theme_lookup_by_gicon_for_scale(
+                            icons->theme, icon, size, scale,
+                            GTK_ICON_LOOKUP_FORCE_SIZE)
+                      : NULL;
+  g_free(name);
+  if (icon != NULL) {
+    g_object_unref(icon);
+  }
+  if (info == NULL) {
+    icons_fail(request, path, "not in the icon theme");
+    g_free(key);
+    return;
+  }
+  l = g_new(struct icons_lookup, 1);
+  l->icons = icons;
+  l->key = key;
+  l->request = (WebKitURISchemeRequest *)g_object_ref(request);
+  l->theme_gen = icons->theme_gen;
+  icons->refs++;
+  gtk_icon_info_load_icon_async(info, NULL, icons_loaded_cb, l);
+}
+
+ICONS_API void icons_register(struct icons *icons, struct webview *w) {
+  webview_register_uri_scheme(w, ICONS_SCHEME, icons_scheme_cb, icons);
+}
+
+#endif /* ICONS_HEADER */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ICONS_H */
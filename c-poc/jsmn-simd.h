@@ -0,0 +1,564 @@
+/*
+ * jsmn_parse_simd(): a drop-in for jsmn_parse() (same parser, same tokens,
+ * same errors, same resumption after JSMN_ERROR_NOMEM or JSMN_ERROR_PART)
+ * for large payloads.
+ *
+ * jsmn_parse() looks at every byte through a switch. Here the bytes that
+ * cannot change the parser state (string contents, primitive bodies,
+ * whitespace runs) are skipped 16 or 32 at a time by comparing whole
+ * vectors against the few bytes that matter, with SSE2, or AVX2 when the
+ * CPU has it; anything else gets the same scalar code as jsmn.h. Closing
+ * brackets and commas find their container on a stack instead of walking
+ * the tokens backwards, so deep documents stay linear.
+ *
+ * Define JSMN_SIMD_SCALAR to leave the vector code out.
+ */
+#ifndef JSMN_SIMD_H
+#define JSMN_SIMD_H
+
+#include "jsmn.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+JSMN_API int jsmn_parse_simd(jsmn_parser *parser, const char *js,
+                             const size_t len, jsmntok_t *tokens,
+                             const unsigned int num_tokens);
+
+#ifndef JSMN_HEADER
+
+#if !defined(JSMN_SIMD_SCALAR) && defined(__GNUC__) &&                        \
+    (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define JSMN_SIMD_X86
+#include <immintrin.h>
+#endif
+
+/* Open containers deeper than this fall back to the backward token walk */
+#define JSMN_SIMD_STACK 256
+
+/* Which bytes stop a skip */
+enum {
+  JSMN_SIMD_STRING,    /* " \ and NUL */
+  JSMN_SIMD_PRIMITIVE, /* : , ] } space, and below 32 or from 127 */
+  JSMN_SIMD_SPACE      /* anything but space, \t, \r and \n */
+};
+
+static inline int jsmn_simd_stops(unsigned char c, int what) {
+  switch (what) {
+  case JSMN_SIMD_STRING:
+    return c == '\"' || c == '\\' || c == '\0';
+  case JSMN_SIMD_PRIMITIVE:
+    return c == ':' || c == ',' || c == ']' || c == '}' || c == ' ' ||
+           c < 32 || c >= 127;
+  default:
+    return c != ' ' && c != '\t' && c != '\r' && c != '\n';
+  }
+}
+
+#ifdef JSMN_SIMD_X86
+static inline unsigned int jsmn_simd_mask16(__m128i v, int what) {
+  __m128i m;
+  switch (what) {
+  case JSMN_SIMD_STRING:
+    m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\"')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+        _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    break;
+  case JSMN_SIMD_PRIMITIVE:
+    m = _mm_or_si128(
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8(','))),
+                     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(']')),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('}')))),
+        _mm_or_si128(
+            _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+            /* Unsigned v <= 31 or v >= 127 */
+            _mm_or_si128(
+                _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(31)), v),
+                _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(127)), v))));
+    break;
+  default:
+    m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+    return ~(unsigned int)_mm_movemask_epi8(m) & 0xffff;
+  }
+  return (unsigned int)_mm_movemask_epi8(m);
+}
+
+__attribute__((target("avx2"))) static size_t
+jsmn_simd_skip_avx2(const char *js, size_t pos, const size_t len, int what) {
+  const __m256i quote = _mm256_set1_epi8('\"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i sp = _mm256_set1_epi8(' ');
+  for (; pos + 32 <= len; pos += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(js + pos));
+    unsigned int mask;
+    if (what == JSMN_SIMD_STRING) {
+      mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(
+          _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                          _mm256_cmpeq_epi8(v, backslash)),
+          _mm256_cmpeq_epi8(v, zero)));
+    } else if (what == JSMN_SIMD_PRIMITIVE) {
+      __m256i m = _mm256_or_si256(
+          _mm256_or_si256(
+              _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')),
+                              _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))),
+              _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(']')),
+                              _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}')))),
+          _mm256_or_si256(
+              _mm256_cmpeq_epi8(v, sp),
+              _mm256_or_si256(
+                  _mm256_cmpeq_epi8(
+                      _mm256_min_epu8(v, _mm256_set1_epi8(31)), v),
+                  _mm256_cmpeq_epi8(
+                      _mm256_max_epu8(v, _mm256_set1_epi8(127)), v))));
+      mask = (unsigned int)_mm256_movemask_epi8(m);
+    } else {
+      __m256i m = _mm256_or_si256(
+          _mm256_or_si256(_mm256_cmpeq_epi8(v, sp),
+                          _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+          _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')),
+                          _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))));
+      mask = ~(unsigned int)_mm256_movemask_epi8(m);
+    }
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+  return pos;
+}
+
+static int jsmn_simd_have_avx2(void) {
+  static int have = -1;
+  if (have < 0) {
+    __builtin_cpu_init();
+    have = __builtin_cpu_supports("avx2") ? 1 : 0;
+  }
+  return have;
+}
+#endif
+
+/**
+ * Returns the position of the first byte from pos on that stops the skip,
+ * or len.
+ */
+static inline size_t jsmn_simd_skip(const char *js, size_t pos, const size_t len,
+                             int what) {
+#ifdef JSMN_SIMD_X86
+  /* Short runs are the common case in small payloads: look first */
+  if (pos < len && jsmn_simd_stops((unsigned char)js[pos], what)) {
+    return pos;
+  }
+  if (len - pos >= 64 && jsmn_simd_have_avx2()) {
+    pos = jsmn_simd_skip_avx2(js, pos, len, what);
+  }
+  for (; pos + 16 <= len; pos += 16) {
+    unsigned int mask = jsmn_simd_mask16(
+        _mm_loadu_si128((const __m128i *)(js + pos)), what);
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; pos < len; pos++) {
+    if (jsmn_simd_stops((unsigned char)js[pos], what)) {
+      break;
+    }
+  }
+  return pos;
+}
+
+static jsmntok_t *jsmn_simd_alloc_token(jsmn_parser *parser,
+                                        jsmntok_t *tokens,
+                                        const size_t num_tokens) {
+  jsmntok_t *tok;
+  if (parser->toknext >= num_tokens) {
+    return NULL;
+  }
+  tok = &tokens[parser->toknext++];
+  tok->start = tok->end = -1;
+  tok->size = 0;
+#ifdef JSMN_PARENT_LINKS
+  tok->parent = -1;
+#endif
+  return tok;
+}
+
+static void jsmn_simd_fill_token(jsmntok_t *token, const jsmntype_t type,
+                                 const int start, const int end) {
+  token->type = type;
+  token->start = start;
+  token->end = end;
+  token->size = 0;
+}
+
+static int jsmn_simd_parse_primitive(jsmn_parser *parser, const char *js,
+                                     const size_t len, jsmntok_t *tokens,
+                                     const size_t num_tokens) {
+  jsmntok_t *token;
+  int start;
+
+  start = parser->pos;
+
+  for (; parser->pos < len; parser->pos++) {
+    parser->pos = jsmn_simd_skip(js, parser->pos, len, JSMN_SIMD_PRIMITIVE);
+    if (parser->pos >= len || js[parser->pos] == '\0') {
+      break;
+    }
+    switch (js[parser->pos]) {
+#ifndef JSMN_STRICT
+    case ':':
+#endif
+    case '\t':
+    case '\r':
+    case '\n':
+    case ' ':
+    case ',':
+    case ']':
+    case '}':
+      goto found;
+    }
+    if (js[parser->pos] < 32 || js[parser->pos] >= 127) {
+      parser->pos = start;
+      return JSMN_ERROR_INVAL;
+    }
+  }
+#ifdef JSMN_STRICT
+  parser->pos = start;
+  return JSMN_ERROR_PART;
+#endif
+
+found:
+  if (tokens == NULL) {
+    parser->pos--;
+    return 0;
+  }
+  token = jsmn_simd_alloc_token(parser, tokens, num_tokens);
+  if (token == NULL) {
+    parser->pos = start;
+    return JSMN_ERROR_NOMEM;
+  }
+  jsmn_simd_fill_token(token, JSMN_PRIMITIVE, start, parser->pos);
+#ifdef JSMN_PARENT_LINKS
+  token->parent = parser->toksuper;
+#endif
+  parser->pos--;
+  return 0;
+}
+
+static int jsmn_simd_parse_string(jsmn_parser *parser, const char *js,
+                                  const size_t len, jsmntok_t *tokens,
+                                  const size_t num_tokens) {
+  jsmntok_t *token;
+
+  int start = parser->pos;
+
+  parser->pos++;
+
+  for (; parser->pos < len; parser->pos++) {
+    char c;
+    parser->pos = jsmn_simd_skip(js, parser->pos, len, JSMN_SIMD_STRING);
+    if (parser->pos >= len || js[parser->pos] == '\0') {
+      break;
+    }
+    c = js[parser->pos];
+
+    if (c == '\"') {
+      if (tokens == NULL) {
+        return 0;
+      }
+      token = jsmn_simd_alloc_token(parser, tokens, num_tokens);
+      if (token == NULL) {
+        parser->pos = start;
+        return JSMN_ERROR_NOMEM;
+      }
+      jsmn_simd_fill_token(token, JSMN_STRING, start + 1, parser->pos);
+#ifdef JSMN_PARENT_LINKS
+      token->parent = parser->toksuper;
+#endif
+      return 0;
+    }
+
+    if (c == '\\' && parser->pos + 1 < len) {
+      int i;
+      parser->pos++;
+      switch (js[parser->pos]) {
+      case '\"':
+      case '/':
+      case '\\':
+      case 'b':
+      case 'f':
+      case 'r':
+      case 'n':
+      case 't':
+        break;
+      case 'u':
+        parser->pos++;
+        for (i = 0; i < 4 && parser->pos < len && js[parser->pos] != '\0';
+             i++) {
+          if (!((js[parser->pos] >= 48 && js[parser->pos] <= 57) ||   /* 0-9 */
+                (js[parser->pos] >= 65 && js[parser->pos] <= 70) ||   /* A-F */
+                (js[parser->pos] >= 97 && js[parser->pos] <= 102))) { /* a-f */
+            parser->pos = start;
+            return JSMN_ERROR_INVAL;
+          }
+          parser->pos++;
+        }
+        parser->pos--;
+        break;
+      default:
+        parser->pos = start;
+        return JSMN_ERROR_INVAL;
+      }
+    }
+  }
+  parser->pos = start;
+  return JSMN_ERROR_PART;
+}
+
+JSMN_API int jsmn_parse_simd(jsmn_parser *parser, const char *js,
+                             const size_t len, jsmntok_t *tokens,
+                             const unsigned int num_tokens) {
+  int r;
+  int i;
+  jsmntok_t *token;
+  int count = parser->toknext;
+#ifndef JSMN_PARENT_LINKS
+  /* Open containers, innermost last. The parser keeps no such thing
+   * between calls: rebuild it from the tokens of the previous ones. */
+  int stack[JSMN_SIMD_STACK];
+  int depth = 0;
+  int overflow = 0;
+  if (tokens != NULL) {
+    for (i = 0; i < (int)parser->toknext; i++) {
+      if (tokens[i].start != -1 && tokens[i].end == -1) {
+        if (depth == JSMN_SIMD_STACK) {
+          overflow = 1;
+          break;
+        }
+        stack[depth++] = i;
+      }
+    }
+  }
+#endif
+
+  for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++) {
+    char c;
+    jsmntype_t type;
+
+    c = js[parser->pos];
+    switch (c) {
+    case '{':
+    case '[':
+      count++;
+      if (tokens == NULL) {
+        break;
+      }
+      token = jsmn_simd_alloc_token(parser, tokens, num_tokens);
+      if (token == NULL) {
+        return JSMN_ERROR_NOMEM;
+      }
+      if (parser->toksuper != -1) {
+        jsmntok_t *t = &tokens[parser->toksuper];
+#ifdef JSMN_STRICT
+        if (t->type == JSMN_OBJECT) {
+          return JSMN_ERROR_INVAL;
+        }
+#endif
+        t->size++;
+#ifdef JSMN_PARENT_LINKS
+        token->parent = parser->toksuper;
+#endif
+      }
+      token->type = (c == '{' ? JSMN_OBJECT : JSMN_ARRAY);
+      token->start = parser->pos;
+      parser->toksuper = parser->toknext - 1;
+#ifndef JSMN_PARENT_LINKS
+      if (depth == JSMN_SIMD_STACK) {
+        overflow = 1;
+      } else if (!overflow) {
+        stack[depth++] = parser->toknext - 1;
+      }
+#endif
+      break;
+    case '}':
+    case ']':
+      if (tokens == NULL) {
+        break;
+      }
+      type = (c == '}' ? JSMN_OBJECT : JSMN_ARRAY);
+#ifdef JSMN_PARENT_LINKS
+      if (parser->toknext < 1) {
+        return JSMN_ERROR_INVAL;
+      }
+      token = &tokens[parser->toknext - 1];
+      for (;;) {
+        if (token->start != -1 && token->end == -1) {
+          if (token->type != type) {
+            return JSMN_ERROR_INVAL;
+          }
+          token->end = parser->pos + 1;
+          parser->toksuper = token->parent;
+          break;
+        }
+        if (token->parent == -1) {
+          if (token->type != type || parser->toksuper == -1) {
+            return JSMN_ERROR_INVAL;
+          }
+          break;
+        }
+        token = &tokens[token->parent];
+      }
+#else
+      if (!overflow) {
+        if (depth == 0) {
+          return JSMN_ERROR_INVAL;
+        }
+        token = &tokens[stack[depth - 1]];
+        if (token->type != type) {
+          return JSMN_ERROR_INVAL;
+        }
+        token->end = parser->pos + 1;
+        depth--;
+        parser->toksuper = depth > 0 ? stack[depth - 1] : -1;
+        break;
+      }
+      /* Too deep for the stack: jsmn.h's walk */
+      for (i = parser->toknext - 1; i >= 0; i--) {
+        token = &tokens[i];
+        if (token->start != -1 && token->end == -1) {
+          if (token->type != type) {
+            return JSMN_ERROR_INVAL;
+          }
+          parser->toksuper = -1;
+          token->end = parser->pos + 1;
+          break;
+        }
+      }
+      if (i == -1) {
+        return JSMN_ERROR_INVAL;
+      }
+      for (; i >= 0; i--) {
+        token = &tokens[i];
+        if (token->start != -1 && token->end == -1) {
+          parser->toksuper = i;
+          break;
+        }
+      }
+#endif
+      break;
+    case '\"':
+      r = jsmn_simd_parse_string(parser, js, len, tokens, num_tokens);
+      if (r < 0) {
+        return r;
+      }
+      count++;
+      if (parser->toksuper != -1 && tokens != NULL) {
+        tokens[parser->toksuper].size++;
+      }
+      break;
+    case '\t':
+    case '\r':
+    case '\n':
+    case ' ':
+      /* Lands on the last blank: the loop steps past it */
+      parser->pos =
+          jsmn_simd_skip(js, parser->pos + 1, len, JSMN_SIMD_SPACE) - 1;
+      break;
+    case ':':
+      parser->toksuper = parser->toknext - 1;
+      break;
+    case ',':
+      if (tokens != NULL && parser->toksuper != -1 &&
+          tokens[parser->toksuper].type != JSMN_ARRAY &&
+          tokens[parser->toksuper].type != JSMN_OBJECT) {
+#ifdef JSMN_PARENT_LINKS
+        parser->toksuper = tokens[parser->toksuper].parent;
+#else
+        if (!overflow) {
+          if (depth > 0) {
+            parser->toksuper = stack[depth - 1];
+          }
+          break;
+        }
+        for (i = parser->toknext - 1; i >= 0; i--) {
+          if (tokens[i].type == JSMN_ARRAY || tokens[i].type == JSMN_OBJECT) {
+            if (tokens[i].start != -1 && tokens[i].end == -1) {
+              parser->toksuper = i;
+              break;
+            }
+          }
+        }
+#endif
+      }
+      break;
+#ifdef JSMN_STRICT
+    case '-':
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+    case 't':
+    case 'f':
+    case 'n':
+      if (tokens != NULL && parser->toksuper != -1) {
+        const jsmntok_t *t = &tokens[parser->toksuper];
+        if (t->type == JSMN_OBJECT ||
+            (t->type == JSMN_STRING && t->size != 0)) {
+          return JSMN_ERROR_INVAL;
+        }
+      }
+#else
+    default:
+#endif
+      r = jsmn_simd_parse_primitive(parser, js, len, tokens, num_tokens);
+      if (r < 0) {
+        return r;
+      }
+      count++;
+      if (parser->toksuper != -1 && tokens != NULL) {
+        tokens[parser->toksuper].size++;
+      }
+      break;
+
+#ifdef JSMN_STRICT
+    default:
+      return JSMN_ERROR_INVAL;
+#endif
+    }
+  }
+
+  if (tokens != NULL) {
+#ifndef JSMN_PARENT_LINKS
+    if (!overflow) {
+      return depth > 0 ? JSMN_ERROR_PART : count;
+    }
+#endif
+    for (i = parser->toknext - 1; i >= 0; i--) {
+      if (tokens[i].start != -1 && tokens[i].end == -1) {
+        return JSMN_ERROR_PART;
+      }
+    }
+  }
+
+  return count;
+}
+
+#endif /* JSMN_HEADER */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JSMN_SIMD_H */
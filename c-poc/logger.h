@@ -0,0 +1,390 @@
+/*
+ * Logging that never blocks the thread that logs.
+ *
+ *   logger_start(getenv("WEBVIEW_LOG"));   // e.g. "info,invoke=debug"
+ *   logger_debug("invoke", "got %zu bytes", len);
+ *   ...
+ *   logger_stop();                          // writes what is left
+ *
+ * A message costs its vsnprintf() into a slot of a fixed ring, taken with one
+ * compare-and-swap: no lock, no allocation, no system call. A background
+ * thread adds the time, level and module and writes whole batches to stderr
+ * with one write(). It sleeps while the ring is empty, and only the message
+ * that finds it asleep takes the lock, to wake it. When the ring is full messages are dropped, and counted,
+ * rather than waited for; messages longer than a slot are cut.
+ *
+ * Filters are a comma separated list of a default level and module=level
+ * pairs (error, warn, info, debug). Each call site keeps the level of its
+ * module, so a filtered-out message costs two loads and a compare.
+ */
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef LOGGER_STATIC
+#define LOGGER_API static
+#else
+#define LOGGER_API extern
+#endif
+
+/* Slots in the ring (a power of two) and the text each one holds */
+#define LOGGER_SLOTS 1024
+#define LOGGER_TEXT 240
+
+enum logger_level {
+  LOGGER_ERROR,
+  LOGGER_WARN,
+  LOGGER_INFO,
+  LOGGER_DEBUG,
+};
+
+/* One per call site, by way of the macros below */
+struct logger_site {
+  const char *module;
+  int level;      /* Most verbose level let through */
+  int generation; /* Of the filters level was computed for */
+};
+
+#define logger_log(module, level, ...)                                         \
+  do {                                                                         \
+    static struct logger_site logger_site_ = {module, 0, -1};                  \
+    if (logger_enabled(&logger_site_, level)) {                                \
+      logger_write(&logger_site_, level, __VA_ARGS__);                         \
+    }                                                                          \
+  } while (0)
+#define logger_error(module, ...) logger_log(module, LOGGER_ERROR, __VA_ARGS__)
+#define logger_warn(module, ...) logger_log(module, LOGGER_WARN, __VA_ARGS__)
+#define logger_info(module, ...) logger_log(module, LOGGER_INFO, __VA_ARGS__)
+#define logger_debug(module, ...) logger_log(module, LOGGER_DEBUG, __VA_ARGS__)
+
+/**
+ * Sets the filters and starts the writer thread. Until then, and after
+ * logger_stop(), messages are written straight away. Returns 0, or -1 if the
+ * filters are not valid: the previous ones are kept, and the thread started
+ * all the same.
+ */
+LOGGER_API int logger_start(const char *filters);
+
+/**
+ * Writes what is still in the ring and stops the writer thread.
+ */
+LOGGER_API void logger_stop(void);
+
+/**
+ * Replaces the filters, from any thread. Returns 0, or -1 if they are not
+ * valid.
+ */
+LOGGER_API int logger_set_filters(const char *filters);
+
+/**
+ * Messages dropped so far because the ring was full.
+ */
+LOGGER_API uint64_t logger_dropped(void);
+
+LOGGER_API int logger_enabled(struct logger_site *site, int level);
+LOGGER_API void logger_write(const struct logger_site *site, int level,
+                             const char *format, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 3, 4)))
+#endif
+    ;
+
+#ifndef LOGGER_HEADER
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOGGER_MAX_FILTERS 32
+
+struct logger_slot {
+  size_t seq; /* Position it is free for, or position + 1 once written */
+  int64_t t_us;
+  const struct logger_site *site;
+  int level;
+  int len;
+  char text[LOGGER_TEXT];
+};
+
+struct logger_filter {
+  char module[32];
+  int level;
+};
+
+static struct logger_slot logger_ring[LOGGER_SLOTS];
+static size_t logger_tail; /* Next position to write, shared by producers */
+static size_t logger_head; /* Next position to read, writer thread only */
+static uint64_t logger_drops;
+static int logger_running;
+static pthread_t logger_thread;
+static pthread_mutex_t logger_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t logger_wake = PTHREAD_COND_INITIALIZER;
+static int logger_quit;
+static int logger_asleep; /* The writer waits for the next message */
+
+static struct logger_filter logger_filters[LOGGER_MAX_FILTERS];
+static int logger_nfilters;
+static int logger_default_level = LOGGER_INFO;
+static int logger_generation;
+
+static const char logger_letters[] = "EWID";
+static const char *logger_level_names[] = {"error", "warn", "info", "debug"};
+
+static int logger_parse_level(const char *s, size_t len) {
+  int i;
+  for (i = 0; i <= LOGGER_DEBUG; i++) {
+    if (strlen(logger_level_names[i]) == len &&
+        strncmp(s, logger_level_names[i], len) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+LOGGER_API int logger_set_filters(const char *filters) {
+  struct logger_filter parsed[LOGGER_MAX_FILTERS];
+  int n = 0, def = LOGGER_INFO;
+  const char *p = filters != NULL ? filters : "";
+  while (*p != '\0') {
+    size_t len = strcspn(p, ",");
+    const char *eq = memchr(p, '=', len);
+    if (eq == NULL) {
+      def = logger_parse_level(p, len);
+      if (def < 0) {
+        return -1;
+      }
+    } else {
+      size_t mlen = (size_t)(eq - p);
+      if (n == LOGGER_MAX_FILTERS || mlen == 0 ||
+          mlen >= sizeof(parsed[n].module)) {
+        return -1;
+      }
+      parsed[n].level = logger_parse_level(eq + 1, len - mlen - 1);
+      if (parsed[n].level < 0) {
+        return -1;
+      }
+      memcpy(parsed[n].module, p, mlen);
+      parsed[n].module[mlen] = '\0';
+      n++;
+    }
+    p += len + (p[len] == ',');
+  }
+  pthread_mutex_lock(&logger_lock);
+  memcpy(logger_filters, parsed, n * sizeof(struct logger_filter));
+  logger_nfilters = n;
+  logger_default_level = def;
+  __atomic_add_fetch(&logger_generation, 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&logger_lock);
+  return 0;
+}
+
+LOGGER_API int logger_enabled(struct logger_site *site, int level) {
+  int generation = __atomic_load_n(&logger_generation, __ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&site->generation, __ATOMIC_RELAXED) != generation) {
+    int i, l;
+    pthread_mutex_lock(&logger_lock);
+    l = logger_default_level;
+    for (i = 0; i < logger_nfilters; i++) {
+      if (strcmp(logger_filters[i].module, site->module) == 0) {
+        l = logger_filters[i].level;
+      }
+    }
+    __atomic_store_n(&site->level, l, __ATOMIC_RELAXED);
+    __atomic_store_n(&site->generation, logger_generation, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&logger_lock);
+  }
+  return level <= __atomic_load_n(&site->level, __ATOMIC_RELAXED);
+}
+
+/* "12:00:01.123 D invoke: text\n" */
+static size_t logger_format(char *out, const struct logger_slot *s) {
+  time_t t = (time_t)(s->t_us / 1000000);
+  struct tm tm;
+  size_t n;
+  localtime_r(&t, &tm);
+  n = strftime(out, 16, "%H:%M:%S", &tm);
+  n += sprintf(out + n, ".%03d %c %s: ", (int)(s->t_us / 1000 % 1000),
+               logger_letters[s->level], s->site->module);
+  memcpy(out + n, s->text, s->len);
+  n += s->len;
+  out[n++] = '\n';
+  return n;
+}
+
+static void logger_flush_out(const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(STDERR_FILENO, buf, len);
+    if (n <= 0) {
+      return;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+}
+
+static int64_t logger_now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+LOGGER_API void logger_write(const struct logger_site *site, int level,
+                             const char *format, ...) {
+  struct logger_slot *s, direct;
+  size_t pos;
+  va_list ap;
+  int len;
+  if (!__atomic_load_n(&logger_running, __ATOMIC_ACQUIRE)) {
+    char out[LOGGER_TEXT + 64];
+    s = &direct;
+    s->site = site;
+    s->level = level;
+    s->t_us = logger_now_us();
+    va_start(ap, format);
+    len = vsnprintf(s->text, sizeof(s->text), format, ap);
+    va_end(ap);
+    s->len = len < 0 ? 0 : len >= LOGGER_TEXT ? LOGGER_TEXT - 1 : len;
+    logger_flush_out(out, logger_format(out, s));
+    return;
+  }
+  pos = __atomic_load_n(&logger_tail, __ATOMIC_RELAXED);
+  for (;;) {
+    intptr_t diff;
+    s = &logger_ring[pos & (LOGGER_SLOTS - 1)];
+    diff = (intptr_t)__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) -
+           (intptr_t)pos;
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&logger_tail, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      __atomic_add_fetch(&logger_drops, 1, __ATOMIC_RELAXED);
+      return;
+    } else {
+      pos = __atomic_load_n(&logger_tail, __ATOMIC_RELAXED);
+    }
+  }
+  s->site = site;
+  s->level = level;
+  s->t_us = logger_now_us();
+  va_start(ap, format);
+  len = vsnprintf(s->text, sizeof(s->text), format, ap);
+  va_end(ap);
+  s->len = len < 0 ? 0 : len >= LOGGER_TEXT ? LOGGER_TEXT - 1 : len;
+  __atomic_store_n(&s->seq, pos + 1, __ATOMIC_SEQ_CST);
+  /* Either this sees the writer asleep, or the writer sees this message
+   * before it goes to sleep */
+  if (__atomic_load_n(&logger_asleep, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&logger_lock);
+    pthread_cond_signal(&logger_wake);
+    pthread_mutex_unlock(&logger_lock);
+  }
+}
+
+/* Writer thread only */
+static int logger_empty(void) {
+  return __atomic_load_n(&logger_ring[logger_head & (LOGGER_SLOTS - 1)].seq,
+                         __ATOMIC_SEQ_CST) != logger_head + 1;
+}
+
+/* Writes out what is in the ring, in batches. Returns the number of
+ * messages */
+static size_t logger_drain(void) {
+  static char buf[64 * 1024];
+  static uint64_t reported;
+  size_t len = 0, count = 0;
+  uint64_t drops;
+  for (;;) {
+    struct logger_slot *s = &logger_ring[logger_head & (LOGGER_SLOTS - 1)];
+    if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != logger_head + 1) {
+      break;
+    }
+    if (len + LOGGER_TEXT + 64 > sizeof(buf)) {
+      logger_flush_out(buf, len);
+      len = 0;
+    }
+    len += logger_format(buf + len, s);
+    __atomic_store_n(&s->seq, logger_head + LOGGER_SLOTS, __ATOMIC_RELEASE);
+    __atomic_store_n(&logger_head, logger_head + 1, __ATOMIC_RELAXED);
+    count++;
+  }
+  drops = __atomic_load_n(&logger_drops, __ATOMIC_RELAXED);
+  if (drops > reported) {
+    len += sprintf(buf + len, "logger: dropped %llu messages\n",
+                   (unsigned long long)(drops - reported));
+    reported = drops;
+  }
+  logger_flush_out(buf, len);
+  return count;
+}
+
+static void *logger_main(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&logger_lock);
+  while (!logger_quit) {
+    pthread_mutex_unlock(&logger_lock);
+    logger_drain();
+    pthread_mutex_lock(&logger_lock);
+    /* No timeout: an idle process gets no wakeups from here */
+    __atomic_store_n(&logger_asleep, 1, __ATOMIC_SEQ_CST);
+    while (!logger_quit && logger_empty()) {
+      pthread_cond_wait(&logger_wake, &logger_lock);
+    }
+    __atomic_store_n(&logger_asleep, 0, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&logger_lock);
+  logger_drain();
+  return NULL;
+}
+
+LOGGER_API int logger_start(const char *filters) {
+  size_t i;
+  int r = logger_set_filters(filters);
+  if (logger_running) {
+    return r;
+  }
+  for (i = 0; i < LOGGER_SLOTS; i++) {
+    logger_ring[i].seq = i;
+  }
+  logger_head = logger_tail = 0;
+  logger_quit = 0;
+  if (pthread_create(&logger_thread, NULL, logger_main, NULL) != 0) {
+    return r; /* Messages still go out, straight away */
+  }
+  __atomic_store_n(&logger_running, 1, __ATOMIC_RELEASE);
+  return r;
+}
+
+LOGGER_API void logger_stop(void) {
+  if (!logger_running) {
+    return;
+  }
+  /* From now on messages go out straight away */
+  __atomic_store_n(&logger_running, 0, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&logger_lock);
+  logger_quit = 1;
+  pthread_cond_signal(&logger_wake);
+  pthread_mutex_unlock(&logger_lock);
+  pthread_join(logger_thread, NULL);
+}
+
+LOGGER_API uint64_t logger_dropped(void) {
+  return __atomic_load_n(&logger_drops, __ATOMIC_RELAXED);
+}
+
+#endif /* LOGGER_HEADER */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOGGER_H */
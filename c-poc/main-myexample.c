@@ -1,4 +1,5 @@
 #define WEBVIEW_IMPLEMENTATION
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <dbus/dbus.h>
@@ -10,15 +11,184 @@
 #include <unistd.h> //_exit, close, dup2, execl, fork, pipe, STDOUT_FILENO
 #include <sys/wait.h> 	// wait, pid_t
 #include <fcntl.h> 	//fnctl, F_SETFL, O_NONBLOCK
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <glib-unix.h>
 
 #include "webview.h"
 #include "jsmn.h"
+#include "jsmn-simd.h"
+#include "command.h"
+#include "capture.h"
+#include "databind.h"
+#include "sampler.h"
+#include "dbus-bridge.h"
+#include "recorder.h"
+#include "snapshot.h"
+#include "panels.h"
+#include "timeseries.h"
+#include "logger.h"
+#include "icons.h"
+#include "channel.h"
+#include "usage.h"
 
 void my_cb(struct webview *w, const char *arg);
 void monitor_dbus_events(const char* interface_name);
+static int json_skip(const jsmntok_t *tokens, int i);
+static int json_key_is(const char *js, const jsmntok_t *key, const char *name);
+static char *json_string(const char *js, const jsmntok_t *t);
+static char **json_argv(const char *js, const jsmntok_t *tokens, int array);
+static void json_argv_free(char **argv);
+struct command_job;
+static void publish_capture(struct webview *w, struct capture *c, long req, int surface, struct usage_account *account);
+static void capture_mem_cb(void *owner, ssize_t delta);
+static void capture_scheme_cb(WebKitURISchemeRequest *request, gpointer arg);
+static void bundle_scheme_cb(WebKitURISchemeRequest *request, gpointer arg);
+static void databind_notify_cb(struct databind *db, void *arg);
+static void recover_cb(struct webview *w, int reason, void *arg);
+static int snapshot_cb(struct webview *w, void *arg);
+static gboolean terminate_cb(gpointer arg);
+static int clock_cb(struct webview *w, void *arg);
 
-int main() {
-  printf("Starting upp!\n");
+// Values shown by the page, pushed only when they change
+static struct databind *store;
+
+// Background threads for commands and data collection
+static struct sampler *sampler;
+
+// D-Bus properties shown by the page, kept up to date by signals
+static struct dbus_bridge *bridge;
+// Application icons for the page, as icon:///<size>/<name>
+static struct icons *icons;
+
+// Messages of continuous controls, where only the latest counts
+static struct channels *channels;
+// While a channel's message runs: its name, and the commands it started
+static const char *channel_running;
+static int channel_jobs;
+
+// What each widget and provider costs; widgets name themselves in their
+// messages, e.g. { exec: [...], widget: 'brightness' }, others are 'page'
+static struct usage *usage;
+static struct usage_account *invoke_account; // Of the message being handled
+
+// Commands started and not reported back yet, stopped by request id with
+//   { cancel: 12 }
+// A message with the id of commands still running supersedes them. Each one
+// may be given a timeout, in ms, past which it is killed:
+//   { send_and_read: 'find / -name core', id: 12, timeout: 5000 }
+static GPtrArray *running_jobs;
+static unsigned long invoke_seq; // Messages handled so far
+// For the commands of messages that don't say; 0: no limit
+static int command_timeout_ms;
+// Guards the pid and cancel of the jobs, shared with the sampler threads
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+// How often a job looks whether its command ended, where there is no pidfd
+#define COMMAND_POLL_MS 50
+
+// History of CPU and network use, for the page's graphs
+static struct timeseries *history;
+static const char *history_metrics[] = {"cpu", "net.rx", "net.tx"};
+// Frame pacing of a --render-bench run, measured on the page: each frame
+// repaints the whole viewport, and the intervals go back as render_bench
+#define RENDER_BENCH_SCRIPT \
+  "(function(ms){window.addEventListener('load',function(){" \
+  "var o=document.createElement('div'),t=[],s,l,i=0;" \
+  "o.style.cssText='position:fixed;left:0;top:0;width:100%%;height:100%%;pointer-events:none';" \
+  "document.body.appendChild(o);" \
+  "function q(p){return t.length?t[Math.min(t.length-1,Math.floor(t.length*p))]:0;}" \
+  "function f(n){t.push(n-l);l=n;i++;" \
+  "o.style.backgroundColor='rgba(128,128,128,'+(i%%2?0.01:0.02)+')';" \
+  "if(n-s<ms){requestAnimationFrame(f);return;}" \
+  "o.remove();t.sort(function(a,b){return a-b;});" \
+  "window.external.invoke(JSON.stringify({render_bench:{frames:t.length," \
+  "ms:n-s,fps:t.length*1000/(n-s),p50_ms:q(.5),p95_ms:q(.95),p99_ms:q(.99)," \
+  "max_ms:q(1)}}));}" \
+  "requestAnimationFrame(function(n){s=l=n;requestAnimationFrame(f);});});})(%d)"
+
+// Kept from the last snapshot, for the one written at exit
+static void *snapshot_session_state = NULL;
+static size_t snapshot_session_state_len = 0;
+static const struct {
+    GBusType bus;
+    const char *name, *path, *interface, *prefix;
+} watched_properties[] = {
+    {G_BUS_TYPE_SYSTEM, "org.freedesktop.UPower",
+     "/org/freedesktop/UPower/devices/battery_BAT0",
+     "org.freedesktop.UPower.Device", "battery"},
+    {G_BUS_TYPE_SYSTEM, "org.freedesktop.UPower",
+     "/org/freedesktop/UPower", "org.freedesktop.UPower", "power"},
+    {G_BUS_TYPE_SESSION, "org.gnome.SettingsDaemon.Power",
+     "/org/gnome/SettingsDaemon/Power",
+     "org.gnome.SettingsDaemon.Power.Screen", "backlight"},
+    {G_BUS_TYPE_SYSTEM, "org.freedesktop.NetworkManager",
+     "/org/freedesktop/NetworkManager", "org.freedesktop.NetworkManager",
+     "network"},
+};
+
+enum { JOB_EXEC, JOB_EXEC_AND_READ, JOB_SEND_COMMAND, JOB_SEND_AND_READ };
+// Why a command was stopped; its output, if any, is dropped
+enum { JOB_RUNNING, JOB_CANCELED, JOB_SUPERSEDED, JOB_TIMED_OUT };
+
+// A command from the page, on its way to a sampler thread and back
+struct command_job {
+    int kind;
+    char **argv;        // argv form
+    char **env;         // extra KEY=VALUE entries for the argv form
+    char *line;         // shell form
+    long req;
+    int surface;        // webview_invoke_surface() of its message
+    char *channel;      // reported to channels_done() when finished
+    struct usage_account *account;
+    struct capture *out;
+    unsigned long msg;  // invoke_seq of its message
+    int timeout_ms;     // 0: none
+    unsigned int timer; // the timeout, 0 when none
+    pid_t pgid;         // of its command, while some of it may run, else 0; job_lock
+    int stopped;        // JOB_RUNNING, or why not; job_lock
+    GCancellable *cancel; // cancelled when stopped
+    // Watched on its sampler thread once its command started
+    struct sampler_job *handle;
+    pid_t child;        // until reaped, else 0
+    int exit_fd;        // command_exit_fd() of child, or -1
+    int out_fd;         // read end of its stdout until EOF, or -1
+    GSource *exit_watch;
+    GSource *out_watch;
+    GSource *cancel_watch;
+};
+
+static void dbus_call(struct webview *w, const char *js, const jsmntok_t *tokens, int object, long req);
+static void series_query(struct webview *w, const char *js, const jsmntok_t *tokens, int object, long req);
+static void render_bench_report(struct webview *w, const char *js, const jsmntok_t *tokens, int object);
+static void history_sample(void *arg);
+static void dbus_reply_cb(struct dbus_bridge *b, long req, const char *json, const char *error, void *arg);
+static void command_job_free(struct command_job *job);
+static void command_job_start(struct webview *w, struct command_job *job);
+static void command_job_stop(struct command_job *job, int why);
+static void command_jobs_cancel(int surface, long req);
+static int command_job_timeout_cb(struct webview *w, void *arg);
+static void command_job_run(void *arg);
+static void command_job_done(struct webview *w, void *arg);
+static void webview_log_cb(const char *s, void *arg);
+static void sampler_warn_cb(const char *s, void *arg);
+static void dbus_warn_cb(const char *s, void *arg);
+static void hidden_cb(struct webview *w, int hidden, void *arg);
+static int channel_run_cb(struct channels *c, const char *name, const char *msg, void *arg);
+static void usage_reply(struct webview *w, long req);
+static int usage_log_cb(struct webview *w, void *arg);
+
+int main(int argc, char **argv) {
+  // Messages go through a ring and a writer thread: logging never blocks
+  // the GTK thread, at any level. WEBVIEW_LOG=debug or e.g. invoke=debug
+  if (logger_start(getenv("WEBVIEW_LOG")) != 0) {
+    fprintf(stderr, "WEBVIEW_LOG: expected e.g. info,invoke=debug, logging at info\n");
+  }
+  // Whichever way main() ends, what is still in the ring gets written
+  atexit(logger_stop);
+  sampler_set_log(sampler_warn_cb, NULL);
+  dbus_bridge_set_log(dbus_warn_cb, NULL);
+  logger_info("main", "Starting upp!");
   struct webview webview = {
       .title = "e182d4d56ea0fe8601cc65486e757ebf",
       .url =  "file:///home/s/Projects/C/myindex.html",
@@ -26,28 +196,287 @@ int main() {
       .height = 600,
       .debug = 1,
       .resizable = 1,
+      .standby = 1,
+      .hidden_interval_ms = 30000,
       
   };
+  
+  // Headless mode, for CI: render offscreen, dump a PNG and the frame times
+  // (a 2560x1600 one here; --zoom enlarges the page instead)
+  //   ./webview-example --headless out.png --size 1280x800 --scale 2
+  //                     --frame-log frames.csv --url file:///.../page.html
+  const char *snapshot = NULL;
+  int settle_frames = 10;
+  struct sampler_config sampler_config = {.threads = 1, .idle = 1};
+  struct recorder *recorder = NULL;
+  // Last session and values, so that the first frame shows real data
+  char *snapshot_path = g_build_filename(g_get_user_cache_dir(),
+                                         "webview-example.snapshot", NULL);
+  struct snapshot *snap = NULL;
+  int usage_log_ms = 300000;
+  command_timeout_ms = 60000;
+  // Panels the page builds on first reveal or when idle, not at load
+  const char *panels_path = "panels/panels.manifest";
+  struct panels *panels = NULL;
+  int render_bench_ms = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+      webview.headless = 1;
+      snapshot = argv[++i];
+    } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+      sscanf(argv[++i], "%dx%d", &webview.width, &webview.height);
+    } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+      webview.scale = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--zoom") == 0 && i + 1 < argc) {
+      webview.zoom = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--frame-log") == 0 && i + 1 < argc) {
+      webview.frame_log = argv[++i];
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      settle_frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--window-hints") == 0 && i + 1 < argc) {
+      // e.g. below,sticky,skip_taskbar,skip_pager,type=desktop
+      webview.window_hints = argv[++i];
+    } else if (strcmp(argv[i], "--per-monitor") == 0) {
+      // One surface per monitor, all fed by this process
+      webview.per_monitor = 1;
+    } else if (strcmp(argv[i], "--render") == 0 && i + 1 < argc) {
+      // e.g. accel=never,opaque=always or accel=always,device-scale=1
+      webview.render = argv[++i];
+    } else if (strcmp(argv[i], "--render-bench") == 0 && i + 1 < argc) {
+      // Repaint the page for that many ms, print the frame times, exit
+      render_bench_ms = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--hidden-interval") == 0 && i + 1 < argc) {
+      // Pace of timers and providers while covered; 0 keeps them going
+      webview.hidden_interval_ms = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--usage-log") == 0 && i + 1 < argc) {
+      // Per widget and provider costs in the log this often; 0: never
+      usage_log_ms = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--command-timeout") == 0 && i + 1 < argc) {
+      // Kill the commands messages run after that many ms, unless the
+      // message says otherwise; 0: never
+      command_timeout_ms = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--idle-slack") == 0 && i + 1 < argc) {
+      webview.idle_slack_ms = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--sampler-threads") == 0 && i + 1 < argc) {
+      sampler_config.threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--sampler-nice") == 0 && i + 1 < argc) {
+      // An explicit nice value replaces SCHED_IDLE
+      sampler_config.idle = 0;
+      sampler_config.nice = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--sampler-cpus") == 0 && i + 1 < argc) {
+      sampler_config.cpus = argv[++i];
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      // Page <-> native traffic, for ./replay
+      recorder = recorder_open(argv[++i]);
+      if (recorder == NULL) {
+        perror(argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+      g_free(snapshot_path);
+      snapshot_path = g_strdup(argv[++i]);
+    } else if (strcmp(argv[i], "--no-snapshot") == 0) {
+      g_free(snapshot_path);
+      snapshot_path = NULL;
+    } else if (strcmp(argv[i], "--panels") == 0 && i + 1 < argc) {
+      panels_path = argv[++i];
+    } else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+      // Levels: error, warn, info, debug; e.g. warn,invoke=debug
+      if (logger_set_filters(argv[++i]) != 0) {
+        fprintf(stderr, "--log: expected e.g. info,invoke=debug\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--url") == 0 && i + 1 < argc) {
+      webview.url = argv[++i];
+    } else {
+      fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      return 1;
+    }
+  }
+  
+  // Headless runs must not depend on what the last desktop session left,
+  // nor benchmarks
+  if (webview.headless || render_bench_ms > 0) {
+    g_free(snapshot_path);
+    snapshot_path = NULL;
+  }
+  panels = panels_load(panels_path);
+  if (panels == NULL && errno != ENOENT) {
+    perror(panels_path);
+    return 1;
+  }
+  if (snapshot_path != NULL) {
+    snap = snapshot_read(snapshot_path);
+    webview.session_state = snapshot_session(snap, &webview.session_state_len);
+  }
   webview.external_invoke_cb = my_cb;
-  webview_init(&webview);
+  if (webview_init(&webview) != 0) {
+    fprintf(stderr, "Failed to initialize the webview\n");
+    return 1;
+  }
   webview_set_color(&webview, 255, 255, 255, 0);
+  webview_set_log(webview_log_cb, NULL);
+  if (recorder != NULL) {
+    webview_set_trace(&webview, recorder_trace_cb, recorder);
+  }
+  webview_set_recover(&webview, recover_cb, NULL);
+  // A session ending (logout, systemctl stop) goes through the normal exit,
+  // which writes the snapshot
+  g_unix_signal_add(SIGTERM, terminate_cb, &webview);
+  g_unix_signal_add(SIGINT, terminate_cb, &webview);
+  usage = usage_new();
+  webview_register_uri_scheme(&webview, "capture", capture_scheme_cb, &webview);
+  icons = icons_new(4 * 1024 * 1024);
+  icons_register(icons, &webview);
+  store = databind_new(databind_notify_cb, &webview);
+  // The kernel may merge the sampler threads' wakeups within the slack;
+  // the GTK thread's timers keep their own, exact
+  sampler_config.timer_slack_ms = webview.idle_slack_ms;
+  sampler = sampler_new(&webview, &sampler_config);
+  channels = channels_new(&webview, channel_run_cb, &webview);
+  webview_set_hidden(&webview, hidden_cb, sampler);
+  bridge = dbus_bridge_new(store);
+  history = timeseries_new();
+  for (size_t i = 0; i < sizeof(history_metrics) / sizeof(history_metrics[0]); i++) {
+    struct timeseries_tier tiers[] = TIMESERIES_DEFAULT_TIERS;
+    timeseries_define(history, history_metrics[i], tiers,
+                      sizeof(tiers) / sizeof(tiers[0]));
+  }
+  sampler_add_provider(sampler, 1000, history_sample, NULL, NULL);
+  for (size_t i = 0; i < sizeof(watched_properties) / sizeof(watched_properties[0]); i++) {
+    dbus_bridge_watch(bridge, watched_properties[i].bus,
+                      watched_properties[i].name, watched_properties[i].path,
+                      watched_properties[i].interface,
+                      watched_properties[i].prefix);
+  }
+  webview_add_init_script(&webview, DATABIND_RUNTIME);
+  if (render_bench_ms > 0) {
+    char script[sizeof(RENDER_BENCH_SCRIPT) + 16];
+    snprintf(script, sizeof(script), RENDER_BENCH_SCRIPT, render_bench_ms);
+    webview_add_init_script(&webview, script);
+  }
+  if (panels != NULL) {
+    char *script = panels_script(panels);
+    webview_register_uri_scheme(&webview, PANELS_SCHEME, bundle_scheme_cb,
+                                panels);
+    if (script != NULL) {
+      webview_add_init_script(&webview, script);
+      free(script);
+    }
+  }
+  // The page starts with the snapshot's values, already in place when it
+  // first paints; the providers then only send what changed since. Only
+  // the first load: by a reload they are stale
+  if (snapshot_seed(snap, store) > 0) {
+    char *seed = databind_flush(store);
+    if (seed != NULL) {
+      webview_add_init_script_once(&webview, seed);
+      free(seed);
+    }
+  }
+  snapshot_free(snap);
+  webview.session_state = NULL;
+  if (snapshot_path != NULL) {
+    webview_timer_add(&webview, 60000, 0, snapshot_cb, snapshot_path);
+  }
+  webview_timer_add(&webview, 1000, 0, clock_cb, NULL);
+  if (usage_log_ms > 0) {
+    webview_timer_add(&webview, usage_log_ms, 0, usage_log_cb, NULL);
+  }
+      
+  if (webview.headless) {
+    /* Let the page settle for a few frames, then take the picture */
+    struct webview_frame_stats stats;
+    int r = 0;
+    for (int i = 0; i < settle_frames && r == 0; i++) {
+      r = webview_snapshot(&webview, snapshot);
+    }
+    webview_frame_stats(&webview, &stats);
+    printf("frames=%d last_us=%ld min_us=%ld max_us=%ld avg_us=%ld\n",
+           stats.frames, stats.last_us, stats.min_us, stats.max_us,
+           stats.frames > 0 ? stats.total_us / stats.frames : 0);
+    recorder_close(recorder);
+    webview_exit(&webview);
+    return r == 0 ? 0 : 2;
+  }
       
   //monitor_dbus_events("backlight");
     
   /* Main app loop, can be either blocking or non-blocking */
   while (webview_loop(&webview, 1) == 0);
+  // The window and its web view are gone by now: the session state is the
+  // one of the last periodic snapshot, the values are the latest
+  if (snapshot_path != NULL) {
+    if (snapshot_write(snapshot_path, snapshot_session_state,
+                       snapshot_session_state_len, store) != 0) {
+      perror(snapshot_path);
+    }
+    g_free(snapshot_session_state);
+    g_free(snapshot_path);
+  }
+  // Nothing waits for the commands still running any more
+  for (guint i = 0; running_jobs != NULL && i < running_jobs->len; i++) {
+    command_job_stop(g_ptr_array_index(running_jobs, i), JOB_CANCELED);
+  }
+  sampler_free(sampler);
+  if (running_jobs != NULL) {
+    g_ptr_array_free(running_jobs, TRUE);
+  }
+  channels_free(channels);
+  timeseries_free(history);
+  dbus_bridge_free(bridge);
+  webview_set_trace(&webview, NULL, NULL);
+  recorder_close(recorder);
   webview_exit(&webview);
+  icons_free(icons);
+  panels_free(panels);
+  databind_free(store);
+  usage_free(usage);
   return 0;
 }
 
 // JS "invoke" callback
 void my_cb(struct webview *w, const char *arg) {
-	printf("Call received! Let me read this: %s\n", arg);
+	logger_debug("invoke", "Call received! Let me read this: %.200s", arg);
+	// Charged to the widget once the message says which; a channel's message
+	// may run another one from inside this one
+	struct usage_scope scope;
+	struct usage_account *outer_account = invoke_account;
+	usage_begin(&scope, NULL);
 	
 	jsmn_parser jsmn_parser;
-	jsmntok_t tokens[1000]; /* We expect no more than 20 JSON tokens */
-	jsmn_init(&jsmn_parser);
-    int result = jsmn_parse(&jsmn_parser, arg, strlen(arg), tokens, 128);
+	jsmntok_t stack_tokens[1000]; /* Enough for most; batches get the heap */
+	jsmntok_t *tokens = stack_tokens;
+	unsigned int ntokens = sizeof(stack_tokens) / sizeof(stack_tokens[0]);
+	size_t len = strlen(arg);
+	int result;
+	for(;;){
+	    jsmn_init(&jsmn_parser);
+	    result = jsmn_parse_simd(&jsmn_parser, arg, len, tokens, ntokens);
+	    if(result != JSMN_ERROR_NOMEM){
+	        break;
+	    }
+	    jsmntok_t *more = malloc(ntokens * 4 * sizeof(jsmntok_t));
+	    if(more == NULL){
+	        break;
+	    }
+	    if(tokens != stack_tokens){
+	        free(tokens);
+	    }
+	    tokens = more;
+	    ntokens *= 4;
+	}
+	// Every message is an object of key/value pairs; anything else is not
+	// for us, and the loops below rely on it
+	if(result < 1 || tokens[0].type != JSMN_OBJECT){
+	    logger_warn("invoke", "Not a JSON object, ignoring it: %.200s", arg);
+	    if(tokens != stack_tokens){
+	        free(tokens);
+	    }
+	    invoke_account = outer_account;
+	    usage_end(&scope);
+	    return;
+	}
     
     /*
     printf("- Read %i tokens:\n", result);
@@ -78,55 +507,979 @@ void my_cb(struct webview *w, const char *arg) {
     printf("Ok! Now let's understand it!\n");
     */
     
-    for(int i=1; i<result; i=i+2){
+    // Extra environment for the argv commands of this message, if any:
+    //   { exec: ['xbacklight', '-set', '50'], env: ['LANG=C'] }
+    // and the request id outputs are reported with:
+    //   { exec_and_read: ['date'], id: 12 }
+    // Continuous controls name a channel, where a newer message replaces the
+    // one still waiting (channel.h); optionally debounce: ms or throttle: Hz
+    //   { exec: ['xbacklight', '-set', '50'], channel: 'brightness' }
+    int env = -1;
+    long req = 0;
+    int timeout = -1;
+    char *channel = NULL;
+    enum channel_policy policy = CHANNEL_LATEST;
+    int param = 0;
+    char *widget = NULL;
+    for(int i=1; i+1<result; i=json_skip(tokens, i+1)){
+        if(json_key_is(arg, &tokens[i], "id") && tokens[i+1].type == JSMN_PRIMITIVE){
+            req = strtol(arg + tokens[i+1].start, NULL, 10);
+        }
+        if(json_key_is(arg, &tokens[i], "env") && tokens[i+1].type == JSMN_ARRAY){
+            env = i+1;
+        }
+        if(json_key_is(arg, &tokens[i], "channel") && tokens[i+1].type == JSMN_STRING && channel == NULL){
+            channel = json_string(arg, &tokens[i+1]);
+        }
+        if(json_key_is(arg, &tokens[i], "debounce") && tokens[i+1].type == JSMN_PRIMITIVE){
+            policy = CHANNEL_DEBOUNCE;
+            param = (int)strtol(arg + tokens[i+1].start, NULL, 10);
+        }
+        if(json_key_is(arg, &tokens[i], "throttle") && tokens[i+1].type == JSMN_PRIMITIVE){
+            policy = CHANNEL_THROTTLE;
+            param = (int)strtol(arg + tokens[i+1].start, NULL, 10);
+        }
+        if(json_key_is(arg, &tokens[i], "widget") && tokens[i+1].type == JSMN_STRING && widget == NULL){
+            widget = json_string(arg, &tokens[i+1]);
+        }
+        if(json_key_is(arg, &tokens[i], "timeout") && tokens[i+1].type == JSMN_PRIMITIVE){
+            timeout = (int)strtol(arg + tokens[i+1].start, NULL, 10);
+        }
+    }
+    invoke_account = scope.account = usage_account(usage, widget != NULL ? widget : "page");
+    free(widget);
+    // Not its turn yet: it comes back through channel_run_cb(). That may be
+    // right away, from in here: close this scope first, so the message's
+    // own run is charged once, to its own scope
+    if(channel != NULL && channels != NULL && channel_running == NULL){
+        invoke_account = outer_account;
+        usage_end(&scope);
+        channels_offer(channels, channel, policy, param, arg);
+        free(channel);
+        if(tokens != stack_tokens){
+            free(tokens);
+        }
+        return;
+    }
+    free(channel);
+    unsigned long msg = ++invoke_seq;
+    
+    for(int i=1; i+1<result; i=json_skip(tokens, i+1)){
         // Get the pair 
         char typeof_command[20]; // Command types can be maximum 20 chars long;
+        if(tokens[i].end-tokens[i].start >= (int)sizeof(typeof_command)){
+            continue;
+        }
         memcpy( typeof_command, &arg[tokens[i].start], tokens[i].end-tokens[i].start );
         typeof_command[tokens[i].end-tokens[i].start] = '\0';
-        char actual_command[1000]; // Command types can be maximum 1000 chars long;
-        memcpy( actual_command, &arg[tokens[i+1].start], tokens[i+1].end-tokens[i+1].start );
-        actual_command[tokens[i+1].end-tokens[i+1].start] = '\0';
+        
+        // D-Bus calls, asynchronous on the shared bus connections
+        if(strcmp(typeof_command, "dbus") == 0 && tokens[i+1].type == JSMN_OBJECT){
+            dbus_call(w, arg, tokens, i+1, req);
+            continue;
+        }
+        // History queries, answered right here from memory
+        if(strcmp(typeof_command, "series") == 0 && tokens[i+1].type == JSMN_OBJECT){
+            series_query(w, arg, tokens, i+1, req);
+            continue;
+        }
+        // The end of a --render-bench run
+        if(strcmp(typeof_command, "render_bench") == 0 && tokens[i+1].type == JSMN_OBJECT){
+            render_bench_report(w, arg, tokens, i+1);
+            continue;
+        }
+        // What each widget and provider has cost so far
+        if(strcmp(typeof_command, "usage") == 0){
+            usage_reply(w, req);
+            continue;
+        }
+        // Commands of an earlier request, not wanted any more
+        if(strcmp(typeof_command, "cancel") == 0 && tokens[i+1].type == JSMN_PRIMITIVE){
+            command_jobs_cancel(webview_invoke_surface(w), strtol(arg + tokens[i+1].start, NULL, 10));
+            continue;
+        }
+        
+        // Commands run on the sampler threads, never here on the GTK thread
+        int kind;
+        if(strcmp(typeof_command, "exec") == 0){
+            kind = JOB_EXEC;
+        } else if(strcmp(typeof_command, "exec_and_read") == 0){
+            kind = JOB_EXEC_AND_READ;
+        } else if(strcmp(typeof_command, "send_command") == 0){
+            kind = JOB_SEND_COMMAND;
+        } else if(strcmp(typeof_command, "send_and_read") == 0){
+            kind = JOB_SEND_AND_READ;
+        } else {
+            continue;
+        }
+        struct command_job *job = calloc(1, sizeof(struct command_job));
+        if(job == NULL){
+            continue;
+        }
+        job->kind = kind;
+        job->req = req;
+        job->surface = webview_invoke_surface(w);
+        job->account = invoke_account;
+        job->msg = msg;
+        job->timeout_ms = timeout >= 0 ? timeout : command_timeout_ms;
+        
+        // Structured form: the value is an argv array, run with no shell at all
+        if(kind == JOB_EXEC || kind == JOB_EXEC_AND_READ){
+            if(tokens[i+1].type == JSMN_ARRAY){
+                job->argv = json_argv(arg, tokens, i+1);
+            }
+            if(job->argv == NULL || job->argv[0] == NULL){
+                logger_warn("invoke", "Empty argv for '%s', ignoring it", typeof_command);
+                command_job_free(job);
+                continue;
+            }
+            if(env != -1){
+                job->env = json_argv(arg, tokens, env);
+            }
+        } else if(tokens[i+1].type == JSMN_STRING){
+            job->line = json_string(arg, &tokens[i+1]);
+        }
+        if(job->argv == NULL && job->line == NULL){
+            command_job_free(job);
+            continue;
+        }
+        if(channel_running != NULL){
+            job->channel = strdup(channel_running);
+            channel_jobs += job->channel != NULL;
+        }
+        command_job_start(w, job);
+    }
+    if(tokens != stack_tokens){
+        free(tokens);
+    }
+    invoke_account = outer_account;
+    usage_end(&scope);
+}
+
+// { dbus: { bus: 'session', dest: 'org.freedesktop.Notifications',
+//           path: '/org/freedesktop/Notifications',
+//           interface: 'org.freedesktop.Notifications', method: 'Notify',
+//           signature: '(susssasa{sv}i)',
+//           args: "('me', 0, '', 'Hello', '', [], {}, 5000)" }, id: 7 }
+// The reply comes back as window.external.ondbus(7, [values], error)
+static void dbus_call(struct webview *w, const char *js, const jsmntok_t *tokens, int object, long req) {
+    char *bus = NULL, *dest = NULL, *path = NULL, *interface = NULL;
+    char *method = NULL, *signature = NULL, *args = NULL;
+    int end = json_skip(tokens, object);
+    for(int j=object+1; j<end; j=json_skip(tokens, j+1)){
+        char **field = json_key_is(js, &tokens[j], "bus") ? &bus
+                     : json_key_is(js, &tokens[j], "dest") ? &dest
+                     : json_key_is(js, &tokens[j], "path") ? &path
+                     : json_key_is(js, &tokens[j], "interface") ? &interface
+                     : json_key_is(js, &tokens[j], "method") ? &method
+                     : json_key_is(js, &tokens[j], "signature") ? &signature
+                     : json_key_is(js, &tokens[j], "args") ? &args
+                     : NULL;
+        if(field != NULL && *field == NULL && tokens[j+1].type == JSMN_STRING){
+            *field = json_string(js, &tokens[j+1]);
+        }
+    }
+    if(dest == NULL || path == NULL || interface == NULL || method == NULL){
+        dbus_reply_cb(bridge, req, NULL, "dest, path, interface and method are needed", w);
+    } else {
+        GBusType type = bus != NULL && strcmp(bus, "system") == 0 ? G_BUS_TYPE_SYSTEM : G_BUS_TYPE_SESSION;
+        // Without an id nobody waits for the reply
+        dbus_bridge_call(bridge, type, dest, path, interface, method, signature, args,
+                         req, req != 0 ? dbus_reply_cb : NULL, w);
+    }
+    free(bus); free(dest); free(path); free(interface);
+    free(method); free(signature); free(args);
+}
 
+static void dbus_reply_cb(struct dbus_bridge *b, long req, const char *json, const char *error, void *arg) {
+    struct webview *w = (struct webview *)arg;
+    size_t size = (json != NULL ? strlen(json) : 0) + (error != NULL ? strlen(error) * 6 : 0) + 128;
+    char *js = malloc(size);
+    if(js == NULL){
+        return;
+    }
+    int n = sprintf(js, "window.external.ondbus&&window.external.ondbus(%ld,%s,", req, json != NULL ? json : "null");
+    if(error != NULL){
+        n += databind_escape(js + n, error);
+    } else {
+        n += sprintf(js + n, "null");
+    }
+    strcpy(js + n, ")");
+    usage_js(usage_account(usage, "dbus"), n + 1);
+    webview_eval(w, js);
+    free(js);
+}
 
-        // printf("#### %s %s\n", typeof_command, actual_command);
-        if(strcmp(typeof_command, "send_command") == 0){
-            printf("- Command to be sent: %s  -> Sending it!\n\n", actual_command);
-            system(actual_command);
-            printf("\n  Done\n");
-            
+// { series: { metric: 'cpu', from: -3600000, to: 0, points: 300 }, id: 9 }
+// from and to are in ms since the epoch, or from now when <= 0. The points
+// come back as min, max, avg float triples (NaN: no sample), to fetch:
+//   window.external.onseries = function(id, url, start, step, points) {
+//     fetch(url).then(function(r) { return r.arrayBuffer(); })
+//               .then(function(b) { var v = new Float32Array(b); ... });
+//   }
+static void series_query(struct webview *w, const char *js, const jsmntok_t *tokens, int object, long req) {
+    char *metric = NULL;
+    int64_t now = g_get_real_time() / 1000, from = -600000, to = 0;
+    int points = 300;
+    int end = json_skip(tokens, object);
+    for(int j=object+1; j<end; j=json_skip(tokens, j+1)){
+        const jsmntok_t *v = &tokens[j+1];
+        if(json_key_is(js, &tokens[j], "metric") && v->type == JSMN_STRING && metric == NULL){
+            metric = json_string(js, v);
+        } else if(v->type == JSMN_PRIMITIVE){
+            long long n = strtoll(js + v->start, NULL, 10);
+            if(json_key_is(js, &tokens[j], "from")) from = n;
+            if(json_key_is(js, &tokens[j], "to")) to = n;
+            if(json_key_is(js, &tokens[j], "points")) points = (int)n;
         }
-        if(strcmp(typeof_command, "send_and_read") == 0){
-            printf("- Command to be sent and read back: %s  -> Sending it!\n\n", actual_command);
-            
-              FILE *fp;
-              char line[1035];
-              
-              char fullpath[1500] = {0};
-              snprintf(fullpath, sizeof(fullpath), "%s/%s ", "/bin", actual_command);
-
-              /* Open the command for reading. */
-              fp = popen(fullpath, "r");
-              if (fp == NULL) {
-                printf("Failed to run command '%s'\n", actual_command );
-                exit(1);
-              }
-              /* Read the output a line at a time - output it. */
-              int i = 0;
-              while (fgets(line, sizeof(line)-1, fp) != NULL) {
-                i++;
-                printf("Output line %i of '%s': %s", i, actual_command, line);
-              }
-              /* close */
-              pclose(fp);
-            
-            
-            printf("\n  Done\n");
+    }
+    from += from <= 0 ? now : 0;
+    to += to <= 0 ? now : 0;
+    if(points > TIMESERIES_MAX_POINTS){
+        points = TIMESERIES_MAX_POINTS;
+    }
+    struct capture *c = capture_new();
+    int64_t start = 0, step = 0;
+    int n = -1;
+    if(c != NULL){
+        capture_set_owner(c, capture_mem_cb, invoke_account);
+    }
+    if(metric != NULL && c != NULL && points > 0 &&
+       capture_reserve(c, points * 3 * sizeof(float)) == 0){
+        n = timeseries_query(history, metric, from, to, points,
+                             (float *)c->data, &start, &step);
+    }
+    free(metric);
+    char js_out[200];
+    if(n < 0){
+        if(c != NULL){
+            capture_unref(c);
         }
+        snprintf(js_out, sizeof(js_out),
+                 "window.external.onseries&&window.external.onseries(%ld,null,0,0,0)", req);
+    } else {
+        char url[CAPTURE_URL_MAX];
+        c->len = n * 3 * sizeof(float);
+        usage_js(invoke_account, c->len);
+        capture_publish(c, webview_invoke_surface(w), url);
+        snprintf(js_out, sizeof(js_out),
+                 "window.external.onseries&&"
+                 "window.external.onseries(%ld,'%s',%lld,%lld,%d)",
+                 req, url, (long long)start, (long long)step, n);
+    }
+    usage_js(invoke_account, strlen(js_out));
+    webview_eval(w, js_out);
+}
 
+// One JSON line on stdout: the policy, the page's frame intervals and what
+// the native side spent drawing them, for render-bench.sh. Then exits
+static void render_bench_report(struct webview *w, const char *js, const jsmntok_t *tokens, int object) {
+    struct webview_frame_stats stats;
+    int end = json_skip(tokens, object);
+    webview_frame_stats(w, &stats);
+    printf("{\"render\":\"%s\"", w->render != NULL ? w->render : WEBVIEW_DEFAULT_RENDER);
+    for(int j=object+1; j<end; j=json_skip(tokens, j+1)){
+        if(tokens[j].type == JSMN_STRING && tokens[j+1].type == JSMN_PRIMITIVE){
+            printf(",\"%.*s\":%.*s", tokens[j].end - tokens[j].start, js + tokens[j].start,
+                   tokens[j+1].end - tokens[j+1].start, js + tokens[j+1].start);
+        }
     }
-    
+    printf(",\"native_frames\":%d,\"native_avg_us\":%ld,\"native_max_us\":%ld}\n",
+           stats.frames, stats.frames > 0 ? stats.total_us / stats.frames : 0, stats.max_us);
+    fflush(stdout);
+    webview_terminate(w);
+}
+
+// On a sampler thread, every second: CPU busy % and network bytes/s, from
+// the difference with the last reading of /proc
+static void history_sample(void *arg) {
+    static unsigned long long last_busy, last_total, last_rx, last_tx;
+    static int64_t last_t;
+    (void)arg;
+    struct usage_scope scope;
+    usage_begin(&scope, usage_account(usage, "history"));
+    int64_t t = g_get_real_time() / 1000;
+    unsigned long long v[10] = {0}, busy = 0, total = 0, rx = 0, tx = 0;
+    char line[512];
+    FILE *f = fopen("/proc/stat", "r");
+    if(f != NULL){
+        if(fgets(line, sizeof(line), f) != NULL){
+            sscanf(line, "cpu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+                   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9]);
+        }
+        fclose(f);
+    }
+    // Guests are already counted in user and nice
+    for(int i = 0; i < 8; i++){
+        total += v[i];
+    }
+    busy = total - v[3] - v[4];
+    f = fopen("/proc/net/dev", "r");
+    if(f != NULL){
+        while(fgets(line, sizeof(line), f) != NULL){
+            char *colon = strchr(line, ':');
+            unsigned long long r, x;
+            if(colon == NULL || strncmp(line + strspn(line, " "), "lo:", 3) == 0){
+                continue;
+            }
+            if(sscanf(colon + 1, "%llu %*u %*u %*u %*u %*u %*u %*u %llu", &r, &x) == 2){
+                rx += r;
+                tx += x;
+            }
+        }
+        fclose(f);
+    }
+    if(last_t != 0 && t > last_t){
+        double s = (t - last_t) / 1000.0;
+        if(total > last_total){
+            timeseries_add(history, "cpu", t, 100.0 * (busy - last_busy) / (total - last_total));
+        }
+        if(rx >= last_rx && tx >= last_tx){
+            timeseries_add(history, "net.rx", t, (rx - last_rx) / s);
+            timeseries_add(history, "net.tx", t, (tx - last_tx) / s);
+        }
+    }
+    last_busy = busy;
+    last_total = total;
+    last_rx = rx;
+    last_tx = tx;
+    last_t = t;
+    usage_end(&scope);
 }
 
+static void command_job_free(struct command_job *job) {
+    if(job->cancel != NULL){
+        g_object_unref(job->cancel);
+    }
+    json_argv_free(job->argv);
+    json_argv_free(job->env);
+    free(job->line);
+    free(job->channel);
+    free(job);
+}
+
+// Hands job to a sampler thread, in place of the commands it supersedes:
+// those of an earlier message from the same surface, with the same id
+static void command_job_start(struct webview *w, struct command_job *job) {
+    if(running_jobs == NULL){
+        running_jobs = g_ptr_array_new();
+    }
+    for(guint i=0; job->req != 0 && i<running_jobs->len; i++){
+        struct command_job *old = g_ptr_array_index(running_jobs, i);
+        if(old->surface == job->surface && old->req == job->req && old->msg != job->msg){
+            command_job_stop(old, JOB_SUPERSEDED);
+        }
+    }
+    job->cancel = g_cancellable_new();
+    g_ptr_array_add(running_jobs, job);
+    if(job->timeout_ms > 0){
+        job->timer = webview_timer_add(w, job->timeout_ms, WEBVIEW_TIMER_URGENT, command_job_timeout_cb, job);
+    }
+    sampler_submit(sampler, command_job_run, command_job_done, job);
+}
+
+// Kills the process group of the command of job, if it runs, or keeps it
+// from starting. Its leader may be gone already while the rest still writes
+// to its output: the group is killed all the same, and the sampler thread
+// stops reading. Its result is dropped once it is back
+static void command_job_stop(struct command_job *job, int why) {
+    pthread_mutex_lock(&job_lock);
+    if(job->stopped == JOB_RUNNING){
+        job->stopped = why;
+        if(job->pgid > 0){
+            command_kill(job->pgid, SIGKILL);
+        }
+    }
+    pthread_mutex_unlock(&job_lock);
+    g_cancellable_cancel(job->cancel);
+}
+
+static void command_jobs_cancel(int surface, long req) {
+    for(guint i=0; running_jobs != NULL && i<running_jobs->len; i++){
+        struct command_job *job = g_ptr_array_index(running_jobs, i);
+        if(job->surface == surface && job->req == req){
+            command_job_stop(job, JOB_CANCELED);
+        }
+    }
+}
+
+static int command_job_timeout_cb(struct webview *w, void *arg) {
+    struct command_job *job = (struct command_job *)arg;
+    (void)w;
+    job->timer = 0;
+    logger_warn("command", "Request %ld still running after %d ms, killing it", job->req, job->timeout_ms);
+    command_job_stop(job, JOB_TIMED_OUT);
+    return 0;
+}
+
+struct command_spawn_call {
+    char **argv;
+    char **env;
+    int out_fd;
+    pid_t pid;
+    int r;
+};
+
+static void command_spawn_cb(void *arg) {
+    struct command_spawn_call *c = (struct command_spawn_call *)arg;
+    c->r = command_spawn(c->argv, c->env, -1, c->out_fd, -1, &c->pid);
+}
+
+// On a sampler thread: starts argv for job, unless it was stopped already.
+// Started from there, it would run at the sampler's idle priority and on its
+// CPUs. Returns 0 or an errno value
+static int command_job_spawn(struct command_job *job, char **argv, char **env, int out_fd) {
+    struct command_spawn_call call = {argv, env, out_fd, 0, ECANCELED};
+    int r;
+    pthread_mutex_lock(&job_lock);
+    if(job->stopped == JOB_RUNNING){
+        sampler_call_normal(sampler, command_spawn_cb, &call);
+        if(call.r == 0){
+            job->pgid = call.pid;
+        }
+    }
+    r = call.r;
+    pthread_mutex_unlock(&job_lock);
+    if(r != 0 && r != ECANCELED){
+        logger_warn("command", "Failed to run command '%s': %s", argv[0], strerror(r));
+    }
+    return r;
+}
+
+// Stops watching with source, if it still does
+static void command_job_unwatch(GSource **source) {
+    if(*source != NULL){
+        g_source_destroy(*source);
+        g_source_unref(*source);
+        *source = NULL;
+    }
+}
+
+static void command_job_close_out(struct command_job *job) {
+    command_job_unwatch(&job->out_watch);
+    if(job->out_fd != -1){
+        close(job->out_fd);
+        job->out_fd = -1;
+    }
+    // Its leader reaped, nothing of it is waited for any more
+    if(job->child == 0){
+        pthread_mutex_lock(&job_lock);
+        job->pgid = 0;
+        pthread_mutex_unlock(&job_lock);
+    }
+}
+
+// Once its command has exited and its output, if read, is all in: back to
+// the GTK thread. job may be gone on return
+static void command_job_finish(struct command_job *job) {
+    const char *name = job->argv != NULL ? job->argv[0] : job->line;
+    if(job->child != 0 || job->out_fd != -1){
+        return;
+    }
+    command_job_unwatch(&job->cancel_watch);
+    if(job->out != NULL){
+        logger_debug("command", "Read %zu bytes from '%s'", job->out->len, name);
+    }
+    logger_debug("command", "Done: %s", name);
+    sampler_finish(job->handle);
+}
+
+// Its command ended: reaped, and what it used charged to the job's account.
+// Unless its output is still open, the pgid is given up before the leader is
+// reaped, while command_kill() still can't miss. Open, others of the group
+// may be writing to it: they keep the pgid from being reused, and are killed
+// with it. A killed command ends the output where it was
+static void command_job_exited(struct command_job *job) {
+    struct rusage ru;
+    int stopped;
+    pthread_mutex_lock(&job_lock);
+    if(job->out_fd == -1){
+        job->pgid = 0;
+    }
+    stopped = job->stopped;
+    pthread_mutex_unlock(&job_lock);
+    if(command_wait_usage(job->child, &ru) != -1){
+        usage_child(job->account, &ru);
+    }
+    job->child = 0;
+    command_job_unwatch(&job->exit_watch);
+    if(job->exit_fd != -1){
+        close(job->exit_fd);
+        job->exit_fd = -1;
+    }
+    if(stopped != JOB_RUNNING){
+        command_job_close_out(job);
+    }
+    command_job_finish(job);
+}
+
+static gboolean command_job_exit_cb(gint fd, GIOCondition condition, gpointer arg) {
+    struct command_job *job = (struct command_job *)arg;
+    struct usage_scope scope;
+    (void)fd;
+    (void)condition;
+    usage_begin(&scope, job->account);
+    command_job_exited(job);
+    usage_end(&scope);
+    return G_SOURCE_REMOVE;
+}
+
+// Without pidfds: looks again every COMMAND_POLL_MS
+static gboolean command_job_poll_cb(gpointer arg) {
+    struct command_job *job = (struct command_job *)arg;
+    if(command_exited(job->child) == 0){
+        return G_SOURCE_CONTINUE;
+    }
+    return command_job_exit_cb(-1, 0, arg);
+}
+
+// Stopped from the GTK thread. With its leader reaped already, what still
+// holds its output may not be in its group: stop reading, don't wait for it
+static gboolean command_job_cancel_cb(GCancellable *cancel, gpointer arg) {
+    struct command_job *job = (struct command_job *)arg;
+    (void)cancel;
+    command_job_unwatch(&job->cancel_watch);
+    if(job->child == 0){
+        command_job_close_out(job);
+        command_job_finish(job);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+// Takes what its command wrote so far, up to EOF
+static gboolean command_job_out_cb(gint fd, GIOCondition condition, gpointer arg) {
+    struct command_job *job = (struct command_job *)arg;
+    struct usage_scope scope;
+    (void)condition;
+    usage_begin(&scope, job->account);
+    if(capture_read_fd(job->out, fd) == -1){
+        if(errno == EAGAIN || errno == EWOULDBLOCK){
+            usage_end(&scope);
+            return G_SOURCE_CONTINUE;
+        }
+        logger_error("command", "read: %s", strerror(errno));
+    }
+    command_job_close_out(job);
+    command_job_finish(job);
+    usage_end(&scope);
+    return G_SOURCE_REMOVE;
+}
+
+// Leaves the command of job, just started, to the main loop of its sampler
+// thread instead of blocking it until the command ends: the thread goes on
+// with other jobs meanwhile
+static void command_job_watch(struct command_job *job, int out_fd) {
+    GMainContext *context = g_main_context_get_thread_default();
+    job->handle = sampler_defer();
+    job->child = job->pgid;
+    job->exit_fd = command_exit_fd(job->child);
+    if(job->exit_fd != -1){
+        job->exit_watch = g_unix_fd_source_new(job->exit_fd, G_IO_IN);
+        g_source_set_callback(job->exit_watch, (GSourceFunc)(void (*)(void))command_job_exit_cb, job, NULL);
+    } else {
+        job->exit_watch = g_timeout_source_new(COMMAND_POLL_MS);
+        g_source_set_callback(job->exit_watch, command_job_poll_cb, job, NULL);
+    }
+    g_source_attach(job->exit_watch, context);
+    job->out_fd = out_fd;
+    if(out_fd != -1){
+        job->out_watch = g_unix_fd_source_new(out_fd, G_IO_IN | G_IO_HUP | G_IO_ERR);
+        g_source_set_callback(job->out_watch, (GSourceFunc)(void (*)(void))command_job_out_cb, job, NULL);
+        g_source_attach(job->out_watch, context);
+        job->cancel_watch = g_cancellable_source_new(job->cancel);
+        g_source_set_callback(job->cancel_watch, (GSourceFunc)(void (*)(void))command_job_cancel_cb, job, NULL);
+        g_source_attach(job->cancel_watch, context);
+    }
+}
+
+// On a sampler thread: starts the command, its output on a pipe if wanted
+static void command_job_run(void *arg) {
+    struct command_job *job = (struct command_job *)arg;
+    struct usage_scope scope;
+    char **env = NULL;
+    char **argv = job->argv;
+    char *fullpath = NULL;
+    int reads = job->kind == JOB_EXEC_AND_READ || job->kind == JOB_SEND_AND_READ;
+    int out[2] = {-1, -1};
+    // The shell forms, as system() and popen() ran them, but with a pid
+    char *sh[] = {"/bin/sh", "-c", NULL, NULL};
+    usage_begin(&scope, job->account);
+    if(job->env != NULL){
+        int n = 0;
+        while(job->env[n] != NULL) n++;
+        env = command_env(job->env, n);
+    }
+
+    if(job->kind == JOB_EXEC){
+        logger_debug("command", "Command to be executed: %s -> Spawning it!", job->argv[0]);
+    }
+    if(job->kind == JOB_EXEC_AND_READ){
+        logger_debug("command", "Command to be executed and read back: %s -> Spawning it!", job->argv[0]);
+    }
+    if(job->kind == JOB_SEND_COMMAND){
+        logger_debug("command", "Command to be sent: %s -> Sending it!", job->line);
+        sh[2] = job->line;
+        argv = sh;
+    }
+    if(job->kind == JOB_SEND_AND_READ){
+        logger_debug("command", "Command to be sent and read back: %s -> Sending it!", job->line);
+        fullpath = malloc(strlen(job->line) + sizeof("/bin/ "));
+        if(fullpath != NULL){
+            sprintf(fullpath, "%s/%s ", "/bin", job->line);
+            sh[2] = fullpath;
+        }
+        argv = fullpath != NULL ? sh : NULL;
+    }
+    if(argv != NULL && reads && pipe2(out, O_CLOEXEC) == -1){
+        logger_error("command", "pipe2: %s", strerror(errno));
+        argv = NULL;
+    }
+    if(argv != NULL && command_job_spawn(job, argv, env, out[1]) == 0){
+        if(reads){
+            close(out[1]);
+            job->out = capture_new();
+            if(job->out != NULL){
+                capture_set_owner(job->out, capture_mem_cb, job->account);
+                fcntl(out[0], F_SETFL, O_NONBLOCK);
+            } else {
+                close(out[0]);
+                out[0] = -1;
+            }
+        }
+        command_job_watch(job, out[0]);
+    } else if(out[0] != -1){
+        close(out[0]);
+        close(out[1]);
+    }
+    free(env);
+    free(fullpath);
+    usage_end(&scope);
+}
+
+// Back on the GTK thread
+static void command_job_done(struct webview *w, void *arg) {
+    struct command_job *job = (struct command_job *)arg;
+    static const char *const why[] = {"", "canceled", "superseded", "timed out"};
+    g_ptr_array_remove_fast(running_jobs, job);
+    if(job->timer != 0){
+        webview_timer_remove(w, job->timer);
+    }
+    if(job->stopped != JOB_RUNNING){
+        logger_info("command", "Request %ld %s, its result dropped", job->req, why[job->stopped]);
+        if(job->out != NULL){
+            capture_unref(job->out);
+        }
+        // The page still waits for this one: window.external.oncapture(id, null, 0)
+        if(job->stopped == JOB_TIMED_OUT && (job->kind == JOB_EXEC_AND_READ || job->kind == JOB_SEND_AND_READ)){
+            char js[96];
+            snprintf(js, sizeof(js),
+                     "window.external.oncapture&&"
+                     "window.external.oncapture(%ld,null,0)", job->req);
+            webview_eval(w, js);
+        }
+    } else if(job->out != NULL){
+        publish_capture(w, job->out, job->req, job->surface, job->account);
+    }
+    if(job->channel != NULL){
+        channels_done(channels, job->channel);
+    }
+    command_job_free(job);
+}
+
+// A channel's message, its turn come: handled as any other, and its channel
+// waits for the commands it starts
+static int channel_run_cb(struct channels *c, const char *name, const char *msg, void *arg) {
+    (void)c;
+    struct webview *w = (struct webview *)arg;
+    channel_running = name;
+    channel_jobs = 0;
+    my_cb(w, msg);
+    channel_running = NULL;
+    return channel_jobs;
+}
+
+// Index of the token right after the value starting at token i
+static int json_skip(const jsmntok_t *tokens, int i) {
+    int pending = 1;
+    while(pending > 0){
+        pending += tokens[i].size - 1;
+        i++;
+    }
+    return i;
+}
+
+static int json_key_is(const char *js, const jsmntok_t *key, const char *name) {
+    int len = key->end - key->start;
+    return key->type == JSMN_STRING && (int)strlen(name) == len &&
+           strncmp(js + key->start, name, len) == 0;
+}
+
+// Copy of a JSON string token with its escapes resolved
+static char *json_string(const char *js, const jsmntok_t *t) {
+    char *out = malloc(t->end - t->start + 1);
+    if(out == NULL){
+        return NULL;
+    }
+    char *o = out;
+    for(int i = t->start; i < t->end; i++){
+        if(js[i] != '\\' || i + 1 >= t->end){
+            *o++ = js[i];
+            continue;
+        }
+        i++;
+        switch(js[i]){
+            case 'b': *o++ = '\b'; break;
+            case 'f': *o++ = '\f'; break;
+            case 'n': *o++ = '\n'; break;
+            case 'r': *o++ = '\r'; break;
+            case 't': *o++ = '\t'; break;
+            case 'u': {
+                // \uXXXX is 6 bytes long, its UTF-8 form 3 at most
+                char hex[5] = {0};
+                memcpy(hex, js + i + 1, i + 4 < t->end ? 4 : 0);
+                unsigned long cp = strtoul(hex, NULL, 16);
+                i += 4;
+                if(cp < 0x80){
+                    *o++ = (char)cp;
+                } else if(cp < 0x800){
+                    *o++ = (char)(0xc0 | (cp >> 6));
+                    *o++ = (char)(0x80 | (cp & 0x3f));
+                } else {
+                    *o++ = (char)(0xe0 | (cp >> 12));
+                    *o++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+                    *o++ = (char)(0x80 | (cp & 0x3f));
+                }
+                break;
+            }
+            default: *o++ = js[i]; break;
+        }
+    }
+    *o = '\0';
+    return out;
+}
+
+// NULL-terminated argv out of a JSON array of strings
+static char **json_argv(const char *js, const jsmntok_t *tokens, int array) {
+    int n = tokens[array].size;
+    char **argv = calloc(n + 1, sizeof(char *));
+    if(argv == NULL){
+        return NULL;
+    }
+    for(int a = 0, i = array + 1; a < n; a++, i = json_skip(tokens, i)){
+        if(tokens[i].type != JSMN_STRING && tokens[i].type != JSMN_PRIMITIVE){
+            json_argv_free(argv);
+            return NULL;
+        }
+        argv[a] = json_string(js, &tokens[i]);
+    }
+    return argv;
+}
+
+static void json_argv_free(char **argv) {
+    if(argv == NULL){
+        return;
+    }
+    for(int i = 0; argv[i] != NULL; i++){
+        free(argv[i]);
+    }
+    free(argv);
+}
+
+// A capture's buffer, charged to the widget it is for until it is fetched
+static void capture_mem_cb(void *owner, ssize_t delta) {
+    usage_add_mem((struct usage_account *)owner, delta);
+}
+
+// Tells the page where to fetch a finished output from:
+//   window.external.oncapture = function(id, url, length) {
+//     fetch(url).then(function(r) { return r.text(); }).then(...);
+//   }
+static void publish_capture(struct webview *w, struct capture *c, long req, int surface, struct usage_account *account) {
+    size_t len = c->len;
+    char url[CAPTURE_URL_MAX];
+    capture_publish(c, surface, url);
+    char js[160];
+    snprintf(js, sizeof(js),
+             "window.external.oncapture&&"
+             "window.external.oncapture(%ld,'%s',%zu)", req, url, len);
+    usage_js(account, len + strlen(js));
+    webview_eval(w, js);
+}
+
+static guint flush_source = 0;
+
+static gboolean databind_flush_cb(gpointer arg) {
+    struct webview *w = (struct webview *)arg;
+    struct usage_scope scope;
+    usage_begin(&scope, usage_account(usage, "databind"));
+    flush_source = 0;
+    char *js = databind_flush(store);
+    if(js != NULL){
+        usage_js(scope.account, strlen(js));
+        webview_eval(w, js);
+        free(js);
+    }
+    usage_end(&scope);
+    return G_SOURCE_REMOVE;
+}
+
+// The store just got its first change: push at the end of this wakeup, along
+// with whatever else changes in the meantime
+static void databind_notify_cb(struct databind *db, void *arg) {
+    (void)db;
+    if(flush_source == 0){
+        flush_source = g_idle_add(databind_flush_cb, arg);
+    }
+}
+
+// The web process died and the page was loaded again, empty: send it the
+// whole store, the providers will only send what changes from now on
+static void recover_cb(struct webview *w, int reason, void *arg) {
+    (void)w;
+    (void)arg;
+    logger_info("main", "Page recovered (reason %d), restoring its state", reason);
+    databind_touch_all(store);
+}
+
+static int snapshot_cb(struct webview *w, void *arg) {
+    const char *path = (const char *)arg;
+    struct usage_scope scope;
+    usage_begin(&scope, usage_account(usage, "snapshot"));
+    g_free(snapshot_session_state);
+    snapshot_session_state = webview_get_session_state(w, &snapshot_session_state_len);
+    if(snapshot_write(path, snapshot_session_state, snapshot_session_state_len, store) != 0){
+        logger_warn("main", "%s: %s", path, strerror(errno));
+    }
+    usage_end(&scope);
+    return 1;
+}
+
+// webview.h's own messages
+static void webview_log_cb(const char *s, void *arg) {
+    (void)arg;
+    logger_info("webview", "%s", s);
+}
+
+static void sampler_warn_cb(const char *s, void *arg) {
+    (void)arg;
+    logger_warn("sampler", "%s", s);
+}
+
+static void dbus_warn_cb(const char *s, void *arg) {
+    (void)arg;
+    logger_warn("dbus", "%s", s);
+}
+
+// Covered by other windows: the providers slow down with the timers, and
+// catch up as soon as the window shows again
+static void hidden_cb(struct webview *w, int hidden, void *arg) {
+    logger_info("main", "%s", hidden ? "Hidden, sampling in the background" : "Shown");
+    sampler_set_background((struct sampler *)arg, hidden ? w->hidden_interval_ms : 0);
+}
+
+static gboolean terminate_cb(gpointer arg) {
+    webview_terminate((struct webview *)arg);
+    return G_SOURCE_CONTINUE;
+}
+
+static int clock_cb(struct webview *w, void *arg) {
+    (void)w;
+    (void)arg;
+    char now[16];
+    struct usage_scope scope;
+    usage_begin(&scope, usage_account(usage, "clock"));
+    time_t t = time(NULL);
+    strftime(now, sizeof(now), "%H:%M:%S", localtime(&t));
+    databind_set_string(store, "clock", now);
+    usage_end(&scope);
+    return 1;
+}
+
+// What the buffers of the caches hold, as of now
+static void usage_refresh(void) {
+    unsigned long hits, misses;
+    size_t bytes;
+    icons_stats(icons, &hits, &misses, &bytes);
+    usage_set_mem(usage_account(usage, "icons"), bytes);
+    usage_set_mem(usage_account(usage, "history"), timeseries_bytes(history));
+}
+
+// { usage: {}, id: 5 } comes back as window.external.onusage(5, {"page":
+//   {"cpu_us":..,"wakeups":..,"children":..,...},"history":{...},...})
+static void usage_reply(struct webview *w, long req) {
+    if(usage == NULL){
+        return;
+    }
+    usage_refresh();
+    char *json = usage_json(usage);
+    if(json == NULL){
+        return;
+    }
+    char *js = malloc(strlen(json) + 96);
+    if(js != NULL){
+        sprintf(js, "window.external.onusage&&window.external.onusage(%ld,%s)", req, json);
+        webview_eval(w, js);
+        free(js);
+    }
+    free(json);
+}
+
+static void usage_line_cb(const char *line, void *arg) {
+    (void)arg;
+    logger_info("usage", "%s", line);
+}
+
+static int usage_log_cb(struct webview *w, void *arg) {
+    (void)w;
+    (void)arg;
+    usage_refresh();
+    usage_report(usage, usage_line_cb, NULL);
+    return 1;
+}
+
+// Serves bundle:///<file>, the panels the page builds after its first frame
+static void bundle_scheme_cb(WebKitURISchemeRequest *request, gpointer arg) {
+    struct panels *panels = (struct panels *)arg;
+    const char *path = webkit_uri_scheme_request_get_path(request), *mime;
+    size_t len;
+    void *data = panels_read(panels, path, &len, &mime);
+    if(data == NULL){
+        GError *error = g_error_new(G_IO_ERROR, g_io_error_from_errno(errno),
+                                    "%s: %s", path, g_strerror(errno));
+        webkit_uri_scheme_request_finish_error(request, error);
+        g_error_free(error);
+        return;
+    }
+    GBytes *bytes = g_bytes_new_take(data, len);
+    GInputStream *stream = g_memory_input_stream_new_from_bytes(bytes);
+    webkit_uri_scheme_request_finish(request, stream, len, mime);
+    g_object_unref(stream);
+    g_bytes_unref(bytes);
+}
+
+// Serves capture://<id>-<key>, to the window it was published for only: the
+// buffer itself goes to WebKit, and back to the pool once WebKit has
+// consumed it
+static void capture_scheme_cb(WebKitURISchemeRequest *request, gpointer arg) {
+    struct webview *w = (struct webview *)arg;
+    const char *uri = webkit_uri_scheme_request_get_uri(request);
+    struct capture *c = capture_take(uri, webview_request_surface(w, request));
+    if(c == NULL){
+        GError *error = g_error_new(G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                    "No capture %s (or already fetched)", uri);
+        webkit_uri_scheme_request_finish_error(request, error);
+        g_error_free(error);
+        return;
+    }
+    GBytes *bytes = g_bytes_new_with_free_func(c->data, c->len,
+                                               (GDestroyNotify)capture_unref, c);
+    GInputStream *stream = g_memory_input_stream_new_from_bytes(bytes);
+    webkit_uri_scheme_request_finish(request, stream, c->len, "text/plain");
+    g_object_unref(stream);
+    g_bytes_unref(bytes);
+}
+
+
 
 
 /**
@@ -0,0 +1,302 @@
+/*
+ * Widget panels built when they are needed, not all at page load.
+ *
+ * A manifest names the page's panels, the file each one is built from and
+ * when it is loaded:
+ *
+ *   # name      load     file, relative to the manifest
+ *   brightness  reveal   brightness.html
+ *   terminal    idle     terminal.html
+ *
+ *   startup  fetched as the page starts, built once the DOM is ready
+ *   reveal   built the first time its placeholder is shown
+ *   idle     built when the page is idle, or when shown, if that is sooner
+ *
+ * The directory of the manifest is the bundle: its files are served to the
+ * page as bundle:///<file> (panels_read()). The page marks where each panel
+ * goes with <div data-panel="name"></div>; PANELS_RUNTIME, installed as an
+ * init script by way of panels_script(), fills them in. A panel's HTML may
+ * carry its own <style> and <script>, which run as it is inserted.
+ *
+ * On the page, window.panels.load(name) builds a panel now and returns a
+ * promise; a 'panelload' event bubbles from the placeholder once it is built.
+ */
+#ifndef PANELS_H
+#define PANELS_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef PANELS_STATIC
+#define PANELS_API static
+#else
+#define PANELS_API extern
+#endif
+
+#define PANELS_SCHEME "bundle"
+
+/* Called with the manifest, as a JSON object: {"name":{"file":..,"load":..}} */
+#define PANELS_RUNTIME                                                         \
+  "(function(m){var t={},l={},"                                               \
+  "r=new Promise(function(f){if(document.readyState==='loading')"             \
+  "document.addEventListener('DOMContentLoaded',f);else f();}),"              \
+  "idle=window.requestIdleCallback||function(f){setTimeout(f,2000);},o;"      \
+  "function q(n){return document.querySelector('[data-panel=\"'+n+'\"]');}"   \
+  "function text(n){return t[n]||(t[n]=fetch('" PANELS_SCHEME ":///'+m[n].file)" \
+  ".then(function(x){if(!x.ok)throw new Error(m[n].file+': '+x.status);"      \
+  "return x.text();}));}"                                                      \
+  "function load(n){if(!m[n])return Promise.reject(new Error('No panel '+n));" \
+  "return l[n]||(l[n]=Promise.all([text(n),r]).then(function(a){"             \
+  "var e=q(n),s,c,i,j,d=window.__databind;if(!e)return;e.innerHTML=a[0];"     \
+  "s=e.querySelectorAll('script');for(i=0;i<s.length;i++){"                    \
+  "c=document.createElement('script');for(j=0;j<s[i].attributes.length;j++)"  \
+  "c.setAttribute(s[i].attributes[j].name,s[i].attributes[j].value);"         \
+  "c.textContent=s[i].textContent;s[i].parentNode.replaceChild(c,s[i]);}"     \
+  "if(d){s=e.querySelectorAll('[data-bind]');for(i=0;i<s.length;i++)"         \
+  "if(s[i].getAttribute('data-bind')in d.v)d.a(s[i].getAttribute('data-bind'));}" \
+  "e.dispatchEvent(new CustomEvent('panelload',{bubbles:true,detail:n}));}));}" \
+  "function each(n){var e=q(n);if(m[n].load==='startup'){load(n);return;}"    \
+  "if(e&&o)o.observe(e);if(m[n].load==='idle'||!o)idle(function(){load(n);});}" \
+  "window.panels={manifest:m,load:load};"                                      \
+  "for(var n in m)if(m[n].load==='startup')text(n).catch(function(){});"      \
+  "r.then(function(){if(window.IntersectionObserver)"                          \
+  "o=new IntersectionObserver(function(es){es.forEach(function(e){"           \
+  "if(e.isIntersecting){o.unobserve(e.target);"                                \
+  "load(e.target.getAttribute('data-panel'));}});});"                          \
+  "for(var n in m)each(n);});})"
+
+enum panels_load {
+  PANELS_STARTUP,
+  PANELS_REVEAL,
+  PANELS_IDLE,
+};
+
+struct panels;
+
+/**
+ * Reads the manifest at path. Returns NULL if it cannot be read or has a bad
+ * line, with errno set (and the line reported on stderr).
+ */
+PANELS_API struct panels *panels_load(const char *path);
+
+PANELS_API void panels_free(struct panels *p);
+
+/**
+ * Returns the init script that builds the panels on the page, to free(), or
+ * NULL when out of memory.
+ */
+PANELS_API char *panels_script(struct panels *p);
+
+/**
+ * Reads a file of the bundle, given the path of its bundle:// URI. Returns
+ * its contents, to free(), and their type in mime; NULL, with errno set, if
+ * the file is missing or the path leaves the bundle.
+ */
+PANELS_API void *panels_read(struct panels *p, const char *path, size_t *len,
+                             const char **mime);
+
+#ifndef PANELS_HEADER
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct panel {
+  char *name;
+  char *file;
+  enum panels_load load;
+};
+
+struct panels {
+  char *dir; /* The bundle, with a trailing '/' */
+  struct panel *panels;
+  size_t len;
+};
+
+static const char *panels_load_names[] = {"startup", "reveal", "idle"};
+
+/* Names and files go into the script and URIs as they are: keep them plain */
+static int panels_plain(const char *s) {
+  const char *c;
+  if (*s == '\0' || *s == '/') {
+    return 0;
+  }
+  for (c = s; *c != '\0'; c++) {
+    if (!((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') ||
+          (*c >= '0' && *c <= '9') || *c == '-' || *c == '_' || *c == '.' ||
+          *c == '/')) {
+      return 0;
+    }
+  }
+  return strstr(s, "..") == NULL;
+}
+
+static int panels_parse_line(struct panels *p, char *line) {
+  char *name, *load, *file, *save;
+  struct panel *more;
+  int i;
+  name = strtok_r(line, " \t\r\n", &save);
+  if (name == NULL || name[0] == '#') {
+    return 0;
+  }
+  load = strtok_r(NULL, " \t\r\n", &save);
+  file = strtok_r(NULL, " \t\r\n", &save);
+  if (load == NULL || file == NULL || strtok_r(NULL, " \t\r\n", &save) != NULL ||
+      !panels_plain(name) || !panels_plain(file)) {
+    return -1;
+  }
+  for (i = 0; i < 3 && strcmp(load, panels_load_names[i]) != 0; i++) {
+  }
+  if (i == 3) {
+    return -1;
+  }
+  more = (struct panel *)realloc(p->panels, (p->len + 1) * sizeof(struct panel));
+  if (more == NULL) {
+    return -1;
+  }
+  p->panels = more;
+  more[p->len].name = strdup(name);
+  more[p->len].file = strdup(file);
+  more[p->len].load = (enum panels_load)i;
+  p->len++;
+  return more[p->len - 1].name != NULL && more[p->len - 1].file != NULL ? 0
+                                                                       : -1;
+}
+
+PANELS_API struct panels *panels_load(const char *path) {
+  struct panels *p = (struct panels *)calloc(1, sizeof(struct panels));
+  const char *slash = strrchr(path, '/');
+  size_t dir_len = slash != NULL ? (size_t)(slash - path) + 1 : 0;
+  char line[1024];
+  int n = 0;
+  FILE *f;
+  if (p == NULL) {
+    return NULL;
+  }
+  p->dir = (char *)malloc(dir_len + 1);
+  f = fopen(path, "r");
+  if (p->dir == NULL || f == NULL) {
+    panels_free(p);
+    return NULL;
+  }
+  memcpy(p->dir, path, dir_len);
+  p->dir[dir_len] = '\0';
+  while (fgets(line, sizeof(line), f) != NULL) {
+    n++;
+    if (panels_parse_line(p, line) != 0) {
+      fprintf(stderr, "%s:%d: expected: name startup|reveal|idle file\n", path,
+              n);
+      fclose(f);
+      panels_free(p);
+      errno = EINVAL;
+      return NULL;
+    }
+  }
+  fclose(f);
+  return p;
+}
+
+PANELS_API void panels_free(struct panels *p) {
+  size_t i;
+  if (p == NULL) {
+    return;
+  }
+  for (i = 0; i < p->len; i++) {
+    free(p->panels[i].name);
+    free(p->panels[i].file);
+  }
+  free(p->panels);
+  free(p->dir);
+  free(p);
+}
+
+PANELS_API char *panels_script(struct panels *p) {
+  size_t len = sizeof(PANELS_RUNTIME) + sizeof("({})"), i;
+  char *s, *o;
+  for (i = 0; i < p->len; i++) {
+    len += strlen(p->panels[i].name) + strlen(p->panels[i].file) +
+           sizeof("\"\":{\"file\":\"\",\"load\":\"startup\"},");
+  }
+  s = (char *)malloc(len);
+  if (s == NULL) {
+    return NULL;
+  }
+  o = s + sprintf(s, "%s({", PANELS_RUNTIME);
+  for (i = 0; i < p->len; i++) {
+    o += sprintf(o, "%s\"%s\":{\"file\":\"%s\",\"load\":\"%s\"}",
+                 i > 0 ? "," : "", p->panels[i].name, p->panels[i].file,
+                 panels_load_names[p->panels[i].load]);
+  }
+  strcpy(o, "})");
+  return s;
+}
+
+static const char *panels_mime(const char *path) {
+  static const struct {
+    const char *ext, *mime;
+  } types[] = {
+      {".html", "text/html"},         {".js", "application/javascript"},
+      {".css", "text/css"},           {".json", "application/json"},
+      {".svg", "image/svg+xml"},      {".png", "image/png"},
+  };
+  size_t n = strlen(path), i;
+  for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+    size_t e = strlen(types[i].ext);
+    if (n > e && strcmp(path + n - e, types[i].ext) == 0) {
+      return types[i].mime;
+    }
+  }
+  return "application/octet-stream";
+}
+
+PANELS_API void *panels_read(struct panels *p, const char *path, size_t *len,
+                             const char **mime) {
+  size_t dir_len = strlen(p->dir);
+  char *full, *data = NULL;
+  long size;
+  FILE *f;
+  while (*path == '/') {
+    path++;
+  }
+  if (!panels_plain(path)) {
+    errno = EACCES;
+    return NULL;
+  }
+  full = (char *)malloc(dir_len + strlen(path) + 1);
+  if (full == NULL) {
+    return NULL;
+  }
+  memcpy(full, p->dir, dir_len);
+  strcpy(full + dir_len, path);
+  f = fopen(full, "rb");
+  free(full);
+  if (f == NULL) {
+    return NULL;
+  }
+  if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 &&
+      fseek(f, 0, SEEK_SET) == 0) {
+    data = (char *)malloc(size > 0 ? size : 1);
+    if (data != NULL && fread(data, 1, size, f) != (size_t)size) {
+      free(data);
+      data = NULL;
+      errno = EIO;
+    }
+  }
+  fclose(f);
+  if (data != NULL) {
+    *len = (size_t)size;
+    *mime = panels_mime(path);
+  }
+  return data;
+}
+
+#endif /* PANELS_HEADER */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PANELS_H */
@@ -0,0 +1,267 @@
+/*
+ * Records the traffic between the page and the native side into a compact
+ * binary log, for replay.c to re-drive offline:
+ *
+ *   struct recorder *rec = recorder_open("session.wvrec");
+ *   webview_set_trace(&webview, recorder_trace_cb, rec);
+ *   ...
+ *   recorder_close(rec);
+ *
+ * The log is an 8 byte header ("WVREC", 0, 0, version) then one record per
+ * invoke payload, evaluated script or dispatched call:
+ *
+ *   kind     1 byte (RECORDER_INVOKE, RECORDER_EVAL, RECORDER_DISPATCH)
+ *   delta    varint, microseconds since the previous record
+ *   length   varint
+ *   data     length bytes: the payload, the script, or the name of the
+ *            dispatched function
+ *
+ * Writes go through a large stdio buffer: recording costs a memcpy per
+ * message, not a syscall.
+ */
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef RECORDER_STATIC
+#define RECORDER_API static
+#else
+#define RECORDER_API extern
+#endif
+
+/* Same values as WEBVIEW_TRACE_* */
+#define RECORDER_INVOKE 1
+#define RECORDER_EVAL 2
+#define RECORDER_DISPATCH 3
+
+#define RECORDER_VERSION 1
+
+struct recorder;
+
+struct recorder_record {
+  int kind;
+  uint64_t t_us; /* Since the first record */
+  size_t len;
+  char *data;    /* NUL-terminated, valid until the next recorder_read() */
+};
+
+/**
+ * Creates (truncates) the log at path. Returns NULL on error, with errno set.
+ */
+RECORDER_API struct recorder *recorder_open(const char *path);
+
+/**
+ * Opens an existing log for recorder_read().
+ */
+RECORDER_API struct recorder *recorder_open_read(const char *path);
+
+RECORDER_API void recorder_close(struct recorder *r);
+
+RECORDER_API int recorder_write(struct recorder *r, int kind, const char *data,
+                                size_t len);
+
+/**
+ * Reads the next record. Returns 1, 0 at the end of the log, or -1 if the
+ * log is damaged.
+ */
+RECORDER_API int recorder_read(struct recorder *r,
+                               struct recorder_record *rec);
+
+#ifdef WEBVIEW_H
+/* A webview_trace_fn, arg being the recorder */
+RECORDER_API void recorder_trace_cb(struct webview *w, int kind,
+                                    const char *data, webview_dispatch_fn fn,
+                                    void *arg);
+#endif
+
+#ifndef RECORDER_HEADER
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RECORDER_BUFFER (256 * 1024)
+
+static const char recorder_magic[8] = {'W', 'V', 'R', 'E', 'C', 0, 0,
+                                       RECORDER_VERSION};
+
+struct recorder {
+  FILE *f;
+  uint64_t last_us;
+  /* Reading: the current record's data */
+  char *data;
+  size_t cap;
+};
+
+static uint64_t recorder_now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static struct recorder *recorder_new(const char *path, const char *mode) {
+  struct recorder *r = (struct recorder *)calloc(1, sizeof(struct recorder));
+  if (r == NULL) {
+    return NULL;
+  }
+  r->f = fopen(path, mode);
+  if (r->f == NULL) {
+    free(r);
+    return NULL;
+  }
+  setvbuf(r->f, NULL, _IOFBF, RECORDER_BUFFER);
+  return r;
+}
+
+RECORDER_API struct recorder *recorder_open(const char *path) {
+  struct recorder *r = recorder_new(path, "wb");
+  if (r == NULL) {
+    return NULL;
+  }
+  fwrite(recorder_magic, 1, sizeof(recorder_magic), r->f);
+  return r;
+}
+
+RECORDER_API struct recorder *recorder_open_read(const char *path) {
+  char magic[sizeof(recorder_magic)];
+  struct recorder *r = recorder_new(path, "rb");
+  if (r == NULL) {
+    return NULL;
+  }
+  if (fread(magic, 1, sizeof(magic), r->f) != sizeof(magic) ||
+      memcmp(magic, recorder_magic, sizeof(magic)) != 0) {
+    recorder_close(r);
+    errno = EINVAL;
+    return NULL;
+  }
+  return r;
+}
+
+RECORDER_API void recorder_close(struct recorder *r) {
+  if (r == NULL) {
+    return;
+  }
+  fclose(r->f);
+  free(r->data);
+  free(r);
+}
+
+static void recorder_put_varint(FILE *f, uint64_t v) {
+  while (v >= 0x80) {
+    putc((int)(v & 0x7f) | 0x80, f);
+    v >>= 7;
+  }
+  putc((int)v, f);
+}
+
+static int recorder_get_varint(FILE *f, uint64_t *v) {
+  int shift = 0;
+  *v = 0;
+  for (;;) {
+    int c = getc(f);
+    if (c == EOF || shift > 63) {
+      return -1;
+    }
+    *v |= (uint64_t)(c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      return 0;
+    }
+    shift += 7;
+  }
+}
+
+RECORDER_API int recorder_write(struct recorder *r, int kind, const char *data,
+                                size_t len) {
+  uint64_t now = recorder_now_us();
+  /* The first record starts the clock */
+  uint64_t delta = r->last_us != 0 ? now - r->last_us : 0;
+  r->last_us = now;
+  putc(kind, r->f);
+  recorder_put_varint(r->f, delta);
+  recorder_put_varint(r->f, len);
+  if (fwrite(data, 1, len, r->f) != len) {
+    return -1;
+  }
+  return 0;
+}
+
+RECORDER_API int recorder_read(struct recorder *r,
+                               struct recorder_record *rec) {
+  uint64_t delta, len;
+  int kind = getc(r->f);
+  if (kind == EOF) {
+    return 0;
+  }
+  if (recorder_get_varint(r->f, &delta) != 0 ||
+      recorder_get_varint(r->f, &len) != 0) {
+    return -1;
+  }
+  if (len + 1 > r->cap) {
+    size_t cap = r->cap > 0 ? r->cap : 4096;
+    char *data;
+    while (cap < len + 1) {
+      cap *= 2;
+    }
+    data = (char *)realloc(r->data, cap);
+    if (data == NULL) {
+      return -1;
+    }
+    r->data = data;
+    r->cap = cap;
+  }
+  if (fread(r->data, 1, len, r->f) != len) {
+    return -1;
+  }
+  r->data[len] = '\0';
+  r->last_us += delta;
+  rec->kind = kind;
+  rec->t_us = r->last_us;
+  rec->len = len;
+  rec->data = r->data;
+  return 1;
+}
+
+#ifdef WEBVIEW_H
+RECORDER_API void recorder_trace_cb(struct webview *w, int kind,
+                                    const char *data, webview_dispatch_fn fn,
+                                    void *arg) {
+  struct recorder *r = (struct recorder *)arg;
+  Dl_info info;
+  char name[256];
+  (void)w;
+  if (kind == RECORDER_DISPATCH) {
+    /* Names, or offsets in their binary, are stable across runs; addresses
+     * are not. Static functions only have the offset. */
+    int found = dladdr((void *)fn, &info) != 0;
+    if (found && info.dli_saddr == (void *)fn && info.dli_sname != NULL) {
+      data = info.dli_sname;
+    } else if (found && info.dli_fname != NULL) {
+      const char *base = strrchr(info.dli_fname, '/');
+      snprintf(name, sizeof(name), "%s+%#lx",
+               base != NULL ? base + 1 : info.dli_fname,
+               (unsigned long)((char *)fn - (char *)info.dli_fbase));
+      data = name;
+    } else {
+      snprintf(name, sizeof(name), "%p", (void *)fn);
+      data = name;
+    }
+  }
+  recorder_write(r, kind, data, strlen(data));
+}
+#endif
+
+#endif /* RECORDER_HEADER */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RECORDER_H */
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Frame times of a widget page under each rendering policy, best first
+# Usage: ./render-bench.sh file:///path/to/page.html [ms] [out.jsonl]
+#
+# Each run repaints the whole page for ms (default 10000) and prints one JSON
+# line: p50/p95/p99/max frame interval as the page saw it, and the average
+# and worst native paint. Run it on the machine the widget is for: which
+# policy wins depends on its GPU, driver and compositor.
+
+MS=${2:-10000}
+OUT=${3:-render-bench.jsonl}
+: > $OUT
+for accel in never always on-demand; do
+  for scale in "" ",device-scale=1"; do
+    for opaque in auto always; do
+      ./webview-example --no-snapshot --render-bench $MS \
+                        --render "accel=$accel,opaque=$opaque$scale" \
+                        --url $1 | tee -a $OUT
+    done
+  done
+done
+# By p95 frame interval
+sed 's/.*"render":"\([^"]*\)".*"p95_ms":\([0-9.]*\).*/\2 \1/' $OUT | sort -n
@@ -0,0 +1,344 @@
+/*
+ * Replays a log written by recorder.h through the real my_cb(), without a
+ * window, and reports what the native side spends on it, stage by stage.
+ *
+ *   gcc -O2 -DWEBVIEW_GTK=1 -o replay replay.c \
+ *       $(pkg-config --cflags --libs gtk+-3.0 webkit2gtk-4.0 dbus-1) \
+ *       -lpthread -ldl
+ *   ./replay [-n runs] [-p] [-s] session.wvrec
+ *
+ * my_cb() is the one of main-myexample.c, included below with its main()
+ * renamed, as bench/bench.c does. Its sampler is replaced by one that
+ * completes each job without running it, and what would leave the process
+ * is counted instead: evaluated scripts (the replies) and D-Bus calls. Each
+ * invoke payload is timed through my_cb()'s own stages:
+ *
+ *   parse   jsmn_parse_simd(), or jsmn_parse() with -s
+ *   handle  the rest of my_cb(): keys, argv and strings decoded, jobs built
+ *   submit  the jobs handed to the sampler, and their completion
+ *   my_cb   all of it
+ *
+ * Recorded evaluated scripts and dispatched calls only run inside the
+ * webview: they are reported as the recorded traffic, by size and rate, and
+ * by function for dispatches.
+ *
+ * -n runs the whole log that many times; -p keeps the recorded gaps between
+ * messages, so caches are as cold as they were on the user's desktop.
+ */
+#define _GNU_SOURCE
+#define SAMPLER_HEADER
+#define WEBVIEW_IMPLEMENTATION
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "webview.h"
+#include "jsmn.h"
+#include "jsmn-simd.h"
+
+/* my_cb()'s calls out of the process, and its parser, go through here */
+static int replay_eval(struct webview *w, const char *js);
+static int replay_parse(jsmn_parser *p, const char *js, size_t len,
+                        jsmntok_t *tokens, unsigned int ntokens);
+#define webview_eval replay_eval
+#define jsmn_parse_simd replay_parse
+#include "dbus-bridge.h"
+static void replay_dbus_call(struct dbus_bridge *b, GBusType bus,
+                             const char *dest, const char *path,
+                             const char *interface, const char *method,
+                             const char *signature, const char *args,
+                             long req, dbus_bridge_reply_fn reply, void *arg);
+#define dbus_bridge_call replay_dbus_call
+
+#define main webview_example_main
+#include "main-myexample.c"
+#undef main
+#undef webview_eval
+#undef jsmn_parse_simd
+#undef dbus_bridge_call
+
+struct stage {
+  const char *name;
+  uint64_t *ns;
+  size_t count;
+  size_t cap;
+  uint64_t bytes;
+};
+
+struct traffic {
+  size_t count;
+  uint64_t bytes;
+};
+
+struct dispatch_count {
+  char *name;
+  size_t count;
+};
+
+static struct stage parse = {.name = "parse"};
+static struct stage handle = {.name = "handle"};
+static struct stage submit = {.name = "submit"};
+static struct stage whole = {.name = "my_cb"};
+static struct traffic traffic[4];
+static struct traffic replies, dbus_calls;
+static struct dispatch_count *dispatches;
+static size_t ndispatches;
+/* -s: jsmn.h's byte by byte parser, for comparison */
+static int scalar;
+/* Spent in the current payload's parse and submit stages so far */
+static uint64_t parse_ns, submit_ns;
+static struct webview replay_webview;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void stage_add(struct stage *s, uint64_t ns, size_t bytes) {
+  if (s->count == s->cap) {
+    s->cap = s->cap > 0 ? s->cap * 2 : 1024;
+    s->ns = realloc(s->ns, s->cap * sizeof(uint64_t));
+    if (s->ns == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  s->ns[s->count++] = ns;
+  s->bytes += bytes;
+}
+
+/* ---- The sampler of my_cb(): jobs complete at once, nothing runs ---- */
+
+struct sampler {
+  struct webview *w;
+};
+
+struct sampler *sampler_new(struct webview *w,
+                            const struct sampler_config *config) {
+  struct sampler *s = calloc(1, sizeof(struct sampler));
+  (void)config;
+  s->w = w;
+  return s;
+}
+
+void sampler_free(struct sampler *s) { free(s); }
+
+void sampler_submit(struct sampler *s, sampler_job_fn job,
+                    webview_dispatch_fn done, void *arg) {
+  uint64_t t0 = now_ns();
+  (void)job;
+  if (done != NULL) {
+    done(s->w, arg);
+  }
+  submit_ns += now_ns() - t0;
+}
+
+unsigned int sampler_add_provider(struct sampler *s, int interval_ms,
+                                  sampler_job_fn sample,
+                                  webview_dispatch_fn publish, void *arg) {
+  (void)s, (void)interval_ms, (void)sample, (void)publish, (void)arg;
+  return 0;
+}
+
+void sampler_remove_provider(struct sampler *s, unsigned int id) {
+  (void)s, (void)id;
+}
+
+void sampler_set_background(struct sampler *s, int interval_ms) {
+  (void)s, (void)interval_ms;
+}
+
+void sampler_call_normal(struct sampler *s, sampler_job_fn fn, void *arg) {
+  (void)s;
+  fn(arg);
+}
+
+void sampler_set_log(sampler_log_fn fn, void *arg) { (void)fn, (void)arg; }
+struct sampler_job *sampler_defer(void) { return NULL; }
+void sampler_finish(struct sampler_job *j) { (void)j; }
+
+/* ---- What would leave the process ---- */
+
+static int replay_eval(struct webview *w, const char *js) {
+  (void)w;
+  replies.count++;
+  replies.bytes += strlen(js);
+  return 0;
+}
+
+static void replay_dbus_call(struct dbus_bridge *b, GBusType bus,
+                             const char *dest, const char *path,
+                             const char *interface, const char *method,
+                             const char *signature, const char *args,
+                             long req, dbus_bridge_reply_fn reply, void *arg) {
+  (void)b, (void)bus, (void)dest, (void)path, (void)interface, (void)method;
+  (void)signature, (void)req, (void)reply, (void)arg;
+  dbus_calls.count++;
+  dbus_calls.bytes += args != NULL ? strlen(args) : 0;
+}
+
+static int replay_parse(jsmn_parser *p, const char *js, size_t len,
+                        jsmntok_t *tokens, unsigned int ntokens) {
+  uint64_t t0 = now_ns();
+  int n = scalar ? jsmn_parse(p, js, len, tokens, ntokens)
+                 : jsmn_parse_simd(p, js, len, tokens, ntokens);
+  parse_ns += now_ns() - t0;
+  return n;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void stage_print(struct stage *s) {
+  uint64_t total = 0;
+  size_t i;
+  if (s->count == 0) {
+    printf("%-8s %8d\n", s->name, 0);
+    return;
+  }
+  qsort(s->ns, s->count, sizeof(uint64_t), cmp_u64);
+  for (i = 0; i < s->count; i++) {
+    total += s->ns[i];
+  }
+  printf("%-8s %8zu %10llu %10.3f %9.2f %9.2f %9.2f %9.2f %9.1f\n", s->name,
+         s->count, (unsigned long long)s->bytes, total / 1e6,
+         total / 1e3 / s->count, s->ns[s->count / 2] / 1e3,
+         s->ns[s->count * 99 / 100] / 1e3, s->ns[s->count - 1] / 1e3,
+         total > 0 ? s->bytes * 1e3 / total : 0.0);
+}
+
+/* my_cb() expects a string it may keep pointers into while it runs */
+static void replay_invoke(const char *data, size_t len) {
+  static char *js;
+  static size_t cap;
+  uint64_t t0, total;
+  if (cap < len + 1) {
+    cap = len + 1;
+    js = realloc(js, cap);
+    if (js == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  memcpy(js, data, len);
+  js[len] = '\0';
+  parse_ns = submit_ns = 0;
+  t0 = now_ns();
+  my_cb(&replay_webview, js);
+  total = now_ns() - t0;
+  stage_add(&parse, parse_ns, len);
+  stage_add(&handle, total - parse_ns - submit_ns, len);
+  stage_add(&submit, submit_ns, len);
+  stage_add(&whole, total, len);
+}
+
+static void count_dispatch(const char *name) {
+  size_t i;
+  for (i = 0; i < ndispatches; i++) {
+    if (strcmp(dispatches[i].name, name) == 0) {
+      dispatches[i].count++;
+      return;
+    }
+  }
+  dispatches = realloc(dispatches, (ndispatches + 1) * sizeof(*dispatches));
+  if (dispatches == NULL) {
+    perror("realloc");
+    exit(1);
+  }
+  dispatches[ndispatches].name = strdup(name);
+  dispatches[ndispatches].count = 1;
+  ndispatches++;
+}
+
+static int replay(const char *path, int first, int pace, uint64_t *span_us) {
+  struct recorder *r = recorder_open_read(path);
+  struct recorder_record rec;
+  uint64_t start = now_ns();
+  int res;
+  if (r == NULL) {
+    perror(path);
+    return -1;
+  }
+  while ((res = recorder_read(r, &rec)) == 1) {
+    if (pace) {
+      uint64_t due = start + rec.t_us * 1000, now = now_ns();
+      if (due > now) {
+        usleep((due - now) / 1000);
+      }
+    }
+    if (rec.kind == RECORDER_INVOKE) {
+      replay_invoke(rec.data, rec.len);
+    }
+    /* Recorded traffic is the same every run */
+    if (first && rec.kind >= RECORDER_INVOKE && rec.kind <= RECORDER_DISPATCH) {
+      traffic[rec.kind].count++;
+      traffic[rec.kind].bytes += rec.len;
+      if (rec.kind == RECORDER_DISPATCH) {
+        count_dispatch(rec.data);
+      }
+    }
+    *span_us = rec.t_us;
+  }
+  recorder_close(r);
+  if (res < 0) {
+    fprintf(stderr, "%s: damaged log\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  static const char *kinds[] = {NULL, "invoke", "eval", "dispatch"};
+  int runs = 1, pace = 0, opt, i;
+  uint64_t span_us = 0;
+  while ((opt = getopt(argc, argv, "n:ps")) != -1) {
+    switch (opt) {
+    case 'n': runs = atoi(optarg); break;
+    case 'p': pace = 1; break;
+    case 's': scalar = 1; break;
+    default:
+      fprintf(stderr, "usage: %s [-n runs] [-p] [-s] log\n", argv[0]);
+      return 2;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "usage: %s [-n runs] [-p] [-s] log\n", argv[0]);
+    return 2;
+  }
+  replay_webview.priv.queue = g_async_queue_new();
+  sampler = sampler_new(&replay_webview, NULL);
+  usage = usage_new();
+  for (i = 0; i < runs; i++) {
+    if (replay(argv[optind], i == 0, pace, &span_us) != 0) {
+      return 1;
+    }
+  }
+
+  printf("recorded %.3f s\n", span_us / 1e6);
+  for (i = RECORDER_INVOKE; i <= RECORDER_DISPATCH; i++) {
+    printf("  %-8s %8zu msgs %10llu bytes %9.2f msgs/s\n", kinds[i],
+           traffic[i].count, (unsigned long long)traffic[i].bytes,
+           span_us > 0 ? traffic[i].count * 1e6 / span_us : 0.0);
+  }
+  for (i = 0; i < (int)ndispatches; i++) {
+    printf("    %-40s %8zu\n", dispatches[i].name, dispatches[i].count);
+  }
+  printf("replayed, all runs\n");
+  printf("  %-8s %8zu msgs %10llu bytes\n", "replies", replies.count,
+         (unsigned long long)replies.bytes);
+  printf("  %-8s %8zu msgs %10llu bytes\n", "dbus", dbus_calls.count,
+         (unsigned long long)dbus_calls.bytes);
+  printf("\n%-8s %8s %10s %10s %9s %9s %9s %9s %9s\n", "stage", "count",
+         "bytes", "total_ms", "mean_us", "p50_us", "p99_us", "max_us", "MB/s");
+  stage_print(&parse);
+  stage_print(&handle);
+  stage_print(&submit);
+  stage_print(&whole);
+  return 0;
+}
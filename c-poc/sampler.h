@@ -0,0 +1,499 @@
+/*
+ * Background threads for data collection: provider sampling and command I/O
+ * run here instead of on the GTK thread, at idle priority, and hand their
+ * results back through webview_dispatch(). Rendering never waits behind them.
+ *
+ * Each thread runs its own GMainContext, so jobs are plain closures invoked
+ * in it and providers are timed sources attached to it.
+ *
+ * Child processes inherit the scheduling of the thread that starts them, and
+ * an unprivileged one cannot undo SCHED_IDLE, a nice value or its affinity:
+ * jobs start them through sampler_call_normal() instead.
+ *
+ * A job need not block its thread until its result is in: it can
+ * sampler_defer() itself, watch its fds in the thread's context and
+ * sampler_finish() from there.
+ */
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "webview.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef SAMPLER_STATIC
+#define SAMPLER_API static
+#else
+#define SAMPLER_API extern
+#endif
+
+struct sampler_config {
+  int threads;      /* Pool size, 1 when left to 0 */
+  int idle;         /* Run at SCHED_IDLE: only when a CPU has nothing else */
+  int nice;         /* Otherwise this nice value */
+  const char *cpus; /* CPU affinity, e.g. "2,3" or "1-3", NULL for any */
+  int timer_slack_ms; /* Kernel timer slack of the threads, 0 to keep it */
+};
+
+struct sampler;
+
+/* Runs on a sampler thread */
+typedef void (*sampler_job_fn)(void *arg);
+
+SAMPLER_API struct sampler *sampler_new(struct webview *w,
+                                        const struct sampler_config *config);
+
+/**
+ * Stops the threads, after the jobs already running. Jobs still queued, and
+ * deferred ones not finished yet, are dropped.
+ */
+SAMPLER_API void sampler_free(struct sampler *s);
+
+/**
+ * Runs job(arg) on a sampler thread, then done(w, arg) on the GTK thread.
+ * done may be NULL.
+ */
+SAMPLER_API void sampler_submit(struct sampler *s, sampler_job_fn job,
+                                webview_dispatch_fn done, void *arg);
+
+struct sampler_job;
+
+/**
+ * Called from a submitted job: its done is not dispatched when it returns,
+ * but by sampler_finish(), e.g. from sources the job attached to
+ * g_main_context_get_thread_default(). Returns NULL outside of a job.
+ */
+SAMPLER_API struct sampler_job *sampler_defer(void);
+
+/**
+ * Dispatches the done of a deferred job. On the thread that ran it, once the
+ * job has returned.
+ */
+SAMPLER_API void sampler_finish(struct sampler_job *j);
+
+/**
+ * Runs fn(arg) on a thread with the scheduling, affinity and timer slack
+ * sampler_new() was called with, and returns once it has. For what must not
+ * inherit those of the sampler threads, such as starting a command the user
+ * asked for.
+ */
+SAMPLER_API void sampler_call_normal(struct sampler *s, sampler_job_fn fn,
+                                     void *arg);
+
+/**
+ * Calls sample(arg) on a sampler thread every interval_ms, and publish(w, arg)
+ * on the GTK thread after each sample. publish can still be running while
+ * the next sample starts: guard what they share. Returns an id for
+ * sampler_remove_provider().
+ */
+SAMPLER_API unsigned int sampler_add_provider(struct sampler *s,
+                                              int interval_ms,
+                                              sampler_job_fn sample,
+                                              webview_dispatch_fn publish,
+                                              void *arg);
+SAMPLER_API void sampler_remove_provider(struct sampler *s, unsigned int id);
+
+/**
+ * Background pace, e.g. while the window is hidden: providers sample at most
+ * every interval_ms. 0 goes back to their own intervals, and the ones that
+ * were held back sample at once.
+ */
+SAMPLER_API void sampler_set_background(struct sampler *s, int interval_ms);
+
+/* Where the threads report what they could not set up; stderr by default.
+ * fn may be called from any sampler thread. */
+typedef void (*sampler_log_fn)(const char *s, void *arg);
+
+SAMPLER_API void sampler_set_log(sampler_log_fn fn, void *arg);
+
+#ifndef SAMPLER_HEADER
+#include <errno.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define SAMPLER_THREAD_BITS 6
+#define SAMPLER_MAX_THREADS (1 << SAMPLER_THREAD_BITS)
+
+struct sampler_thread {
+  GThread *thread;
+  GMainContext *context;
+  GMainLoop *loop;
+  struct sampler *sampler;
+};
+
+struct sampler {
+  struct webview *w;
+  struct sampler_config config;
+  struct sampler_thread *threads;
+  int nthreads;
+  struct sampler_thread launcher; /* For sampler_call_normal(), or none */
+  unsigned int next;
+  int background_ms;  /* Atomic, as the two below */
+  int background_gen; /* Bumped on each change, for the providers to see */
+};
+
+struct sampler_job {
+  struct sampler *sampler;
+  sampler_job_fn job;
+  webview_dispatch_fn done;
+  void *arg;
+  int deferred;
+};
+
+/* The job sampler_job_cb() is running */
+static GPrivate sampler_current;
+
+static sampler_log_fn sampler_log_cb = NULL;
+static void *sampler_log_arg = NULL;
+
+SAMPLER_API void sampler_set_log(sampler_log_fn fn, void *arg) {
+  sampler_log_cb = fn;
+  sampler_log_arg = arg;
+}
+
+static void sampler_log(const char *format, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, format);
+  vsnprintf(buf, sizeof(buf), format, ap);
+  va_end(ap);
+  if (sampler_log_cb != NULL) {
+    sampler_log_cb(buf, sampler_log_arg);
+  } else {
+    fprintf(stderr, "sampler: %s\n", buf);
+  }
+}
+
+/* Applies priority, affinity and timer slack to the calling thread */
+static void sampler_setup_thread(const struct sampler_config *config) {
+#ifdef __linux__
+  pid_t tid = (pid_t)syscall(SYS_gettid);
+  /* Per thread: the GTK thread and WebKit's processes keep theirs */
+  if (config->timer_slack_ms > 0 &&
+      prctl(PR_SET_TIMERSLACK,
+            (unsigned long)config->timer_slack_ms * 1000000UL) != 0) {
+    sampler_log("timer slack %d ms: %s", config->timer_slack_ms,
+                strerror(errno));
+  }
+  if (config->idle) {
+    struct sched_param param = {0};
+    /* pid 0 is the calling thread, not the whole process, on Linux */
+    if (sched_setscheduler(0, SCHED_IDLE, &param) != 0) {
+      sampler_log("SCHED_IDLE: %s", strerror(errno));
+    }
+  } else if (config->nice != 0) {
+    if (setpriority(PRIO_PROCESS, tid, config->nice) != 0) {
+      sampler_log("nice %d: %s", config->nice, strerror(errno));
+    }
+  }
+  if (config->cpus != NULL) {
+    cpu_set_t set;
+    const char *p = config->cpus;
+    CPU_ZERO(&set);
+    while (*p) {
+      char *end;
+      long from = strtol(p, &end, 10);
+      long to = from;
+      if (end == p) {
+        break;
+      }
+      if (*end == '-') {
+        p = end + 1;
+        to = strtol(p, &end, 10);
+      }
+      for (; from <= to && from < CPU_SETSIZE; from++) {
+        CPU_SET(from, &set);
+      }
+      p = *end == ',' ? end + 1 : end;
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+      sampler_log("affinity %s: %s", config->cpus, strerror(errno));
+    }
+  }
+#else
+  (void)config;
+#endif
+}
+
+static gpointer sampler_thread_main(gpointer arg) {
+  struct sampler_thread *t = (struct sampler_thread *)arg;
+  if (t != &t->sampler->launcher) {
+    sampler_setup_thread(&t->sampler->config);
+  }
+  g_main_context_push_thread_default(t->context);
+  g_main_loop_run(t->loop);
+  g_main_context_pop_thread_default(t->context);
+  return NULL;
+}
+
+SAMPLER_API struct sampler *sampler_new(struct webview *w,
+                                        const struct sampler_config *config) {
+  struct sampler *s = g_new0(struct sampler, 1);
+  int i;
+  s->w = w;
+  if (config != NULL) {
+    s->config = *config;
+  }
+  s->nthreads = s->config.threads > 0 ? s->config.threads : 1;
+  if (s->nthreads > SAMPLER_MAX_THREADS) {
+    s->nthreads = SAMPLER_MAX_THREADS;
+  }
+  s->threads = g_new0(struct sampler_thread, s->nthreads);
+  for (i = 0; i < s->nthreads; i++) {
+    struct sampler_thread *t = &s->threads[i];
+    char name[16];
+    snprintf(name, sizeof(name), "sampler-%d", i);
+    t->sampler = s;
+    t->context = g_main_context_new();
+    t->loop = g_main_loop_new(t->context, FALSE);
+    t->thread = g_thread_new(name, sampler_thread_main, t);
+  }
+  /* Created from here, it keeps the caller's scheduling */
+  if (s->config.idle || s->config.nice != 0 || s->config.cpus != NULL ||
+      s->config.timer_slack_ms > 0) {
+    s->launcher.sampler = s;
+    s->launcher.context = g_main_context_new();
+    s->launcher.loop = g_main_loop_new(s->launcher.context, FALSE);
+    s->launcher.thread =
+        g_thread_new("sampler-launch", sampler_thread_main, &s->launcher);
+  }
+  return s;
+}
+
+static gboolean sampler_quit_cb(gpointer arg) {
+  g_main_loop_quit((GMainLoop *)arg);
+  return G_SOURCE_REMOVE;
+}
+
+SAMPLER_API void sampler_free(struct sampler *s) {
+  int i;
+  if (s == NULL) {
+    return;
+  }
+  for (i = 0; i < s->nthreads; i++) {
+    struct sampler_thread *t = &s->threads[i];
+    g_main_context_invoke(t->context, sampler_quit_cb, t->loop);
+    g_thread_join(t->thread);
+    g_main_loop_unref(t->loop);
+    g_main_context_unref(t->context);
+  }
+  if (s->launcher.thread != NULL) {
+    g_main_context_invoke(s->launcher.context, sampler_quit_cb,
+                          s->launcher.loop);
+    g_thread_join(s->launcher.thread);
+    g_main_loop_unref(s->launcher.loop);
+    g_main_context_unref(s->launcher.context);
+  }
+  g_free(s->threads);
+  g_free(s);
+}
+
+static gboolean sampler_job_cb(gpointer arg) {
+  struct sampler_job *j = (struct sampler_job *)arg;
+  g_private_set(&sampler_current, j);
+  j->job(j->arg);
+  g_private_set(&sampler_current, NULL);
+  if (!j->deferred && j->done != NULL) {
+    webview_dispatch(j->sampler->w, j->done, j->arg);
+  }
+  return G_SOURCE_REMOVE;
+}
+
+/* A deferred job is sampler_finish()'s to free */
+static void sampler_job_free(gpointer arg) {
+  struct sampler_job *j = (struct sampler_job *)arg;
+  if (!j->deferred) {
+    g_free(j);
+  }
+}
+
+SAMPLER_API struct sampler_job *sampler_defer(void) {
+  struct sampler_job *j =
+      (struct sampler_job *)g_private_get(&sampler_current);
+  if (j != NULL) {
+    j->deferred = 1;
+  }
+  return j;
+}
+
+SAMPLER_API void sampler_finish(struct sampler_job *j) {
+  if (j->done != NULL) {
+    webview_dispatch(j->sampler->w, j->done, j->arg);
+  }
+  g_free(j);
+}
+
+struct sampler_call {
+  sampler_job_fn fn;
+  void *arg;
+  GMutex lock;
+  GCond cond;
+  int done;
+};
+
+static gboolean sampler_call_cb(gpointer arg) {
+  struct sampler_call *c = (struct sampler_call *)arg;
+  c->fn(c->arg);
+  g_mutex_lock(&c->lock);
+  c->done = 1;
+  g_cond_signal(&c->cond);
+  g_mutex_unlock(&c->lock);
+  return G_SOURCE_REMOVE;
+}
+
+SAMPLER_API void sampler_call_normal(struct sampler *s, sampler_job_fn fn,
+                                     void *arg) {
+  struct sampler_call c;
+  if (s->launcher.thread == NULL) {
+    fn(arg); /* The sampler threads are not throttled either */
+    return;
+  }
+  c.fn = fn;
+  c.arg = arg;
+  c.done = 0;
+  g_mutex_init(&c.lock);
+  g_cond_init(&c.cond);
+  g_main_context_invoke(s->launcher.context, sampler_call_cb, &c);
+  g_mutex_lock(&c.lock);
+  while (!c.done) {
+    g_cond_wait(&c.cond, &c.lock);
+  }
+  g_mutex_unlock(&c.lock);
+  g_cond_clear(&c.cond);
+  g_mutex_clear(&c.lock);
+}
+
+struct sampler_provider {
+  GSource source;
+  struct sampler_job job;
+  int interval_ms;
+  gint64 last_us; /* Added or last sampled */
+  int gen;        /* Of the pace it is set to */
+};
+
+static gint64 sampler_provider_deadline(struct sampler_provider *p) {
+  int background = g_atomic_int_get(&p->job.sampler->background_ms);
+  int ms = background > p->interval_ms ? background : p->interval_ms;
+  gint64 deadline = p->last_us + (gint64)ms * 1000;
+  /* Whole seconds fall on whole seconds, so that providers share wakeups */
+  if (ms % 1000 == 0) {
+    deadline = (deadline + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC * G_USEC_PER_SEC;
+  }
+  return deadline;
+}
+
+/* The pace changed: due again from the last sample, at the new one */
+static gboolean sampler_provider_prepare(GSource *source, gint *timeout) {
+  struct sampler_provider *p = (struct sampler_provider *)source;
+  int gen = g_atomic_int_get(&p->job.sampler->background_gen);
+  *timeout = -1;
+  if (gen != p->gen) {
+    p->gen = gen;
+    g_source_set_ready_time(source, sampler_provider_deadline(p));
+  }
+  return FALSE;
+}
+
+static gboolean sampler_provider_dispatch(GSource *source, GSourceFunc callback,
+                                          gpointer userdata) {
+  struct sampler_provider *p = (struct sampler_provider *)source;
+  (void)callback;
+  (void)userdata;
+  p->last_us = g_source_get_time(source);
+  p->job.job(p->job.arg);
+  if (p->job.done != NULL) {
+    webview_dispatch(p->job.sampler->w, p->job.done, p->job.arg);
+  }
+  g_source_set_ready_time(source, sampler_provider_deadline(p));
+  return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs sampler_provider_funcs = {
+    sampler_provider_prepare, NULL, sampler_provider_dispatch, NULL};
+
+static int sampler_pick(struct sampler *s) {
+  unsigned int n = __atomic_fetch_add(&s->next, 1, __ATOMIC_RELAXED);
+  return n % s->nthreads;
+}
+
+SAMPLER_API void sampler_submit(struct sampler *s, sampler_job_fn job,
+                                webview_dispatch_fn done, void *arg) {
+  struct sampler_job *j = g_new(struct sampler_job, 1);
+  GSource *source = g_idle_source_new();
+  j->sampler = s;
+  j->job = job;
+  j->done = done;
+  j->arg = arg;
+  j->deferred = 0;
+  g_source_set_callback(source, sampler_job_cb, j, sampler_job_free);
+  g_source_attach(source, s->threads[sampler_pick(s)].context);
+  g_source_unref(source);
+}
+
+SAMPLER_API unsigned int sampler_add_provider(struct sampler *s,
+                                              int interval_ms,
+                                              sampler_job_fn sample,
+                                              webview_dispatch_fn publish,
+                                              void *arg) {
+  GSource *source =
+      g_source_new(&sampler_provider_funcs, sizeof(struct sampler_provider));
+  struct sampler_provider *p = (struct sampler_provider *)source;
+  int thread = sampler_pick(s);
+  unsigned int id;
+  p->job.sampler = s;
+  p->job.job = sample;
+  p->job.done = publish;
+  p->job.arg = arg;
+  p->job.deferred = 0;
+  p->interval_ms = interval_ms;
+  p->last_us = g_get_monotonic_time();
+  p->gen = g_atomic_int_get(&s->background_gen);
+  g_source_set_ready_time(source, sampler_provider_deadline(p));
+  id = g_source_attach(source, s->threads[thread].context);
+  g_source_unref(source);
+  /* Source ids are per context: keep the thread in the low bits */
+  return (id << SAMPLER_THREAD_BITS) | thread;
+}
+
+SAMPLER_API void sampler_remove_provider(struct sampler *s, unsigned int id) {
+  int thread = id & ((1 << SAMPLER_THREAD_BITS) - 1);
+  GSource *source;
+  if (thread >= s->nthreads) {
+    return;
+  }
+  source = g_main_context_find_source_by_id(s->threads[thread].context,
+                                            id >> SAMPLER_THREAD_BITS);
+  if (source != NULL) {
+    g_source_destroy(source);
+  }
+}
+
+SAMPLER_API void sampler_set_background(struct sampler *s, int interval_ms) {
+  int i;
+  if (g_atomic_int_get(&s->background_ms) == interval_ms) {
+    return;
+  }
+  g_atomic_int_set(&s->background_ms, interval_ms);
+  g_atomic_int_inc(&s->background_gen);
+  /* Each thread sees it in its next prepare */
+  for (i = 0; i < s->nthreads; i++) {
+    g_main_context_wakeup(s->threads[i].context);
+  }
+}
+
+#endif /* SAMPLER_HEADER */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SAMPLER_H */
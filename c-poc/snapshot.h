@@ -0,0 +1,320 @@
+/*
+ * Session snapshot: what a restarted widget needs to show real data in its
+ * first frame, before any provider has sampled.
+ *
+ *   struct snapshot *snap = snapshot_read("widget.snapshot");
+ *   w.session_state = snapshot_session(snap, &w.session_state_len);
+ *   webview_init(&w);
+ *   snapshot_seed(snap, store);        // the last values, into the store
+ *   snapshot_free(snap);
+ *   ...
+ *   snapshot_write("widget.snapshot", state, state_len, store);
+ *
+ * The file is an 8 byte header ("WVSNAP", 0, version) then
+ *
+ *   length   varint, then that many bytes of WebKit session state
+ *   count    varint, then count entries of the databind store:
+ *     key      varint length, bytes
+ *     value    varint length + 1, bytes (0: no value)
+ *     element  varint length + 1, bytes (0: not bound to an id)
+ *
+ * It is written to a temporary file and renamed over the old one, so a crash
+ * while saving leaves the previous snapshot intact.
+ */
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+
+#include "databind.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef SNAPSHOT_STATIC
+#define SNAPSHOT_API static
+#else
+#define SNAPSHOT_API extern
+#endif
+
+#define SNAPSHOT_VERSION 1
+
+struct snapshot;
+
+/**
+ * Reads the snapshot at path. Returns NULL if there is none or it is damaged,
+ * with errno set.
+ */
+SNAPSHOT_API struct snapshot *snapshot_read(const char *path);
+
+SNAPSHOT_API void snapshot_free(struct snapshot *s);
+
+/**
+ * Returns the WebKit session state, valid until snapshot_free(), or NULL.
+ */
+SNAPSHOT_API const void *snapshot_session(struct snapshot *s, size_t *len);
+
+/**
+ * Sets every saved key in db, and binds the saved element ids. Returns the
+ * number of keys.
+ */
+SNAPSHOT_API int snapshot_seed(struct snapshot *s, struct databind *db);
+
+/**
+ * Saves session (may be NULL) and every key of db at path. Returns 0, or -1
+ * with errno set.
+ */
+SNAPSHOT_API int snapshot_write(const char *path, const void *session,
+                                size_t len, struct databind *db);
+
+#ifndef SNAPSHOT_HEADER
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char snapshot_magic[8] = {'W', 'V', 'S', 'N', 'A', 'P', 0,
+                                       SNAPSHOT_VERSION};
+
+struct snapshot_entry {
+  const char *key;
+  const char *value;
+  const char *element;
+};
+
+struct snapshot {
+  unsigned char *data; /* The whole file; strings point into it */
+  const unsigned char *session;
+  size_t session_len;
+  struct snapshot_entry *entries;
+  size_t len;
+};
+
+static void snapshot_put_varint(FILE *f, uint64_t v) {
+  while (v >= 0x80) {
+    putc((int)(v & 0x7f) | 0x80, f);
+    v >>= 7;
+  }
+  putc((int)v, f);
+}
+
+static void snapshot_put_string(FILE *f, const char *s, int optional) {
+  if (s == NULL) {
+    snapshot_put_varint(f, 0);
+    return;
+  }
+  snapshot_put_varint(f, strlen(s) + (optional ? 1 : 0));
+  fputs(s, f);
+}
+
+static void snapshot_put_entry(const char *key, const char *json,
+                               const char *element_id, void *arg) {
+  FILE *f = (FILE *)arg;
+  snapshot_put_string(f, key, 0);
+  snapshot_put_string(f, json, 1);
+  snapshot_put_string(f, element_id, 1);
+}
+
+static void snapshot_count_entry(const char *key, const char *json,
+                                 const char *element_id, void *arg) {
+  (void)key, (void)json, (void)element_id;
+  (*(size_t *)arg)++;
+}
+
+SNAPSHOT_API int snapshot_write(const char *path, const void *session,
+                                size_t len, struct databind *db) {
+  size_t n = strlen(path), count = 0;
+  char *tmp = (char *)malloc(n + sizeof(".tmp"));
+  FILE *f;
+  int r = 0;
+  if (tmp == NULL) {
+    return -1;
+  }
+  memcpy(tmp, path, n);
+  memcpy(tmp + n, ".tmp", sizeof(".tmp"));
+  f = fopen(tmp, "wb");
+  if (f == NULL) {
+    free(tmp);
+    return -1;
+  }
+  fwrite(snapshot_magic, 1, sizeof(snapshot_magic), f);
+  snapshot_put_varint(f, session != NULL ? len : 0);
+  if (session != NULL) {
+    fwrite(session, 1, len, f);
+  }
+  databind_foreach(db, snapshot_count_entry, &count);
+  snapshot_put_varint(f, count);
+  databind_foreach(db, snapshot_put_entry, f);
+  if (fflush(f) != 0 || ferror(f) || fsync(fileno(f)) != 0) {
+    r = -1;
+  }
+  if (fclose(f) != 0) {
+    r = -1;
+  }
+  if (r == 0 && rename(tmp, path) != 0) {
+    r = -1;
+  }
+  if (r != 0) {
+    int e = errno;
+    unlink(tmp);
+    errno = e;
+  }
+  free(tmp);
+  return r;
+}
+
+struct snapshot_reader {
+  unsigned char *p;
+  unsigned char *end;
+};
+
+static int snapshot_get_varint(struct snapshot_reader *in, uint64_t *v) {
+  int shift = 0;
+  *v = 0;
+  for (;;) {
+    if (in->p == in->end || shift > 63) {
+      return -1;
+    }
+    *v |= (uint64_t)(*in->p & 0x7f) << shift;
+    if (!(*in->p++ & 0x80)) {
+      return 0;
+    }
+    shift += 7;
+  }
+}
+
+/* Strings are NUL-terminated in place: each is moved down over its length
+ * varint, at least one byte long, which leaves room for the NUL */
+static int snapshot_get_string(struct snapshot_reader *in, const char **s,
+                               int optional) {
+  unsigned char *start = in->p;
+  uint64_t len;
+  if (snapshot_get_varint(in, &len) != 0) {
+    return -1;
+  }
+  if (optional) {
+    if (len == 0) {
+      *s = NULL;
+      return 0;
+    }
+    len--;
+  }
+  if (len > (uint64_t)(in->end - in->p)) {
+    return -1;
+  }
+  memmove(start, in->p, len);
+  start[len] = '\0';
+  *s = (const char *)start;
+  in->p += len;
+  return 0;
+}
+
+SNAPSHOT_API struct snapshot *snapshot_read(const char *path) {
+  struct snapshot *s = (struct snapshot *)calloc(1, sizeof(struct snapshot));
+  struct snapshot_reader in;
+  FILE *f = fopen(path, "rb");
+  uint64_t len, count, i;
+  long size;
+  if (s == NULL || f == NULL) {
+    goto fail;
+  }
+  if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 ||
+      fseek(f, 0, SEEK_SET) != 0) {
+    goto fail;
+  }
+  s->data = (unsigned char *)malloc(size > 0 ? size : 1);
+  if (s->data == NULL || fread(s->data, 1, size, f) != (size_t)size) {
+    goto fail;
+  }
+  fclose(f);
+  f = NULL;
+  in.p = s->data;
+  in.end = s->data + size;
+  if (size < (long)sizeof(snapshot_magic) ||
+      memcmp(s->data, snapshot_magic, sizeof(snapshot_magic)) != 0) {
+    errno = EINVAL;
+    goto fail;
+  }
+  in.p += sizeof(snapshot_magic);
+  if (snapshot_get_varint(&in, &len) != 0 ||
+      len > (uint64_t)(in.end - in.p)) {
+    goto damaged;
+  }
+  s->session = len > 0 ? in.p : NULL;
+  s->session_len = len;
+  in.p += len;
+  if (snapshot_get_varint(&in, &count) != 0 ||
+      count > (uint64_t)(in.end - in.p)) {
+    goto damaged;
+  }
+  s->entries = (struct snapshot_entry *)calloc(
+      count > 0 ? count : 1, sizeof(struct snapshot_entry));
+  if (s->entries == NULL) {
+    goto fail;
+  }
+  for (i = 0; i < count; i++) {
+    struct snapshot_entry *e = &s->entries[i];
+    if (snapshot_get_string(&in, &e->key, 0) != 0 ||
+        snapshot_get_string(&in, &e->value, 1) != 0 ||
+        snapshot_get_string(&in, &e->element, 1) != 0) {
+      goto damaged;
+    }
+  }
+  s->len = count;
+  return s;
+damaged:
+  errno = EINVAL;
+fail:
+  if (f != NULL) {
+    int e = errno;
+    fclose(f);
+    errno = e;
+  }
+  snapshot_free(s);
+  return NULL;
+}
+
+SNAPSHOT_API void snapshot_free(struct snapshot *s) {
+  if (s == NULL) {
+    return;
+  }
+  free(s->entries);
+  free(s->data);
+  free(s);
+}
+
+SNAPSHOT_API const void *snapshot_session(struct snapshot *s, size_t *len) {
+  if (s == NULL || s->session == NULL) {
+    *len = 0;
+    return NULL;
+  }
+  *len = s->session_len;
+  return s->session;
+}
+
+SNAPSHOT_API int snapshot_seed(struct snapshot *s, struct databind *db) {
+  size_t i;
+  if (s == NULL) {
+    return 0;
+  }
+  for (i = 0; i < s->len; i++) {
+    if (s->entries[i].value != NULL) {
+      databind_set(db, s->entries[i].key, s->entries[i].value);
+    }
+    if (s->entries[i].element != NULL) {
+      databind_bind(db, s->entries[i].key, s->entries[i].element);
+    }
+  }
+  return (int)s->len;
+}
+
+#endif /* SNAPSHOT_HEADER */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SNAPSHOT_H */
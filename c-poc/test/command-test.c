@@ -0,0 +1,118 @@
+/*
+ * Command jobs of main-myexample.c, run for real on a sampler thread.
+ *
+ *   make check
+ *
+ * my_cb()'s jobs are the ones of main-myexample.c, included below with its
+ * main() renamed, as bench/bench.c does. No window: the GTK thread is this
+ * one, spinning the default main context, and the page's replies are kept
+ * instead of evaluated. Each case prints "ok" or "FAIL" and a failure makes
+ * the exit status 1.
+ */
+#define _GNU_SOURCE
+#define WEBVIEW_IMPLEMENTATION
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "webview.h"
+
+/* The page's replies go through here */
+static int test_eval(struct webview *w, const char *js);
+#define webview_eval test_eval
+
+#define main webview_example_main
+#include "../main-myexample.c"
+#undef main
+#undef webview_eval
+
+static char last_eval[256];
+
+static int test_eval(struct webview *w, const char *js) {
+  (void)w;
+  snprintf(last_eval, sizeof(last_eval), "%s", js);
+  return 0;
+}
+
+static gboolean test_deadline_cb(gpointer arg) {
+  *(int *)arg = 1;
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean test_cancel_cb(gpointer arg) {
+  command_jobs_cancel(0, *(long *)arg);
+  return G_SOURCE_REMOVE;
+}
+
+/* Runs sh -c line as the exec_and_read of request req, canceled by the page
+ * after cancel_ms unless 0, and waits up to 5 s for it to come back. Returns
+ * how long that took, in ms, or -1 */
+static int run(struct webview *w, long req, const char *line, int timeout_ms,
+               int cancel_ms) {
+  struct command_job *job = calloc(1, sizeof(struct command_job));
+  gint64 start = g_get_monotonic_time();
+  int late = 0;
+  guint deadline = g_timeout_add(5000, test_deadline_cb, &late);
+  job->kind = JOB_EXEC_AND_READ;
+  job->argv = calloc(4, sizeof(char *));
+  job->argv[0] = strdup("/bin/sh");
+  job->argv[1] = strdup("-c");
+  job->argv[2] = strdup(line);
+  job->req = req;
+  job->account = usage_account(usage, "test");
+  job->timeout_ms = timeout_ms;
+  last_eval[0] = '\0';
+  command_job_start(w, job);
+  if (cancel_ms > 0) {
+    g_timeout_add(cancel_ms, test_cancel_cb, &req);
+  }
+  while (running_jobs->len > 0 && !late) {
+    g_main_context_iteration(NULL, TRUE);
+  }
+  if (late) {
+    return -1;
+  }
+  g_source_remove(deadline);
+  return (int)((g_get_monotonic_time() - start) / 1000);
+}
+
+static int check(const char *name, int ok) {
+  printf("%s %s\n", ok ? "ok  " : "FAIL", name);
+  return ok ? 0 : 1;
+}
+
+int main(void) {
+  struct webview webview;
+  struct sampler_config config = {.threads = 1};
+  int failed = 0, ms;
+  memset(&webview, 0, sizeof(webview));
+  webview.priv.queue = g_async_queue_new();
+  usage = usage_new();
+  sampler = sampler_new(&webview, &config);
+
+  ms = run(&webview, 1, "echo hi", 0, 0);
+  failed += check("output published",
+                  ms >= 0 && strstr(last_eval, "oncapture(1,'capture://"));
+
+  /* The leader exits at once, the background sleep keeps its stdout: the
+   * timeout kills the group, and the job comes back without its output */
+  ms = run(&webview, 2, "sleep 1000 & echo hi", 300, 0);
+  failed += check("leader exits, its group keeps the pipe, timed out",
+                  ms >= 0 && ms < 2000 &&
+                      strstr(last_eval, "oncapture(2,null,0)"));
+
+  /* Same, the holder in a session of its own, out of reach of the kill:
+   * the job still comes back at the timeout, not when it lets go */
+  ms = run(&webview, 3, "setsid sleep 3 & echo hi", 300, 0);
+  failed += check("leader exits, another group keeps the pipe, timed out",
+                  ms >= 0 && ms < 2000 &&
+                      strstr(last_eval, "oncapture(3,null,0)"));
+
+  /* Canceled by the page instead: no reply at all */
+  ms = run(&webview, 4, "sleep 1000 & echo hi", 0, 300);
+  failed += check("leader exits, its group keeps the pipe, canceled",
+                  ms >= 0 && ms < 2000 && last_eval[0] == '\0');
+
+  sampler_free(sampler);
+  return failed > 0;
+}
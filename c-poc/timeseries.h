@@ -0,0 +1,369 @@
+/*
+ * In-memory history of numeric metrics, for the page's graphs.
+ *
+ * Each metric keeps a few tiers of fixed-size rings, from fine and short to
+ * coarse and long. Every sample goes into all of them at once, each slot
+ * holding the min, max and sum of the samples in its step:
+ *
+ *   {1000, 600}    10 minutes at 1 s
+ *   {10000, 720}   2 hours at 10 s
+ *   {60000, 1440}  24 hours at 1 min
+ *
+ * Memory per metric is fixed when it is defined, however long it runs.
+ *
+ * A query asks for a window at a number of points. It is answered from the
+ * coarsest tier that still has the resolution and covers the window, as
+ * min, max, avg triples of floats, one per point (NaN where there was no
+ * sample): the same size whatever the window, ready for a Float32Array.
+ *
+ * Samples may come from any thread.
+ */
+#ifndef TIMESERIES_H
+#define TIMESERIES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef TIMESERIES_STATIC
+#define TIMESERIES_API static
+#else
+#define TIMESERIES_API extern
+#endif
+
+#define TIMESERIES_MAX_TIERS 8
+/* Largest query, in points */
+#define TIMESERIES_MAX_POINTS 4096
+
+struct timeseries_tier {
+  int step_ms;
+  int points;
+};
+
+#define TIMESERIES_DEFAULT_TIERS                                               \
+  { {1000, 600}, {10000, 720}, {60000, 1440} }
+
+struct timeseries;
+
+TIMESERIES_API struct timeseries *timeseries_new(void);
+TIMESERIES_API void timeseries_free(struct timeseries *ts);
+
+/**
+ * Defines metric with ntiers tiers, ordered from the finest. Returns 0, or -1
+ * if it is already defined, the tiers are not valid or when out of memory.
+ */
+TIMESERIES_API int timeseries_define(struct timeseries *ts, const char *metric,
+                                     const struct timeseries_tier *tiers,
+                                     int ntiers);
+
+/**
+ * Adds a sample at t_ms, which only goes forward: a late one is kept only in
+ * the tiers whose slot for it was not reused since. Returns 0, or -1 if
+ * metric is not defined.
+ */
+TIMESERIES_API int timeseries_add(struct timeseries *ts, const char *metric,
+                                  int64_t t_ms, double v);
+
+/**
+ * Fills out with up to max_points min, max, avg triples covering
+ * [from_ms, to_ms), the last one ending at to_ms or just after. Returns the
+ * number of points, with the time of the first one and the step between them,
+ * or -1 if metric is not defined.
+ */
+TIMESERIES_API int timeseries_query(struct timeseries *ts, const char *metric,
+                                    int64_t from_ms, int64_t to_ms,
+                                    int max_points, float *out,
+                                    int64_t *start_ms, int64_t *step_ms);
+
+/**
+ * Memory held by the rings of all metrics.
+ */
+TIMESERIES_API size_t timeseries_bytes(struct timeseries *ts);
+
+#ifndef TIMESERIES_HEADER
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct timeseries_slot {
+  int64_t epoch; /* t_ms / step of what it holds; -1 when never written */
+  float min;
+  float max;
+  double sum;
+  uint32_t count;
+};
+
+struct timeseries_ring {
+  int64_t step_ms;
+  int points;
+  struct timeseries_slot *slots;
+};
+
+struct timeseries_metric {
+  char *name;
+  int64_t last_ms; /* Of the newest sample */
+  int ntiers;
+  struct timeseries_ring tiers[TIMESERIES_MAX_TIERS];
+};
+
+struct timeseries {
+  pthread_mutex_t lock;
+  struct timeseries_metric *metrics;
+  size_t len;
+};
+
+TIMESERIES_API struct timeseries *timeseries_new(void) {
+  struct timeseries *ts =
+      (struct timeseries *)calloc(1, sizeof(struct timeseries));
+  if (ts != NULL) {
+    pthread_mutex_init(&ts->lock, NULL);
+  }
+  return ts;
+}
+
+TIMESERIES_API void timeseries_free(struct timeseries *ts) {
+  size_t i;
+  int j;
+  if (ts == NULL) {
+    return;
+  }
+  for (i = 0; i < ts->len; i++) {
+    for (j = 0; j < ts->metrics[i].ntiers; j++) {
+      free(ts->metrics[i].tiers[j].slots);
+    }
+    free(ts->metrics[i].name);
+  }
+  free(ts->metrics);
+  pthread_mutex_destroy(&ts->lock);
+  free(ts);
+}
+
+/* Called with the lock held */
+static struct timeseries_metric *timeseries_find(struct timeseries *ts,
+                                                 const char *metric) {
+  size_t i;
+  for (i = 0; i < ts->len; i++) {
+    if (strcmp(ts->metrics[i].name, metric) == 0) {
+      return &ts->metrics[i];
+    }
+  }
+  return NULL;
+}
+
+TIMESERIES_API int timeseries_define(struct timeseries *ts, const char *metric,
+                                     const struct timeseries_tier *tiers,
+                                     int ntiers) {
+  struct timeseries_metric m, *more;
+  int i, j;
+  if (ntiers < 1 || ntiers > TIMESERIES_MAX_TIERS) {
+    return -1;
+  }
+  memset(&m, 0, sizeof(m));
+  for (i = 0; i < ntiers; i++) {
+    if (tiers[i].step_ms <= 0 || tiers[i].points <= 0) {
+      goto fail;
+    }
+    m.tiers[i].step_ms = tiers[i].step_ms;
+    m.tiers[i].points = tiers[i].points;
+    m.tiers[i].slots = (struct timeseries_slot *)malloc(
+        tiers[i].points * sizeof(struct timeseries_slot));
+    if (m.tiers[i].slots == NULL) {
+      goto fail;
+    }
+    for (j = 0; j < tiers[i].points; j++) {
+      m.tiers[i].slots[j].epoch = -1;
+    }
+    m.ntiers = i + 1;
+  }
+  m.name = strdup(metric);
+  if (m.name == NULL) {
+    goto fail;
+  }
+  pthread_mutex_lock(&ts->lock);
+  more = timeseries_find(ts, metric) == NULL
+             ? (struct timeseries_metric *)realloc(
+                   ts->metrics, (ts->len + 1) * sizeof(m))
+             : NULL;
+  if (more != NULL) {
+    ts->metrics = more;
+    ts->metrics[ts->len++] = m;
+  }
+  pthread_mutex_unlock(&ts->lock);
+  if (more != NULL) {
+    return 0;
+  }
+fail:
+  for (i = 0; i < m.ntiers; i++) {
+    free(m.tiers[i].slots);
+  }
+  free(m.name);
+  return -1;
+}
+
+TIMESERIES_API int timeseries_add(struct timeseries *ts, const char *metric,
+                                  int64_t t_ms, double v) {
+  struct timeseries_metric *m;
+  int i;
+  pthread_mutex_lock(&ts->lock);
+  m = timeseries_find(ts, metric);
+  if (m != NULL && t_ms > m->last_ms) {
+    m->last_ms = t_ms;
+  }
+  for (i = 0; m != NULL && t_ms >= 0 && i < m->ntiers; i++) {
+    struct timeseries_ring *r = &m->tiers[i];
+    int64_t epoch = t_ms / r->step_ms;
+    struct timeseries_slot *s = &r->slots[epoch % r->points];
+    /* Already holds a later step: too late for this tier */
+    if (s->epoch > epoch) {
+      continue;
+    }
+    if (s->epoch != epoch) {
+      s->epoch = epoch;
+      s->min = s->max = (float)v;
+      s->sum = 0;
+      s->count = 0;
+    }
+    s->min = v < s->min ? (float)v : s->min;
+    s->max = v > s->max ? (float)v : s->max;
+    s->sum += v;
+    s->count++;
+  }
+  pthread_mutex_unlock(&ts->lock);
+  return m != NULL ? 0 : -1;
+}
+
+/* Of the tiers that still hold from_ms, the one giving the finest points no
+ * finer than step_ms, once rounded up to whole slots; the coarsest of those,
+ * for the fewest slots to read. With none, the one that goes back furthest */
+static struct timeseries_ring *timeseries_pick(struct timeseries_metric *m,
+                                               int64_t from_ms,
+                                               int64_t *step_ms) {
+  struct timeseries_ring *best = NULL, *longest = &m->tiers[0];
+  int64_t best_step = 0, step;
+  int i;
+  for (i = 0; i < m->ntiers; i++) {
+    struct timeseries_ring *r = &m->tiers[i];
+    int64_t span = r->step_ms * r->points;
+    if (span > longest->step_ms * longest->points) {
+      longest = r;
+    }
+    if (m->last_ms - span > from_ms) {
+      continue;
+    }
+    step = (*step_ms + r->step_ms - 1) / r->step_ms * r->step_ms;
+    if (best == NULL || step < best_step ||
+        (step == best_step && r->step_ms > best->step_ms)) {
+      best = r;
+      best_step = step;
+    }
+  }
+  if (best == NULL) {
+    best = longest;
+    best_step = (*step_ms + best->step_ms - 1) / best->step_ms * best->step_ms;
+  }
+  *step_ms = best_step;
+  return best;
+}
+
+TIMESERIES_API int timeseries_query(struct timeseries *ts, const char *metric,
+                                    int64_t from_ms, int64_t to_ms,
+                                    int max_points, float *out,
+                                    int64_t *start_ms, int64_t *step_ms) {
+  struct timeseries_metric *m;
+  struct timeseries_ring *r;
+  int64_t step, end, start, e, oldest, newest, last;
+  int n, i, j;
+  if (max_points > TIMESERIES_MAX_POINTS) {
+    max_points = TIMESERIES_MAX_POINTS;
+  }
+  if (max_points < 1 || to_ms <= from_ms) {
+    *start_ms = to_ms;
+    *step_ms = 0;
+    return 0;
+  }
+  pthread_mutex_lock(&ts->lock);
+  m = timeseries_find(ts, metric);
+  if (m == NULL) {
+    pthread_mutex_unlock(&ts->lock);
+    return -1;
+  }
+  /* Nothing older than the longest tier is kept: a window from 0 would be
+   * millions of empty slots to go through, with the lock held */
+  oldest = m->last_ms;
+  for (i = 0; i < m->ntiers; i++) {
+    int64_t span = m->tiers[i].step_ms * m->tiers[i].points;
+    oldest = m->last_ms - span < oldest ? m->last_ms - span : oldest;
+  }
+  from_ms = from_ms < oldest ? oldest : from_ms;
+  if (to_ms <= from_ms) {
+    pthread_mutex_unlock(&ts->lock);
+    *start_ms = to_ms;
+    *step_ms = 0;
+    return 0;
+  }
+  /* Points are whole slots of the tier, aligned to it */
+  step = (to_ms - from_ms + max_points - 1) / max_points;
+  r = timeseries_pick(m, from_ms, &step);
+  end = (to_ms + step - 1) / step * step;
+  start = from_ms / step * step;
+  n = (int)((end - start) / step);
+  if (n > max_points) {
+    n = max_points;
+  }
+  start = end - n * step;
+  /* The ring only holds its last points steps: no more to read, whatever
+   * the window reaches into the future */
+  newest = m->last_ms / r->step_ms;
+  for (i = 0; i < n; i++) {
+    float min = NAN, max = NAN;
+    double sum = 0;
+    uint32_t count = 0;
+    int64_t first = (start + i * step) / r->step_ms;
+    last = first + step / r->step_ms;
+    last = last > newest + 1 ? newest + 1 : last;
+    e = first < newest - r->points + 1 ? newest - r->points + 1 : first;
+    for (; e < last; e++) {
+      struct timeseries_slot *s;
+      if (e < 0 || (s = &r->slots[e % r->points])->epoch != e) {
+        continue;
+      }
+      min = count == 0 || s->min < min ? s->min : min;
+      max = count == 0 || s->max > max ? s->max : max;
+      sum += s->sum;
+      count += s->count;
+    }
+    j = i * 3;
+    out[j] = min;
+    out[j + 1] = max;
+    out[j + 2] = count > 0 ? (float)(sum / count) : NAN;
+  }
+  pthread_mutex_unlock(&ts->lock);
+  *start_ms = start;
+  *step_ms = step;
+  return n;
+}
+
+TIMESERIES_API size_t timeseries_bytes(struct timeseries *ts) {
+  size_t bytes = 0, i;
+  int j;
+  pthread_mutex_lock(&ts->lock);
+  for (i = 0; i < ts->len; i++) {
+    for (j = 0; j < ts->metrics[i].ntiers; j++) {
+      bytes += ts->metrics[i].tiers[j].points * sizeof(struct timeseries_slot);
+    }
+  }
+  pthread_mutex_unlock(&ts->lock);
+  return bytes;
+}
+
+#endif /* TIMESERIES_HEADER */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIMESERIES_H */
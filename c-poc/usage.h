@@ -0,0 +1,305 @@
+/*
+ * Who costs what, to find the heavy widget on a desktop in use.
+ *
+ * Work is charged to accounts, one per widget or provider, by name:
+ *
+ *   cpu_us        CPU time of its callbacks, on whichever thread they ran
+ *   wakeups       callbacks run for it
+ *   children      processes it started, their CPU time and largest RSS
+ *   js_bytes      what it pushed to the page: scripts and fetched buffers
+ *   mem_bytes     what its buffers hold now
+ *
+ *   struct usage_scope scope;
+ *   usage_begin(&scope, usage_account(u, "history"));
+ *   ...  the provider's work
+ *   usage_end(&scope);
+ *
+ * Counters are atomic: accounts are charged from any thread. A NULL account
+ * is charged nothing, so that code runs the same without accounting.
+ */
+#ifndef USAGE_H
+#define USAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef USAGE_STATIC
+#define USAGE_API static
+#else
+#define USAGE_API extern
+#endif
+
+#define USAGE_NAME_MAX 32
+/* Past this many, new names are not accounted */
+#define USAGE_MAX_ACCOUNTS 64
+
+struct usage;
+struct usage_account;
+
+struct usage_scope {
+  struct usage_account *account; /* May be set after usage_begin() */
+  struct timespec start;
+};
+
+typedef void (*usage_line_fn)(const char *line, void *arg);
+
+USAGE_API struct usage *usage_new(void);
+USAGE_API void usage_free(struct usage *u);
+
+/**
+ * The account called name, created on first use. Returns NULL if u is NULL,
+ * the name is not made of [A-Za-z0-9._-] or when there are too many.
+ */
+USAGE_API struct usage_account *usage_account(struct usage *u,
+                                              const char *name);
+
+/**
+ * Charges the calling thread's CPU time between the two calls, and one
+ * wakeup, to s->account.
+ */
+USAGE_API void usage_begin(struct usage_scope *s, struct usage_account *a);
+USAGE_API void usage_end(struct usage_scope *s);
+
+/**
+ * A child process ended, with usage as wait4() reported it.
+ */
+USAGE_API void usage_child(struct usage_account *a, const struct rusage *usage);
+
+USAGE_API void usage_js(struct usage_account *a, size_t bytes);
+
+/**
+ * Sets what the buffers of a hold now.
+ */
+USAGE_API void usage_set_mem(struct usage_account *a, size_t bytes);
+
+/**
+ * Adds to what the buffers of a hold, or takes away with a negative delta,
+ * for buffers charged as they come and go rather than measured.
+ */
+USAGE_API void usage_add_mem(struct usage_account *a, int64_t delta);
+
+/**
+ * All accounts, as a JSON object, to free(); NULL when out of memory.
+ *   {"history":{"cpu_us":..,"wakeups":..,"children":..,"child_cpu_us":..,
+ *               "child_maxrss_kb":..,"js_bytes":..,"mem_bytes":..},...}
+ */
+USAGE_API char *usage_json(struct usage *u);
+
+/**
+ * One line per account, to fn, for a log.
+ */
+USAGE_API void usage_report(struct usage *u, usage_line_fn fn, void *arg);
+
+#ifndef USAGE_HEADER
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct usage_account {
+  struct usage_account *next;
+  char name[USAGE_NAME_MAX];
+  uint64_t cpu_us;
+  uint64_t wakeups;
+  uint64_t children;
+  uint64_t child_cpu_us;
+  uint64_t child_maxrss_kb;
+  uint64_t js_bytes;
+  uint64_t mem_bytes;
+};
+
+struct usage {
+  pthread_mutex_t lock;
+  struct usage_account *accounts; /* In the order they were created */
+  struct usage_account **tail;
+  int n;
+};
+
+USAGE_API struct usage *usage_new(void) {
+  struct usage *u = (struct usage *)calloc(1, sizeof(struct usage));
+  if (u != NULL) {
+    pthread_mutex_init(&u->lock, NULL);
+    u->tail = &u->accounts;
+  }
+  return u;
+}
+
+USAGE_API void usage_free(struct usage *u) {
+  struct usage_account *a, *next;
+  if (u == NULL) {
+    return;
+  }
+  for (a = u->accounts; a != NULL; a = next) {
+    next = a->next;
+    free(a);
+  }
+  pthread_mutex_destroy(&u->lock);
+  free(u);
+}
+
+/* Names go into JSON and log lines as they are: keep them plain */
+static int usage_plain(const char *s) {
+  size_t n = strlen(s), i;
+  if (n == 0 || n >= USAGE_NAME_MAX) {
+    return 0;
+  }
+  for (i = 0; i < n; i++) {
+    if (!((s[i] >= 'a' && s[i] <= 'z') || (s[i] >= 'A' && s[i] <= 'Z') ||
+          (s[i] >= '0' && s[i] <= '9') || s[i] == '.' || s[i] == '_' ||
+          s[i] == '-')) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+USAGE_API struct usage_account *usage_account(struct usage *u,
+                                              const char *name) {
+  struct usage_account *a;
+  if (u == NULL || !usage_plain(name)) {
+    return NULL;
+  }
+  pthread_mutex_lock(&u->lock);
+  for (a = u->accounts; a != NULL && strcmp(a->name, name) != 0; a = a->next) {
+  }
+  if (a == NULL && u->n < USAGE_MAX_ACCOUNTS &&
+      (a = (struct usage_account *)calloc(1, sizeof(*a))) != NULL) {
+    strcpy(a->name, name);
+    *u->tail = a;
+    u->tail = &a->next;
+    u->n++;
+  }
+  pthread_mutex_unlock(&u->lock);
+  return a;
+}
+
+USAGE_API void usage_begin(struct usage_scope *s, struct usage_account *a) {
+  s->account = a;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &s->start);
+}
+
+USAGE_API void usage_end(struct usage_scope *s) {
+  struct timespec now;
+  int64_t us;
+  if (s->account == NULL) {
+    return;
+  }
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  us = (int64_t)(now.tv_sec - s->start.tv_sec) * 1000000 +
+       (now.tv_nsec - s->start.tv_nsec) / 1000;
+  __atomic_fetch_add(&s->account->cpu_us, (uint64_t)(us > 0 ? us : 0),
+                     __ATOMIC_RELAXED);
+  __atomic_fetch_add(&s->account->wakeups, 1, __ATOMIC_RELAXED);
+}
+
+USAGE_API void usage_child(struct usage_account *a,
+                           const struct rusage *usage) {
+  uint64_t rss, old;
+  if (a == NULL) {
+    return;
+  }
+  __atomic_fetch_add(&a->children, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(
+      &a->child_cpu_us,
+      (uint64_t)(usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000000 +
+          usage->ru_utime.tv_usec + usage->ru_stime.tv_usec,
+      __ATOMIC_RELAXED);
+  rss = usage->ru_maxrss > 0 ? (uint64_t)usage->ru_maxrss : 0;
+  old = __atomic_load_n(&a->child_maxrss_kb, __ATOMIC_RELAXED);
+  while (rss > old &&
+         !__atomic_compare_exchange_n(&a->child_maxrss_kb, &old, rss, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+USAGE_API void usage_js(struct usage_account *a, size_t bytes) {
+  if (a != NULL) {
+    __atomic_fetch_add(&a->js_bytes, (uint64_t)bytes, __ATOMIC_RELAXED);
+  }
+}
+
+USAGE_API void usage_set_mem(struct usage_account *a, size_t bytes) {
+  if (a != NULL) {
+    __atomic_store_n(&a->mem_bytes, (uint64_t)bytes, __ATOMIC_RELAXED);
+  }
+}
+
+USAGE_API void usage_add_mem(struct usage_account *a, int64_t delta) {
+  if (a != NULL) {
+    /* Two's complement: adding a negative one wraps back down */
+    __atomic_fetch_add(&a->mem_bytes, (uint64_t)delta, __ATOMIC_RELAXED);
+  }
+}
+
+/* Called with the lock held */
+static int usage_format(struct usage_account *a, char *out, size_t n,
+                        int json) {
+  unsigned long long v[7];
+  v[0] = __atomic_load_n(&a->cpu_us, __ATOMIC_RELAXED);
+  v[1] = __atomic_load_n(&a->wakeups, __ATOMIC_RELAXED);
+  v[2] = __atomic_load_n(&a->children, __ATOMIC_RELAXED);
+  v[3] = __atomic_load_n(&a->child_cpu_us, __ATOMIC_RELAXED);
+  v[4] = __atomic_load_n(&a->child_maxrss_kb, __ATOMIC_RELAXED);
+  v[5] = __atomic_load_n(&a->js_bytes, __ATOMIC_RELAXED);
+  v[6] = __atomic_load_n(&a->mem_bytes, __ATOMIC_RELAXED);
+  if (json) {
+    return snprintf(out, n,
+                    "\"%s\":{\"cpu_us\":%llu,\"wakeups\":%llu,\"children\":%llu,"
+                    "\"child_cpu_us\":%llu,\"child_maxrss_kb\":%llu,"
+                    "\"js_bytes\":%llu,\"mem_bytes\":%llu}",
+                    a->name, v[0], v[1], v[2], v[3], v[4], v[5], v[6]);
+  }
+  return snprintf(out, n,
+                  "%s: cpu %llu ms, %llu wakeups, %llu children (cpu %llu ms, "
+                  "rss %llu kB), %llu kB to js, %llu kB held",
+                  a->name, v[0] / 1000, v[1], v[2], v[3] / 1000, v[4],
+                  v[5] / 1024, v[6] / 1024);
+}
+
+USAGE_API char *usage_json(struct usage *u) {
+  struct usage_account *a;
+  char *s, *o;
+  size_t len;
+  pthread_mutex_lock(&u->lock);
+  /* Seven 20 digit counters, the keys and the name, per account */
+  len = 3 + (size_t)u->n * (USAGE_NAME_MAX + 320);
+  s = (char *)malloc(len);
+  if (s != NULL) {
+    o = s;
+    *o++ = '{';
+    for (a = u->accounts; a != NULL; a = a->next) {
+      if (a != u->accounts) {
+        *o++ = ',';
+      }
+      o += usage_format(a, o, len - (size_t)(o - s) - 1, 1);
+    }
+    strcpy(o, "}");
+  }
+  pthread_mutex_unlock(&u->lock);
+  return s;
+}
+
+USAGE_API void usage_report(struct usage *u, usage_line_fn fn, void *arg) {
+  struct usage_account *a;
+  char line[256];
+  pthread_mutex_lock(&u->lock);
+  for (a = u->accounts; a != NULL; a = a->next) {
+    usage_format(a, line, sizeof(line), 0);
+    fn(line, arg);
+  }
+  pthread_mutex_unlock(&u->lock);
+}
+
+#endif /* USAGE_HEADER */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* USAGE_H */
@@ -0,0 +1,440 @@
+/*
+ * Typed C++ bindings over struct webview, the C/C++ counterpart of the Go
+ * POC's w.Bind("controller", controller).
+ *
+ *   static int add(int a, int b) { return a + b; }
+ *   static void say_hello(std::string who) { printf("Hello %s\n", who.c_str()); }
+ *
+ *   webview_init(&webview);
+ *   webview_bind::binder controller(&webview, "controller");
+ *   controller.bind("add", add).bind("sayHello", say_hello);
+ *   controller.inject();
+ *
+ * and from the page:
+ *
+ *   controller.sayHello("world");
+ *   controller.add(1, 2).then(function(sum) { ... });
+ *
+ * Every binder and every bound function get an integer id: the stub sends
+ * "#<binder>.<id>:<seq>:[args]" through the usual external message handler,
+ * which costs two table lookups on the native side, and the arguments are
+ * decoded by decoders chosen at compile time.
+ * Messages not starting with '#' are passed on to the external_invoke_cb that
+ * was set before the binder, so existing JSON commands keep working.
+ * Functions returning a value resolve the Promise returned by the stub; void
+ * functions do not reply at all. bind/bind-example.cpp goes through every
+ * type: make -C bind check.
+ */
+#ifndef WEBVIEW_BIND_HPP
+#define WEBVIEW_BIND_HPP
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "webview.h"
+#define JSMN_STATIC
+#include "jsmn-simd.h"
+
+namespace webview_bind {
+
+/* Raw JSON text, for arguments that are objects or arrays */
+struct json {
+  std::string text;
+};
+
+/* Index of the token following the whole subtree rooted at i */
+inline int skip(const jsmntok_t *t, int i) {
+  int pending = 1;
+  while (pending > 0) {
+    pending += t[i].size - 1;
+    i++;
+  }
+  return i;
+}
+
+inline std::string unescape(const char *js, const jsmntok_t &t) {
+  std::string out;
+  out.reserve(t.end - t.start);
+  for (int i = t.start; i < t.end; i++) {
+    char c = js[i];
+    if (c != '\\' || i + 1 >= t.end) {
+      out += c;
+      continue;
+    }
+    c = js[++i];
+    switch (c) {
+    case 'b': out += '\b'; break;
+    case 'f': out += '\f'; break;
+    case 'n': out += '\n'; break;
+    case 'r': out += '\r'; break;
+    case 't': out += '\t'; break;
+    case 'u':
+      if (i + 4 < t.end) {
+        unsigned long cp = strtoul(std::string(js + i + 1, 4).c_str(), NULL, 16);
+        i += 4;
+        /* UTF-8 encode, surrogate pairs are left as two code points */
+        if (cp < 0x80) {
+          out += (char)cp;
+        } else if (cp < 0x800) {
+          out += (char)(0xc0 | (cp >> 6));
+          out += (char)(0x80 | (cp & 0x3f));
+        } else {
+          out += (char)(0xe0 | (cp >> 12));
+          out += (char)(0x80 | ((cp >> 6) & 0x3f));
+          out += (char)(0x80 | (cp & 0x3f));
+        }
+      }
+      break;
+    default: out += c; break;
+    }
+  }
+  return out;
+}
+
+inline void escape(std::string &out, const std::string &s) {
+  out += '"';
+  for (size_t i = 0; i < s.size(); i++) {
+    unsigned char c = (unsigned char)s[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += (char)c;
+    } else if (c < 0x20 || c == '<' || c == '>') {
+      /* < and > too, so "</script>" can never end up in a script */
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += (char)c;
+    }
+  }
+  out += '"';
+}
+
+/* Argument decoders, one per supported C++ type */
+template <typename T> struct arg;
+
+template <> struct arg<int> {
+  static bool decode(const char *js, const jsmntok_t &t, int &v) {
+    if (t.type != JSMN_PRIMITIVE) return false;
+    v = (int)strtol(js + t.start, NULL, 10);
+    return true;
+  }
+};
+template <> struct arg<long> {
+  static bool decode(const char *js, const jsmntok_t &t, long &v) {
+    if (t.type != JSMN_PRIMITIVE) return false;
+    v = strtol(js + t.start, NULL, 10);
+    return true;
+  }
+};
+template <> struct arg<double> {
+  static bool decode(const char *js, const jsmntok_t &t, double &v) {
+    if (t.type != JSMN_PRIMITIVE) return false;
+    v = strtod(js + t.start, NULL);
+    return true;
+  }
+};
+template <> struct arg<bool> {
+  static bool decode(const char *js, const jsmntok_t &t, bool &v) {
+    if (t.type != JSMN_PRIMITIVE) return false;
+    v = js[t.start] == 't';
+    return true;
+  }
+};
+template <> struct arg<std::string> {
+  static bool decode(const char *js, const jsmntok_t &t, std::string &v) {
+    if (t.type != JSMN_STRING) return false;
+    v = unescape(js, t);
+    return true;
+  }
+};
+template <> struct arg<json> {
+  static bool decode(const char *js, const jsmntok_t &t, json &v) {
+    v.text.assign(js + t.start, t.end - t.start);
+    return true;
+  }
+};
+
+/* Result encoders */
+template <typename T> struct ret {
+  static void encode(std::string &out, T v) { out += std::to_string(v); }
+};
+template <> struct ret<double> {
+  static void encode(std::string &out, double v) {
+    /* JSON has no NaN or Infinity; %.17g round-trips every double */
+    char buf[32];
+    if (!std::isfinite(v)) {
+      out += "null";
+      return;
+    }
+    snprintf(buf, sizeof(buf), "%.17g", v);
+    out += buf;
+  }
+};
+template <> struct ret<float> : ret<double> {};
+template <> struct ret<bool> {
+  static void encode(std::string &out, bool v) { out += v ? "true" : "false"; }
+};
+template <> struct ret<std::string> {
+  static void encode(std::string &out, const std::string &v) { escape(out, v); }
+};
+template <> struct ret<json> {
+  static void encode(std::string &out, const json &v) { out += v.text; }
+};
+
+template <int... I> struct seq {};
+template <int N, int... I> struct make_seq : make_seq<N - 1, N - 1, I...> {};
+template <int... I> struct make_seq<0, I...> { typedef seq<I...> type; };
+
+/* Decodes all arguments into a tuple-like set of locals and calls fn */
+template <typename R, typename... A> struct caller {
+  typedef std::function<R(A...)> fn_t;
+
+  template <int... I>
+  static bool call(const fn_t &fn, const char *js, const jsmntok_t *t,
+                   const int *idx, std::string &out, seq<I...>) {
+    (void)js, (void)t, (void)idx; /* Unused without arguments */
+    std::tuple<typename std::decay<A>::type...> args;
+    bool ok[] = {true, arg<typename std::decay<A>::type>::decode(
+                           js, t[idx[I]], std::get<I>(args))...};
+    for (size_t i = 0; i < sizeof(ok) / sizeof(ok[0]); i++) {
+      if (!ok[i]) return false;
+    }
+    ret<typename std::decay<R>::type>::encode(out, fn(std::get<I>(args)...));
+    return true;
+  }
+};
+
+template <typename... A> struct caller<void, A...> {
+  typedef std::function<void(A...)> fn_t;
+
+  template <int... I>
+  static bool call(const fn_t &fn, const char *js, const jsmntok_t *t,
+                   const int *idx, std::string &out, seq<I...>) {
+    (void)out, (void)js, (void)t, (void)idx;
+    std::tuple<typename std::decay<A>::type...> args;
+    bool ok[] = {true, arg<typename std::decay<A>::type>::decode(
+                           js, t[idx[I]], std::get<I>(args))...};
+    for (size_t i = 0; i < sizeof(ok) / sizeof(ok[0]); i++) {
+      if (!ok[i]) return false;
+    }
+    fn(std::get<I>(args)...);
+    return true;
+  }
+};
+
+/* Signature of lambdas and other function objects */
+template <typename F> struct traits : traits<decltype(&F::operator())> {};
+template <typename C, typename R, typename... A>
+struct traits<R (C::*)(A...) const> {
+  typedef std::function<R(A...)> fn_t;
+};
+template <typename C, typename R, typename... A> struct traits<R (C::*)(A...)> {
+  typedef std::function<R(A...)> fn_t;
+};
+
+class binder {
+public:
+  binder(struct webview *w, const char *object)
+      : w_(w), object_(object), next_(NULL) {
+    std::vector<binder *> &r = registry();
+    slot_ = r.size();
+    r.push_back(this);
+    if (w->external_invoke_cb != invoke_cb) {
+      next_ = w->external_invoke_cb;
+      w->external_invoke_cb = invoke_cb;
+    }
+  }
+
+  /* The registry and the JS stubs refer to this one by its slot */
+  binder(const binder &) = delete;
+  binder &operator=(const binder &) = delete;
+
+  ~binder() {
+    std::vector<binder *> &r = registry();
+    r[slot_] = NULL;
+    if (w_->external_invoke_cb != invoke_cb) {
+      return;
+    }
+    /* Hand the chained callback over to another binder of the same webview,
+     * or give it back if we were the last one */
+    binder *other = find(w_);
+    if (other == NULL) {
+      w_->external_invoke_cb = next_;
+    } else if (next_ != NULL) {
+      other->next_ = next_;
+    }
+  }
+
+  template <typename R, typename... A>
+  binder &bind(const char *name, R (*fn)(A...)) {
+    return bind(name, std::function<R(A...)>(fn));
+  }
+
+  template <typename R, typename... A>
+  binder &bind(const char *name, std::function<R(A...)> fn) {
+    entry e;
+    e.name = name;
+    e.arity = sizeof...(A);
+    e.replies = !std::is_void<R>::value;
+    e.call = [fn](const char *js, const jsmntok_t *t, const int *idx,
+                  std::string &out) {
+      return caller<R, A...>::call(fn, js, t, idx, out,
+                                   typename make_seq<sizeof...(A)>::type());
+    };
+    table_.push_back(e);
+    return *this;
+  }
+
+  template <typename F> binder &bind(const char *name, F fn) {
+    return bind(name, typename traits<F>::fn_t(fn));
+  }
+
+  /* Installs the JS stubs; they are in place before the page scripts run,
+   * on this load and on every reload */
+  void inject() {
+    std::string js =
+        "(function(){var b=window.__wvbind=window.__wvbind||{n:0,p:{},"
+        "r:function(s,v){var p=b.p[s];if(p){delete b.p[s];p[0](v);}},"
+        "e:function(s,m){var p=b.p[s];if(p){delete b.p[s];p[1](new Error(m));}},"
+        "c:function(i,r,a){var s=0,q;if(r){s=++b.n;q=new Promise("
+        "function(ok,ko){b.p[s]=[ok,ko];});}"
+        "window.webkit.messageHandlers.external.postMessage('#'+i+':'+s+':'+"
+        "JSON.stringify(Array.prototype.slice.call(a)));return q;}};var o=window['";
+    js += object_;
+    js += "']=window['";
+    js += object_;
+    js += "']||{};";
+    for (size_t i = 0; i < table_.size(); i++) {
+      js += "o['" + table_[i].name + "']=function(){return b.c('" +
+            std::to_string(slot_) + "." + std::to_string(i) + "'," +
+            (table_[i].replies ? "1" : "0") + ",arguments);};";
+    }
+    js += "})()";
+    webview_add_init_script(w_, js.c_str());
+  }
+
+private:
+  struct entry {
+    std::string name;
+    int arity;
+    bool replies;
+    std::function<bool(const char *, const jsmntok_t *, const int *,
+                       std::string &)>
+        call;
+  };
+
+  static std::vector<binder *> &registry() {
+    static std::vector<binder *> r;
+    return r;
+  }
+
+  static binder *find(struct webview *w) {
+    std::vector<binder *> &r = registry();
+    for (size_t i = 0; i < r.size(); i++) {
+      if (r[i] != NULL && r[i]->w_ == w) return r[i];
+    }
+    return NULL;
+  }
+
+  static void invoke_cb(struct webview *w, const char *arg) {
+    std::vector<binder *> &r = registry();
+    if (arg[0] != '#') {
+      for (size_t i = 0; i < r.size(); i++) {
+        if (r[i] != NULL && r[i]->w_ == w && r[i]->next_ != NULL) {
+          r[i]->next_(w, arg);
+          return;
+        }
+      }
+      return;
+    }
+    char *p;
+    unsigned long slot = strtoul(arg + 1, &p, 10);
+    if (*p != '.') return;
+    unsigned long id = strtoul(p + 1, &p, 10);
+    if (*p != ':') return;
+    unsigned long s = strtoul(p + 1, &p, 10);
+    if (*p != ':') return;
+    if (slot < r.size() && r[slot] != NULL && r[slot]->w_ == w) {
+      r[slot]->dispatch(id, s, p + 1);
+    }
+  }
+
+  void dispatch(unsigned long id, unsigned long s, const char *args) {
+    if (id >= table_.size()) {
+      webview_debug("bind: no function with id %lu", id);
+      return;
+    }
+    const entry &e = table_[id];
+    jsmntok_t stack[32];
+    std::vector<jsmntok_t> heap;
+    jsmntok_t *t = stack;
+    int ntok = sizeof(stack) / sizeof(stack[0]);
+    size_t len = strlen(args);
+    int n;
+    for (;;) {
+      jsmn_parser parser;
+      jsmn_init(&parser);
+      n = jsmn_parse_simd(&parser, args, len, t, ntok);
+      if (n != JSMN_ERROR_NOMEM) break;
+      ntok *= 4;
+      heap.resize(ntok);
+      t = heap.data();
+    }
+    if (n < 1 || t[0].type != JSMN_ARRAY || t[0].size != e.arity) {
+      fail(e, s, "bad arguments");
+      return;
+    }
+    int idx[sizeof(stack) / sizeof(stack[0])];
+    std::vector<int> idx_heap;
+    int *pi = idx;
+    if (e.arity > (int)(sizeof(idx) / sizeof(idx[0]))) {
+      idx_heap.resize(e.arity);
+      pi = idx_heap.data();
+    }
+    for (int a = 0, i = 1; a < e.arity; a++) {
+      pi[a] = i;
+      i = skip(t, i);
+    }
+    std::string js;
+    if (e.replies) {
+      js = "window.__wvbind.r(" + std::to_string(s) + ",";
+    }
+    if (!e.call(args, t, pi, js)) {
+      fail(e, s, "bad argument types");
+      return;
+    }
+    if (e.replies) {
+      js += ")";
+      webview_eval(w_, js.c_str());
+    }
+  }
+
+  void fail(const entry &e, unsigned long s, const char *why) {
+    webview_debug("bind: %s.%s: %s", object_.c_str(), e.name.c_str(), why);
+    if (e.replies) {
+      std::string js = "window.__wvbind.e(" + std::to_string(s) + ",";
+      escape(js, why);
+      js += ")";
+      webview_eval(w_, js.c_str());
+    }
+  }
+
+  struct webview *w_;
+  size_t slot_;
+  std::string object_;
+  webview_external_invoke_cb_t next_;
+  std::vector<entry> table_;
+};
+
+} // namespace webview_bind
+
+#endif /* WEBVIEW_BIND_HPP */
@@ -52,6 +52,40 @@ struct webview_priv {
   int ready;
   int js_busy;
   int should_exit;
+  // ----- ADDED CODE ------------- //
+  int frames;
+  gint64 frame_start_us;
+  gint64 frame_last_us;
+  gint64 frame_min_us;
+  gint64 frame_max_us;
+  gint64 frame_total_us;
+  FILE *frame_log;
+  unsigned long wakeups;
+  gint64 wakeup_window_us;
+  double wakeups_per_sec;
+  GPtrArray *surfaces; /* per_monitor: struct webview_surface, primary first */
+  GtkWidget *standby;  /* Spare view in its own web process, or NULL */
+  unsigned int hints;  /* WEBVIEW_HINT_* */
+  int hint_type;       /* GdkWindowTypeHint, or -1 */
+  int strut_edge;
+  int strut_size;
+  guint standby_source;
+  guint recover_source;
+  int recovering;      /* Reloading after a crash: termination reason + 1 */
+  gint64 crash_us;
+  int crash_delay_ms;
+  int accel;           /* WebKitHardwareAccelerationPolicy, or -1 */
+  int device_scale;    /* 0: the screen's */
+  int opaque;          /* WEBVIEW_OPAQUE_* */
+  int hidden;          /* Every window covered, minimized or unmapped */
+  int hidden_gen;      /* Bumped on each change, for the timers to see */
+  GPtrArray *init_scripts; /* WebKitUserScript, in each surface's manager */
+  GPtrArray *once_scripts; /* WebKitUserScript, gone at the first commit */
+  int once_pending;    /* Views still to commit before they go */
+  int surface_ids;     /* The last id given to a surface */
+  int message_surface; /* Whose message comes next, from its own handler */
+  int invoke_surface;  /* Whose message external_invoke_cb is handling */
+  // ------ END ADDED CODE -------- //
 };
 #elif defined(WEBVIEW_COCOA)
 #include <objc/objc-runtime.h>
@@ -81,6 +115,22 @@ struct webview {
   int height;
   int resizable;
   int debug;
+  // ----- ADDED CODE ------------- //
+  int headless;          /* Render offscreen at width x height, no WM needed */
+  double scale;          /* Headless: device pixels per CSS pixel, rounded */
+                         /* to an integer as GTK3 wants; 1 when left to 0 */
+  double zoom;           /* Page zoom level, 1.0 when left to 0 */
+  const char *frame_log; /* If set, per-frame paint timings go here (CSV) */
+  int idle_slack_ms;     /* >0: idle mode, timers are merged on this grid */
+  int per_monitor;       /* One surface per monitor, following hotplug */
+  int standby;           /* Keep a spare web process to recover crashes into */
+  const char *window_hints; /* NULL for WEBVIEW_DEFAULT_WINDOW_HINTS */
+  const char *render;       /* NULL for WEBVIEW_DEFAULT_RENDER */
+  int hidden_interval_ms; /* >0: while hidden, the page pauses and timers */
+                          /* run at most this often (webview_set_hidden()) */
+  const void *session_state; /* From webview_get_session_state(): restored */
+  size_t session_state_len;  /* by webview_init() instead of loading url */
+  // ------ END ADDED CODE -------- //
   webview_external_invoke_cb_t external_invoke_cb;
   struct webview_priv priv;
   void *userdata;
@@ -123,6 +173,60 @@ struct webview_dispatch_arg {
   "css'),t.styleSheet?t.styleSheet.cssText=e:t.appendChild(document."          \
   "createTextNode(e)),d.appendChild(t)})"
 
+// ----- ADDED CODE ------------- //
+#define EXTERNAL_INVOKE_FUNCTION                                               \
+  "window.external=window.external||{};window.external.invoke=function(x){"   \
+  "window.webkit.messageHandlers.external.postMessage(x);}"
+
+/* Page side of idle mode: setTimeout deadlines at least one slack long are
+ * aligned to the slack grid and setInterval periods rounded up to it, so
+ * polling pages wake up together with the native timers. */
+#define IDLE_TIMERS_FUNCTION                                                   \
+  "(function(s){var st=window.setTimeout,si=window.setInterval;"              \
+  "window.setTimeout=function(f,d){var a=Array.prototype.slice.call("          \
+  "arguments);d=+d||0;if(d>=s){var n=Date.now();a[1]=Math.ceil((n+d)/s)*s-n;}" \
+  "return st.apply(window,a);};"                                               \
+  "window.setInterval=function(f,d){var a=Array.prototype.slice.call("         \
+  "arguments);d=+d||0;if(d>=s){a[1]=Math.ceil(d/s)*s;}"                        \
+  "return si.apply(window,a);};})"
+
+/* Page side of hidden mode, told by window.__hostvisibility(hidden): while
+ * hidden, setInterval timers are stopped, setTimeout callbacks and animation
+ * frames held back and animations paused. On reveal each interval and held
+ * callback runs once, right away, and a 'hostvisibility' event follows. */
+#define HOST_VISIBILITY_FUNCTION                                               \
+  "(function(){var h=false,st=window.setTimeout,ct=window.clearTimeout,"      \
+  "si=window.setInterval,ci=window.clearInterval,"                            \
+  "ra=window.requestAnimationFrame,ca=window.cancelAnimationFrame,"           \
+  "iv={},late=[],fr={},k=0,an=[];"                                             \
+  "function cl(i){var t=iv[i];if(!t)return ct(i);delete iv[i];"               \
+  "if(t.r)ci(t.r);}"                                                           \
+  "function run(f,a){if(typeof f==='function')"                                \
+  "st.apply(window,[f,0].concat(a));}"                                         \
+  "window.setTimeout=function(f){var a=[].slice.call(arguments);"             \
+  "if(typeof f==='function')a[0]=function(){var b=[].slice.call(arguments);"  \
+  "if(h)late.push([f,b]);else f.apply(window,b);};"                            \
+  "return st.apply(window,a);};"                                               \
+  "window.setInterval=function(){var a=[].slice.call(arguments),"             \
+  "i=si.apply(window,a);if(h)ci(i);iv[i]={a:a,r:h?0:i};return i;};"           \
+  "window.clearTimeout=window.clearInterval=cl;"                               \
+  "window.requestAnimationFrame=function(f){if(!h)return ra.call(window,f);"  \
+  "fr[--k]=f;return k;};"                                                      \
+  "window.cancelAnimationFrame=function(i){if(i<0)delete fr[i];"              \
+  "else ca.call(window,i);};"                                                  \
+  "window.__hostvisibility=function(x){var i,t;if(!!x===h)return;h=!!x;"      \
+  "if(h){for(i in iv)if(iv[i].r){ci(iv[i].r);iv[i].r=0;}"                      \
+  "an=document.getAnimations?document.getAnimations().filter(function(a){"    \
+  "return a.playState==='running';}):[];an.forEach(function(a){a.pause();});}" \
+  "else{an.forEach(function(a){a.play();});an=[];"                             \
+  "for(i in iv)if(!iv[i].r){t=iv[i].a;run(t[0],t.slice(2));"                  \
+  "iv[i].r=si.apply(window,t);}"                                               \
+  "t=late;late=[];t.forEach(function(c){run(c[0],c[1]);});"                   \
+  "t=fr;fr={};for(i in t)ra.call(window,t[i]);}"                               \
+  "window.dispatchEvent(new CustomEvent('hostvisibility',"                     \
+  "{detail:{hidden:h}}));};})()"
+// ------ END ADDED CODE -------- //
+
 static const char *webview_check_url(const char *url) {
   if (url == NULL || strlen(url) == 0) {
     return DEFAULT_URL;
@@ -153,8 +257,114 @@ WEBVIEW_API void webview_debug(const char *format, ...);
 WEBVIEW_API void webview_print_log(const char *s);
 
 // ----- ADDED CODE ------------- //
+/* The window's role, set before it is mapped: a comma separated list of
+ *   below, above, sticky, skip_taskbar, skip_pager, no_focus, maximized,
+ *   undecorated, type=normal|desktop|dock|utility|splash|notification,
+ *   strut=left|right|top|bottom:SIZE (a bar SIZE pixels wide along that
+ *   edge of the monitor, whose space other windows leave free) */
+#define WEBVIEW_DEFAULT_WINDOW_HINTS "maximized,below,sticky,skip_taskbar"
+
+/* How the page is rendered, a comma separated list of
+ *   accel=never|always|on-demand (WebKit's hardware acceleration policy),
+ *   device-scale=N (device pixels per CSS pixel instead of the screen's: 1 on
+ *   a HiDPI screen paints a quarter of the pixels; only if GTK is not
+ *   initialized yet), opaque=auto|always|never (an opaque window instead of
+ *   a transparent one; auto: when no compositor runs, where transparency
+ *   would only show black). Headless mode always renders in software, and
+ *   keeps its transparency unless opaque=always. */
+#define WEBVIEW_DEFAULT_RENDER "accel=on-demand,opaque=auto"
+
 static void screen_changed(GtkWidget *widget, GdkScreen *old_screen, gpointer userdata);
 static gboolean draw(GtkWidget *widget, cairo_t *cr, gpointer userdata);
+
+struct webview_frame_stats {
+  int frames;      /* Frames painted since webview_init() */
+  long last_us;    /* Paint time of the most recent frame */
+  long min_us;
+  long max_us;
+  long total_us;
+};
+
+WEBVIEW_API int webview_snapshot(struct webview *w, const char *png_path);
+WEBVIEW_API void webview_frame_stats(struct webview *w,
+                                     struct webview_frame_stats *stats);
+
+/* Native timers. Return non-zero from the callback to keep the timer going.
+ * In idle mode (idle_slack_ms > 0) timers without WEBVIEW_TIMER_URGENT are
+ * rounded up to the slack grid, so they all fire in the same wakeup. */
+#define WEBVIEW_TIMER_URGENT (1 << 0)
+
+typedef int (*webview_timer_fn)(struct webview *w, void *arg);
+
+WEBVIEW_API void webview_add_init_script(struct webview *w, const char *js);
+/* As webview_add_init_script(), for the first page load only: the script
+ * is removed once that load commits, so reloads don't run it again */
+WEBVIEW_API void webview_add_init_script_once(struct webview *w,
+                                              const char *js);
+/* Which window the message external_invoke_cb handles came from: 0 for the
+ * primary one, or the id of a per-monitor surface, never reused. Each
+ * surface runs the page on its own, with request ids of its own. */
+WEBVIEW_API int webview_invoke_surface(struct webview *w);
+/* Same for the window whose page made request, or -1 if it is none of ours */
+WEBVIEW_API int webview_request_surface(struct webview *w,
+                                        WebKitURISchemeRequest *request);
+WEBVIEW_API unsigned int webview_timer_add(struct webview *w, int interval_ms,
+                                           int flags, webview_timer_fn fn,
+                                           void *arg);
+WEBVIEW_API void webview_timer_remove(struct webview *w, unsigned int id);
+WEBVIEW_API double webview_wakeups_per_sec(struct webview *w);
+
+/* Serves scheme://... URIs from native code; pages may fetch() them */
+WEBVIEW_API void webview_register_uri_scheme(struct webview *w,
+                                             const char *scheme,
+                                             WebKitURISchemeRequestCallback cb,
+                                             void *arg);
+
+/* Tracing, for recorder.h: fn sees each invoke payload and each evaluated
+ * script just before it is handled, and each dispatched call with data NULL.
+ * All of them on the GTK thread. */
+#define WEBVIEW_TRACE_INVOKE 1
+#define WEBVIEW_TRACE_EVAL 2
+#define WEBVIEW_TRACE_DISPATCH 3
+
+typedef void (*webview_trace_fn)(struct webview *w, int kind,
+                                 const char *data, webview_dispatch_fn fn,
+                                 void *arg);
+
+WEBVIEW_API void webview_set_trace(struct webview *w, webview_trace_fn fn,
+                                   void *arg);
+
+/* Crash recovery: when the web process dies the page is loaded again, into
+ * the standby process if w->standby is set, and fn runs once it has loaded.
+ * That is the moment to push back the state the page lost. reason is a
+ * WebKitWebProcessTerminationReason. */
+typedef void (*webview_recover_fn)(struct webview *w, int reason, void *arg);
+
+WEBVIEW_API void webview_set_recover(struct webview *w, webview_recover_fn fn,
+                                     void *arg);
+
+/* WebKit's session state (history, scroll positions, form data), to hand
+ * back in w->session_state on the next start. g_free() it. */
+WEBVIEW_API void *webview_get_session_state(struct webview *w, size_t *len);
+
+/* Where webview_debug() messages go instead of stderr, e.g. a logger that
+ * does not block the GTK thread. NULL restores stderr. */
+typedef void (*webview_log_fn)(const char *s, void *arg);
+
+WEBVIEW_API void webview_set_log(webview_log_fn fn, void *arg);
+
+/* Hidden mode, with w->hidden_interval_ms > 0: a window is hidden when it is
+ * fully covered, minimized or unmapped, as X reports it (with a compositor,
+ * X reports windows as never covered). A hidden window's page pauses
+ * (HOST_VISIBILITY_FUNCTION). Once every window is, timers without
+ * WEBVIEW_TIMER_URGENT run at most every hidden_interval_ms, and fn is told,
+ * e.g. to slow down pollers of its own. On reveal the timers that are due
+ * run at once. */
+typedef void (*webview_hidden_fn)(struct webview *w, int hidden, void *arg);
+
+WEBVIEW_API void webview_set_hidden(struct webview *w, webview_hidden_fn fn,
+                                    void *arg);
+WEBVIEW_API int webview_is_hidden(struct webview *w);
 // ------ END ADDED CODE -------- //
 
 #ifdef WEBVIEW_IMPLEMENTATION
@@ -210,23 +420,47 @@ static int webview_js_encode(const char *s, char *esc, size_t n) {
   return r;
 }
 
-WEBVIEW_API int webview_inject_css(struct webview *w, const char *css) {
+// ------------ ADDED CODE ----------------- //
+/* The script webview_inject_css() evaluates, to free() */
+static char *webview_css_script(const char *css) {
   int n = webview_js_encode(css, NULL, 0);
-  char *esc = (char *)calloc(1, sizeof(CSS_INJECT_FUNCTION) + n + 4);
+  size_t size = sizeof(CSS_INJECT_FUNCTION) + n + 4;
+  char *esc = (char *)calloc(1, size);
+  char *js = (char *)calloc(1, n);
+  if (esc == NULL || js == NULL) {
+    free(esc);
+    free(js);
+    return NULL;
+  }
+  webview_js_encode(css, js, n);
+  snprintf(esc, size, "%s(\"%s\")", CSS_INJECT_FUNCTION, js);
+  free(js);
+  return esc;
+}
+// ------------ END ADDED CODE ----------------- //
+
+WEBVIEW_API int webview_inject_css(struct webview *w, const char *css) {
+  char *esc = webview_css_script(css);
   if (esc == NULL) {
     return -1;
   }
-  char *js = (char *)calloc(1, n);
-  webview_js_encode(css, js, n);
-  snprintf(esc, sizeof(CSS_INJECT_FUNCTION) + n + 4, "%s(\"%s\")",
-           CSS_INJECT_FUNCTION, js);
   int r = webview_eval(w, esc);
-  free(js);
   free(esc);
   return r;
 }
 
 #if defined(WEBVIEW_GTK)
+// ------------ ADDED CODE ----------------- //
+static webview_trace_fn webview_trace = NULL;
+static void *webview_trace_arg = NULL;
+static webview_recover_fn webview_recover = NULL;
+static void *webview_recover_arg = NULL;
+static webview_log_fn webview_log = NULL;
+static void *webview_log_arg = NULL;
+static webview_hidden_fn webview_hidden = NULL;
+static void *webview_hidden_arg = NULL;
+// ------------ END ADDED CODE ----------------- //
+
 static void external_message_received_cb(WebKitUserContentManager *m,
                                          WebKitJavascriptResult *r,
                                          gpointer arg) {
@@ -241,17 +475,64 @@ static void external_message_received_cb(WebKitUserContentManager *m,
   size_t n = JSStringGetMaximumUTF8CStringSize(js);
   char *s = g_new(char, n);
   JSStringGetUTF8CString(js, s, n);
+  // ------------ ADDED CODE ----------------- //
+  if (webview_trace != NULL) {
+    webview_trace(w, WEBVIEW_TRACE_INVOKE, s, NULL, webview_trace_arg);
+  }
+  // A message handled from inside this one (webview_eval() runs the loop)
+  // must not change whose this one is
+  int outer = w->priv.invoke_surface;
+  w->priv.invoke_surface = w->priv.message_surface;
+  w->priv.message_surface = 0;
+  // ------------ END ADDED CODE ----------------- //
   w->external_invoke_cb(w, s);
+  // ------------ ADDED CODE ----------------- //
+  w->priv.invoke_surface = outer;
+  // ------------ END ADDED CODE ----------------- //
   JSStringRelease(js);
   g_free(s);
 }
 
+// ------------ ADDED CODE ----------------- //
+static void webview_user_script_remove(struct webview *w,
+                                       WebKitUserScript *script);
+
+/* A view's first load committed: once every view loading with the scripts
+ * for the first load only has, they go */
+static void webview_once_committed(struct webview *w) {
+  if (w->priv.once_scripts == NULL || --w->priv.once_pending > 0) {
+    return;
+  }
+  for (guint i = 0; i < w->priv.once_scripts->len; i++) {
+    webview_user_script_remove(
+        w, (WebKitUserScript *)g_ptr_array_index(w->priv.once_scripts, i));
+  }
+  g_ptr_array_unref(w->priv.once_scripts);
+  w->priv.once_scripts = NULL;
+}
+// ------------ END ADDED CODE ----------------- //
+
 static void webview_load_changed_cb(WebKitWebView *webview,
                                     WebKitLoadEvent event, gpointer arg) {
   (void)webview;
   struct webview *w = (struct webview *)arg;
+  // ------------ ADDED CODE ----------------- //
+  // With surfaces, each view reports its own commit
+  if (event == WEBKIT_LOAD_COMMITTED && w->priv.surfaces == NULL) {
+    webview_once_committed(w);
+  }
+  // ------------ END ADDED CODE ----------------- //
   if (event == WEBKIT_LOAD_FINISHED) {
     w->priv.ready = 1;
+    // ------------ ADDED CODE ----------------- //
+    if (w->priv.recovering) {
+      int reason = w->priv.recovering - 1;
+      w->priv.recovering = 0;
+      if (webview_recover != NULL) {
+        webview_recover(w, reason, webview_recover_arg);
+      }
+    }
+    // ------------ END ADDED CODE ----------------- //
   }
 }
 
@@ -274,7 +555,852 @@ static gboolean webview_context_menu_cb(WebKitWebView *webview,
   return TRUE;
 }
 
+// ------------ ADDED CODE ----------------- //
+static GPollFunc webview_default_poll = NULL;
+static struct webview *webview_wakeup_owner = NULL;
+
+/* Every poll that may sleep and returns is a wakeup of the process */
+static gint webview_counting_poll(GPollFD *fds, guint nfds, gint timeout) {
+  gint r = webview_default_poll(fds, nfds, timeout);
+  if (timeout != 0 && webview_wakeup_owner != NULL) {
+    webview_wakeup_owner->priv.wakeups++;
+  }
+  return r;
+}
+
+static gboolean webview_frame_begin_cb(GtkWidget *widget, cairo_t *cr,
+                                       gpointer arg) {
+  (void)widget;
+  (void)cr;
+  struct webview *w = (struct webview *)arg;
+  w->priv.frame_start_us = g_get_monotonic_time();
+  return FALSE;
+}
+
+static gboolean webview_frame_end_cb(GtkWidget *widget, cairo_t *cr,
+                                     gpointer arg) {
+  (void)widget;
+  (void)cr;
+  struct webview *w = (struct webview *)arg;
+  gint64 us = g_get_monotonic_time() - w->priv.frame_start_us;
+  w->priv.frames++;
+  w->priv.frame_last_us = us;
+  w->priv.frame_total_us += us;
+  if (us < w->priv.frame_min_us) {
+    w->priv.frame_min_us = us;
+  }
+  if (us > w->priv.frame_max_us) {
+    w->priv.frame_max_us = us;
+  }
+  if (w->priv.frame_log != NULL) {
+    fprintf(w->priv.frame_log, "%d,%" G_GINT64_FORMAT ",%" G_GINT64_FORMAT "\n",
+            w->priv.frames, w->priv.frame_start_us, us);
+  }
+  return FALSE;
+}
+// ------------ END ADDED CODE ----------------- //
+
+// ------------ ADDED CODE ----------------- //
+/* Window hints, parsed from w->window_hints by webview_init(). Everything
+ * but the strut is set on the GtkWindow before it is first mapped, so the
+ * window manager sees the window's role from the start. */
+#define WEBVIEW_HINT_BELOW (1 << 0)
+#define WEBVIEW_HINT_ABOVE (1 << 1)
+#define WEBVIEW_HINT_STICKY (1 << 2)
+#define WEBVIEW_HINT_SKIP_TASKBAR (1 << 3)
+#define WEBVIEW_HINT_SKIP_PAGER (1 << 4)
+#define WEBVIEW_HINT_NO_FOCUS (1 << 5)
+#define WEBVIEW_HINT_MAXIMIZED (1 << 6)
+#define WEBVIEW_HINT_UNDECORATED (1 << 7)
+
+enum { WEBVIEW_STRUT_NONE, WEBVIEW_STRUT_LEFT, WEBVIEW_STRUT_RIGHT,
+       WEBVIEW_STRUT_TOP, WEBVIEW_STRUT_BOTTOM };
+
+static const struct {
+  const char *name;
+  unsigned int flag;
+} webview_hint_flags[] = {
+    {"below", WEBVIEW_HINT_BELOW},
+    {"above", WEBVIEW_HINT_ABOVE},
+    {"sticky", WEBVIEW_HINT_STICKY},
+    {"skip_taskbar", WEBVIEW_HINT_SKIP_TASKBAR},
+    {"skip_pager", WEBVIEW_HINT_SKIP_PAGER},
+    {"no_focus", WEBVIEW_HINT_NO_FOCUS},
+    {"maximized", WEBVIEW_HINT_MAXIMIZED},
+    {"undecorated", WEBVIEW_HINT_UNDECORATED},
+};
+
+static const struct {
+  const char *name;
+  GdkWindowTypeHint type;
+} webview_hint_types[] = {
+    {"normal", GDK_WINDOW_TYPE_HINT_NORMAL},
+    {"desktop", GDK_WINDOW_TYPE_HINT_DESKTOP},
+    {"dock", GDK_WINDOW_TYPE_HINT_DOCK},
+    {"utility", GDK_WINDOW_TYPE_HINT_UTILITY},
+    {"splash", GDK_WINDOW_TYPE_HINT_SPLASHSCREEN},
+    {"notification", GDK_WINDOW_TYPE_HINT_NOTIFICATION},
+};
+
+static const char *webview_strut_edges[] = {NULL, "left", "right", "top",
+                                            "bottom"};
+
+enum { WEBVIEW_OPAQUE_AUTO, WEBVIEW_OPAQUE_ALWAYS, WEBVIEW_OPAQUE_NEVER };
+
+static const char *webview_accel_names[] = {"always", "never", "on-demand"};
+static const char *webview_opaque_names[] = {"auto", "always", "never"};
+
+/* Index of name in names, or -1 */
+static int webview_find_name(const char *name, const char **names, int n) {
+  for (int i = 0; i < n; i++) {
+    if (strcmp(name, names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* Parses w->render; device-scale takes effect here, before gtk_init() */
+static void webview_parse_render(struct webview *w) {
+  gchar **items = g_strsplit(w->render != NULL ? w->render
+                                               : WEBVIEW_DEFAULT_RENDER,
+                             ",", -1);
+  w->priv.accel = -1;
+  w->priv.device_scale = 0;
+  w->priv.opaque = WEBVIEW_OPAQUE_AUTO;
+  for (gchar **item = items; *item != NULL; item++) {
+    const char *opt = g_strstrip(*item);
+    int known = 0;
+    if (*opt == '\0') {
+      continue;
+    }
+    if (g_str_has_prefix(opt, "accel=")) {
+      int policy = webview_find_name(opt + 6, webview_accel_names, 3);
+      static const int policies[] = {
+          WEBKIT_HARDWARE_ACCELERATION_POLICY_ALWAYS,
+          WEBKIT_HARDWARE_ACCELERATION_POLICY_NEVER,
+          WEBKIT_HARDWARE_ACCELERATION_POLICY_ON_DEMAND};
+      if (policy >= 0) {
+        w->priv.accel = policies[policy];
+        known = 1;
+      }
+    } else if (g_str_has_prefix(opt, "device-scale=")) {
+      w->priv.device_scale = atoi(opt + 13);
+      known = w->priv.device_scale > 0;
+    } else if (g_str_has_prefix(opt, "opaque=")) {
+      int opaque = webview_find_name(opt + 7, webview_opaque_names, 3);
+      if (opaque >= 0) {
+        w->priv.opaque = opaque;
+        known = 1;
+      }
+    }
+    if (!known) {
+      webview_debug("webview: unknown render option '%s'", opt);
+    }
+  }
+  g_strfreev(items);
+  // The offscreen window is rendered at width*scale x height*scale
+  if (w->headless && w->scale > 0 && w->priv.device_scale == 0) {
+    w->priv.device_scale = (int)(w->scale + 0.5) > 0 ? (int)(w->scale + 0.5) : 1;
+  }
+  if (w->priv.device_scale > 0) {
+    char scale[16];
+    snprintf(scale, sizeof(scale), "%d", w->priv.device_scale);
+    g_setenv("GDK_SCALE", scale, TRUE);
+  }
+}
+
+static void webview_parse_window_hints(struct webview *w) {
+  gchar **items = g_strsplit(w->window_hints != NULL
+                                 ? w->window_hints
+                                 : WEBVIEW_DEFAULT_WINDOW_HINTS,
+                             ",", -1);
+  w->priv.hints = 0;
+  w->priv.hint_type = -1;
+  w->priv.strut_edge = WEBVIEW_STRUT_NONE;
+  w->priv.strut_size = 0;
+  for (gchar **item = items; *item != NULL; item++) {
+    const char *hint = g_strstrip(*item);
+    int known = 0;
+    size_t i;
+    if (*hint == '\0') {
+      continue;
+    }
+    for (i = 0; i < G_N_ELEMENTS(webview_hint_flags); i++) {
+      if (strcmp(hint, webview_hint_flags[i].name) == 0) {
+        w->priv.hints |= webview_hint_flags[i].flag;
+        known = 1;
+      }
+    }
+    if (g_str_has_prefix(hint, "type=")) {
+      for (i = 0; i < G_N_ELEMENTS(webview_hint_types); i++) {
+        if (strcmp(hint + 5, webview_hint_types[i].name) == 0) {
+          w->priv.hint_type = webview_hint_types[i].type;
+          known = 1;
+        }
+      }
+    } else if (g_str_has_prefix(hint, "strut=")) {
+      char edge[8];
+      int size;
+      if (sscanf(hint + 6, "%7[a-z]:%d", edge, &size) == 2 && size > 0) {
+        for (i = 1; i < G_N_ELEMENTS(webview_strut_edges); i++) {
+          if (strcmp(edge, webview_strut_edges[i]) == 0) {
+            w->priv.strut_edge = (int)i;
+            w->priv.strut_size = size;
+            known = 1;
+          }
+        }
+      }
+    }
+    if (!known) {
+      webview_debug("webview: unknown window hint '%s'", hint);
+    }
+  }
+  g_strfreev(items);
+}
+
+/* placed: the window gets an explicit geometry (per_monitor, or a strut),
+ * instead of being maximized */
+static void webview_apply_window_hints(struct webview *w, GtkWidget *widget,
+                                       int placed) {
+  GtkWindow *window = GTK_WINDOW(widget);
+  unsigned int hints = w->priv.hints;
+  if (w->priv.hint_type >= 0) {
+    gtk_window_set_type_hint(window, (GdkWindowTypeHint)w->priv.hint_type);
+  }
+  gtk_window_set_keep_below(window, !!(hints & WEBVIEW_HINT_BELOW));
+  gtk_window_set_keep_above(window, !!(hints & WEBVIEW_HINT_ABOVE));
+  gtk_window_set_skip_taskbar_hint(window, !!(hints & WEBVIEW_HINT_SKIP_TASKBAR));
+  gtk_window_set_skip_pager_hint(window, !!(hints & WEBVIEW_HINT_SKIP_PAGER));
+  gtk_window_set_accept_focus(window, !(hints & WEBVIEW_HINT_NO_FOCUS));
+  if (hints & WEBVIEW_HINT_STICKY) {
+    gtk_window_stick(window);
+  }
+  if (placed || (hints & WEBVIEW_HINT_UNDECORATED)) {
+    gtk_window_set_decorated(window, FALSE);
+  }
+  if (placed) {
+    gtk_widget_set_size_request(widget, -1, -1);
+    gtk_window_set_resizable(window, TRUE);
+  } else if (hints & WEBVIEW_HINT_MAXIMIZED) {
+    // "Fullscreen": maximized with no bar
+    gtk_window_set_hide_titlebar_when_maximized(window, TRUE);
+    gtk_window_maximize(window);
+  }
+}
+
+/* Where a placed window goes: all of monitor, or the strut's bar along it */
+static void webview_window_geometry(struct webview *w, GdkMonitor *monitor,
+                                    GdkRectangle *g) {
+  gdk_monitor_get_geometry(monitor, g);
+  switch (w->priv.strut_edge) {
+  case WEBVIEW_STRUT_LEFT:
+    g->width = MIN(w->priv.strut_size, g->width);
+    break;
+  case WEBVIEW_STRUT_RIGHT:
+    g->x += g->width - MIN(w->priv.strut_size, g->width);
+    g->width = MIN(w->priv.strut_size, g->width);
+    break;
+  case WEBVIEW_STRUT_TOP:
+    g->height = MIN(w->priv.strut_size, g->height);
+    break;
+  case WEBVIEW_STRUT_BOTTOM:
+    g->y += g->height - MIN(w->priv.strut_size, g->height);
+    g->height = MIN(w->priv.strut_size, g->height);
+    break;
+  }
+}
+
+/* Moves the window to its place on monitor, and reserves the strut there:
+ * _NET_WM_STRUT(_PARTIAL), in root window device pixels. Realizes the
+ * window, so its visual must already be set. */
+static void webview_place_window(struct webview *w, GtkWidget *window,
+                                 GdkMonitor *monitor) {
+  GdkRectangle g;
+  gulong strut[12] = {0};
+  webview_window_geometry(w, monitor, &g);
+  gtk_window_move(GTK_WINDOW(window), g.x, g.y);
+  gtk_window_resize(GTK_WINDOW(window), g.width, g.height);
+  if (w->priv.strut_edge == WEBVIEW_STRUT_NONE) {
+    return;
+  }
+  gtk_widget_realize(window);
+  GdkWindow *gdk_window = gtk_widget_get_window(window);
+  GdkWindow *root = gdk_screen_get_root_window(gtk_widget_get_screen(window));
+  int scale = gdk_window_get_scale_factor(gdk_window);
+  int root_width = gdk_window_get_width(root);
+  int root_height = gdk_window_get_height(root);
+  switch (w->priv.strut_edge) {
+  case WEBVIEW_STRUT_LEFT:
+    strut[0] = g.x + g.width, strut[4] = g.y, strut[5] = g.y + g.height;
+    break;
+  case WEBVIEW_STRUT_RIGHT:
+    strut[1] = root_width - g.x, strut[6] = g.y, strut[7] = g.y + g.height;
+    break;
+  case WEBVIEW_STRUT_TOP:
+    strut[2] = g.y + g.height, strut[8] = g.x, strut[9] = g.x + g.width;
+    break;
+  case WEBVIEW_STRUT_BOTTOM:
+    strut[3] = root_height - g.y, strut[10] = g.x, strut[11] = g.x + g.width;
+    break;
+  }
+  // Ends are inclusive
+  for (int i = 0; i < 12; i++) {
+    strut[i] *= scale;
+    if (i >= 4 && i % 2 == 1 && strut[i] > 0) {
+      strut[i]--;
+    }
+  }
+  gdk_property_change(gdk_window,
+                      gdk_atom_intern_static_string("_NET_WM_STRUT_PARTIAL"),
+                      gdk_atom_intern_static_string("CARDINAL"), 32,
+                      GDK_PROP_MODE_REPLACE, (const guchar *)strut, 12);
+  gdk_property_change(gdk_window, gdk_atom_intern_static_string("_NET_WM_STRUT"),
+                      gdk_atom_intern_static_string("CARDINAL"), 32,
+                      GDK_PROP_MODE_REPLACE, (const guchar *)strut, 4);
+}
+// ------------ END ADDED CODE ----------------- //
+
+// ------------ ADDED CODE ----------------- //
+/* per_monitor: one window per monitor, each at the monitor's geometry. The
+ * first is the usual w->priv.window; the others hold web views related to
+ * w->priv.webview, so they share its web process, user scripts, URI schemes
+ * and invoke handler. Native data providers stay one per process, and
+ * webview_eval() runs on every surface, so they all see the same updates
+ * (and the same replies). The page finds its monitor in
+ * window.external.surface, refreshed with a 'surfacechange' event. */
+struct webview_surface {
+  struct webview *w;
+  GdkMonitor *monitor; /* NULL once the last monitor is gone */
+  GtkWidget *window;
+  GtkWidget *webview;
+  int committed;       /* Its first load got that far */
+  int id;              /* 0 for the primary, then never reused */
+  WebKitUserContentManager *manager; /* Its own, NULL for the primary */
+};
+
+/* Hidden mode. Each window keeps what X last said of it, as object data; its
+ * page is paused while any of these holds, the timers once every window's
+ * is. Until told otherwise a window counts as shown. */
+#define WEBVIEW_HIDDEN_COVERED (1 << 0)
+#define WEBVIEW_HIDDEN_MINIMIZED (1 << 1)
+#define WEBVIEW_HIDDEN_UNMAPPED (1 << 2)
+
+static int webview_window_hidden(GtkWidget *window) {
+  return GPOINTER_TO_INT(g_object_get_data(G_OBJECT(window), "webview-hidden"));
+}
+
+static void webview_update_hidden(struct webview *w) {
+  int hidden = webview_window_hidden(w->priv.window) != 0;
+  for (guint i = 1; hidden && w->priv.surfaces != NULL &&
+                    i < w->priv.surfaces->len;
+       i++) {
+    struct webview_surface *s =
+        (struct webview_surface *)g_ptr_array_index(w->priv.surfaces, i);
+    hidden = webview_window_hidden(s->window) != 0;
+  }
+  if (hidden == w->priv.hidden) {
+    return;
+  }
+  w->priv.hidden = hidden;
+  w->priv.hidden_gen++; /* The timers take their new pace from it */
+  webview_debug("webview: %s", hidden ? "hidden" : "shown");
+  if (webview_hidden != NULL) {
+    webview_hidden(w, hidden, webview_hidden_arg);
+  }
+}
+
+static gboolean webview_visibility_cb(GtkWidget *window, GdkEvent *event,
+                                      gpointer arg) {
+  struct webview *w = (struct webview *)arg;
+  int was = webview_window_hidden(window), now = was;
+  switch (event->type) {
+  case GDK_VISIBILITY_NOTIFY:
+    now = event->visibility.state == GDK_VISIBILITY_FULLY_OBSCURED
+              ? now | WEBVIEW_HIDDEN_COVERED
+              : now & ~WEBVIEW_HIDDEN_COVERED;
+    break;
+  case GDK_WINDOW_STATE:
+    now = event->window_state.new_window_state & GDK_WINDOW_STATE_ICONIFIED
+              ? now | WEBVIEW_HIDDEN_MINIMIZED
+              : now & ~WEBVIEW_HIDDEN_MINIMIZED;
+    break;
+  case GDK_MAP:
+    now &= ~WEBVIEW_HIDDEN_UNMAPPED;
+    break;
+  case GDK_UNMAP:
+    now |= WEBVIEW_HIDDEN_UNMAPPED;
+    break;
+  default:
+    break;
+  }
+  g_object_set_data(G_OBJECT(window), "webview-hidden", GINT_TO_POINTER(now));
+  if ((now != 0) != (was != 0)) {
+    // The window's own page, window > scroller > web view
+    GtkWidget *view = gtk_bin_get_child(GTK_BIN(window));
+    view = view != NULL ? gtk_bin_get_child(GTK_BIN(view)) : NULL;
+    if (view != NULL) {
+      webkit_web_view_run_javascript(
+          WEBKIT_WEB_VIEW(view),
+          now != 0 ? "window.__hostvisibility&&window.__hostvisibility(true)"
+                   : "window.__hostvisibility&&window.__hostvisibility(false)",
+          NULL, NULL, NULL);
+    }
+  }
+  webview_update_hidden(w);
+  return FALSE;
+}
+
+static void webview_watch_visibility(struct webview *w, GtkWidget *window) {
+  if (w->hidden_interval_ms <= 0 || w->headless) {
+    return;
+  }
+  gtk_widget_add_events(window,
+                        GDK_VISIBILITY_NOTIFY_MASK | GDK_STRUCTURE_MASK);
+  g_signal_connect(G_OBJECT(window), "visibility-notify-event",
+                   G_CALLBACK(webview_visibility_cb), w);
+  g_signal_connect(G_OBJECT(window), "window-state-event",
+                   G_CALLBACK(webview_visibility_cb), w);
+  g_signal_connect(G_OBJECT(window), "map-event",
+                   G_CALLBACK(webview_visibility_cb), w);
+  g_signal_connect(G_OBJECT(window), "unmap-event",
+                   G_CALLBACK(webview_visibility_cb), w);
+}
+
+static void webview_surface_announce(struct webview_surface *s) {
+  GdkRectangle g;
+  char js[256];
+  int index = 0;
+  if (s->monitor == NULL) {
+    return;
+  }
+  GdkDisplay *display = gdk_monitor_get_display(s->monitor);
+  while (index < gdk_display_get_n_monitors(display) &&
+         gdk_display_get_monitor(display, index) != s->monitor) {
+    index++;
+  }
+  gdk_monitor_get_geometry(s->monitor, &g);
+  snprintf(js, sizeof(js),
+           "window.external.surface={index:%d,primary:%s,x:%d,y:%d,width:%d,"
+           "height:%d,scale:%d};window.dispatchEvent(new Event("
+           "'surfacechange'))",
+           index, gdk_monitor_is_primary(s->monitor) ? "true" : "false", g.x,
+           g.y, g.width, g.height, gdk_monitor_get_scale_factor(s->monitor));
+  webkit_web_view_run_javascript(WEBKIT_WEB_VIEW(s->webview), js, NULL, NULL,
+                                 NULL);
+}
+
+/* Geometry is in application pixels: GTK applies the monitor's scale */
+static void webview_surface_place(struct webview_surface *s) {
+  if (s->monitor == NULL) {
+    return;
+  }
+  webview_place_window(s->w, s->window, s->monitor);
+  webview_surface_announce(s);
+}
+
+static void webview_surface_monitor_cb(GObject *monitor, GParamSpec *pspec,
+                                       gpointer arg) {
+  (void)monitor;
+  (void)pspec;
+  webview_surface_place((struct webview_surface *)arg);
+}
+
+static void webview_surface_set_monitor(struct webview_surface *s,
+                                        GdkMonitor *monitor) {
+  if (s->monitor != NULL) {
+    g_signal_handlers_disconnect_by_data(s->monitor, s);
+    g_object_unref(s->monitor);
+  }
+  s->monitor = monitor;
+  if (monitor != NULL) {
+    g_object_ref(monitor);
+    g_signal_connect(monitor, "notify::geometry",
+                     G_CALLBACK(webview_surface_monitor_cb), s);
+    g_signal_connect(monitor, "notify::scale-factor",
+                     G_CALLBACK(webview_surface_monitor_cb), s);
+    webview_surface_place(s);
+  }
+}
+
+static void webview_surface_load_cb(WebKitWebView *webview,
+                                    WebKitLoadEvent event, gpointer arg) {
+  (void)webview;
+  struct webview_surface *s = (struct webview_surface *)arg;
+  if (event == WEBKIT_LOAD_COMMITTED && !s->committed) {
+    s->committed = 1;
+    webview_once_committed(s->w);
+  }
+  if (event == WEBKIT_LOAD_FINISHED) {
+    webview_surface_announce(s);
+  }
+}
+
+static void webview_surface_setup_window(struct webview *w, GtkWidget *window) {
+  gtk_window_set_title(GTK_WINDOW(window), w->title);
+  webview_apply_window_hints(w, window, 1);
+}
+
+static void webview_surface_free(struct webview_surface *s) {
+  webview_surface_set_monitor(s, NULL);
+  if (s->manager != NULL) {
+    g_signal_handlers_disconnect_by_data(s->manager, s);
+    g_object_unref(s->manager);
+  }
+  g_free(s);
+}
+
+/* The surface's own handler: the message is the same, but now it is known
+ * whose it is */
+static void webview_surface_message_cb(WebKitUserContentManager *m,
+                                       WebKitJavascriptResult *r,
+                                       gpointer arg) {
+  struct webview_surface *s = (struct webview_surface *)arg;
+  s->w->priv.message_surface = s->id;
+  external_message_received_cb(m, r, s->w);
+  s->w->priv.message_surface = 0;
+}
+
+/* Secondary windows may be closed from outside: forget them when they go */
+static void webview_surface_destroy_cb(GtkWidget *widget, gpointer arg) {
+  (void)widget;
+  struct webview_surface *s = (struct webview_surface *)arg;
+  if (s->w->priv.surfaces != NULL) {
+    g_ptr_array_remove(s->w->priv.surfaces, s);
+    webview_update_hidden(s->w);
+  }
+  // Gone before its first commit: the others don't wait for it
+  if (!s->committed) {
+    webview_once_committed(s->w);
+  }
+  webview_surface_free(s);
+}
+
+/* Secondary surfaces just reload: the page state lives in the primary one */
+static void webview_surface_terminated_cb(
+    WebKitWebView *webview, WebKitWebProcessTerminationReason reason,
+    gpointer arg) {
+  (void)reason;
+  (void)arg;
+  webkit_web_view_reload(webview);
+}
+
+static void webview_surface_new(struct webview *w, GdkMonitor *monitor) {
+  struct webview_surface *s = g_new0(struct webview_surface, 1);
+  GdkRGBA color;
+  s->w = w;
+  s->window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+  webview_surface_setup_window(w, s->window);
+  gtk_widget_set_app_paintable(s->window, TRUE);
+  g_signal_connect(G_OBJECT(s->window), "draw", G_CALLBACK(draw), NULL);
+  g_signal_connect(G_OBJECT(s->window), "screen-changed",
+                   G_CALLBACK(screen_changed), w);
+  screen_changed(s->window, NULL, w);
+  webview_watch_visibility(w, s->window);
+
+  GtkWidget *scroller = gtk_scrolled_window_new(NULL, NULL);
+  gtk_container_add(GTK_CONTAINER(s->window), scroller);
+  // As webkit_web_view_new_with_related_view(), but with a content manager
+  // of its own, so that its messages say where they come from
+  s->id = ++w->priv.surface_ids;
+  s->manager = webkit_user_content_manager_new();
+  webkit_user_content_manager_register_script_message_handler(s->manager,
+                                                              "external");
+  g_signal_connect(s->manager, "script-message-received::external",
+                   G_CALLBACK(webview_surface_message_cb), s);
+  for (guint i = 0; w->priv.init_scripts != NULL &&
+                    i < w->priv.init_scripts->len; i++) {
+    webkit_user_content_manager_add_script(
+        s->manager,
+        (WebKitUserScript *)g_ptr_array_index(w->priv.init_scripts, i));
+  }
+  s->webview = GTK_WIDGET(g_object_new(
+      WEBKIT_TYPE_WEB_VIEW, "user-content-manager", s->manager, "settings",
+      webkit_web_view_get_settings(WEBKIT_WEB_VIEW(w->priv.webview)),
+      "related-view", w->priv.webview, NULL));
+  webkit_web_view_get_background_color(WEBKIT_WEB_VIEW(w->priv.webview),
+                                       &color);
+  webkit_web_view_set_background_color(WEBKIT_WEB_VIEW(s->webview), &color);
+  webkit_web_view_set_zoom_level(
+      WEBKIT_WEB_VIEW(s->webview),
+      webkit_web_view_get_zoom_level(WEBKIT_WEB_VIEW(w->priv.webview)));
+  if (!w->debug) {
+    g_signal_connect(G_OBJECT(s->webview), "context-menu",
+                     G_CALLBACK(webview_context_menu_cb), w);
+  }
+  g_signal_connect(G_OBJECT(s->webview), "load-changed",
+                   G_CALLBACK(webview_surface_load_cb), s);
+  // It loads with the scripts for the first load only, if still there
+  w->priv.once_pending += w->priv.once_scripts != NULL;
+  g_signal_connect(G_OBJECT(s->webview), "web-process-terminated",
+                   G_CALLBACK(webview_surface_terminated_cb), NULL);
+  gtk_container_add(GTK_CONTAINER(scroller), s->webview);
+  webkit_web_view_load_uri(
+      WEBKIT_WEB_VIEW(s->webview),
+      webview_check_url(webkit_web_view_get_uri(WEBKIT_WEB_VIEW(w->priv.webview))));
+
+  g_ptr_array_add(w->priv.surfaces, s);
+  webview_surface_set_monitor(s, monitor);
+  g_signal_connect(G_OBJECT(s->window), "destroy",
+                   G_CALLBACK(webview_surface_destroy_cb), s);
+  gtk_widget_show_all(s->window);
+}
+
+static void webview_monitor_added_cb(GdkDisplay *display, GdkMonitor *monitor,
+                                     gpointer arg) {
+  (void)display;
+  struct webview *w = (struct webview *)arg;
+  struct webview_surface *primary =
+      (struct webview_surface *)g_ptr_array_index(w->priv.surfaces, 0);
+  if (primary->monitor == NULL) {
+    webview_surface_set_monitor(primary, monitor);
+  } else {
+    webview_surface_new(w, monitor);
+  }
+}
+
+static void webview_monitor_removed_cb(GdkDisplay *display, GdkMonitor *monitor,
+                                       gpointer arg) {
+  (void)display;
+  struct webview *w = (struct webview *)arg;
+  GPtrArray *surfaces = w->priv.surfaces;
+  for (guint i = 0; i < surfaces->len; i++) {
+    struct webview_surface *s =
+        (struct webview_surface *)g_ptr_array_index(surfaces, i);
+    if (s->monitor != monitor) {
+      continue;
+    }
+    if (i > 0) {
+      gtk_widget_destroy(s->window);
+    } else if (surfaces->len > 1) {
+      // The primary window holds the page everything else is related to:
+      // it takes over the next monitor, whose own surface goes away
+      struct webview_surface *next =
+          (struct webview_surface *)g_ptr_array_index(surfaces, 1);
+      GdkMonitor *m = (GdkMonitor *)g_object_ref(next->monitor);
+      gtk_widget_destroy(next->window);
+      webview_surface_set_monitor(s, m);
+      g_object_unref(m);
+    } else {
+      webview_surface_set_monitor(s, NULL);
+    }
+    return;
+  }
+}
+
+static void webview_surfaces_init(struct webview *w) {
+  GdkDisplay *display = gtk_widget_get_display(w->priv.window);
+  struct webview_surface *primary = g_new0(struct webview_surface, 1);
+  primary->w = w;
+  primary->window = w->priv.window;
+  primary->webview = w->priv.webview;
+  w->priv.surfaces = g_ptr_array_new();
+  g_ptr_array_add(w->priv.surfaces, primary);
+  webview_surface_setup_window(w, w->priv.window);
+  g_signal_connect(G_OBJECT(w->priv.webview), "load-changed",
+                   G_CALLBACK(webview_surface_load_cb), primary);
+  for (int i = 0; i < gdk_display_get_n_monitors(display); i++) {
+    GdkMonitor *monitor = gdk_display_get_monitor(display, i);
+    if (i == 0) {
+      webview_surface_set_monitor(primary, monitor);
+    } else {
+      webview_surface_new(w, monitor);
+    }
+  }
+  g_signal_connect(display, "monitor-added",
+                   G_CALLBACK(webview_monitor_added_cb), w);
+  g_signal_connect(display, "monitor-removed",
+                   G_CALLBACK(webview_monitor_removed_cb), w);
+}
+
+static void webview_surfaces_free(struct webview *w) {
+  GPtrArray *surfaces = w->priv.surfaces;
+  if (surfaces == NULL) {
+    return;
+  }
+  g_signal_handlers_disconnect_by_data(gtk_widget_get_display(w->priv.window),
+                                       w);
+  w->priv.surfaces = NULL;
+  for (guint i = 1; i < surfaces->len; i++) {
+    struct webview_surface *s =
+        (struct webview_surface *)g_ptr_array_index(surfaces, i);
+    g_signal_handlers_disconnect_by_data(s->window, s);
+    gtk_widget_destroy(s->window);
+    webview_surface_free(s);
+  }
+  g_signal_handlers_disconnect_by_data(w->priv.webview,
+                                       g_ptr_array_index(surfaces, 0));
+  webview_surface_free((struct webview_surface *)g_ptr_array_index(surfaces, 0));
+  g_ptr_array_free(surfaces, TRUE);
+}
+// ------------ END ADDED CODE ----------------- //
+
+// ------------ ADDED CODE ----------------- //
+/* Crash recovery. A terminated web process leaves a blank window: load the
+ * page again, into the standby view when there is one. Its process was
+ * started ahead of time on about:blank, so recovering costs the page load
+ * and not the process start. A page that keeps crashing is retried with a
+ * growing delay, up to 30 s. */
+static void webview_web_process_terminated_cb(
+    WebKitWebView *webview, WebKitWebProcessTerminationReason reason,
+    gpointer arg);
+
+static void webview_standby_free(struct webview *w) {
+  if (w->priv.standby != NULL) {
+    g_signal_handlers_disconnect_by_data(w->priv.standby, w);
+    gtk_widget_destroy(w->priv.standby);
+    g_object_unref(w->priv.standby);
+    w->priv.standby = NULL;
+  }
+}
+
+static gboolean webview_standby_spawn_cb(gpointer arg);
+
+static void webview_standby_schedule(struct webview *w, guint delay_ms) {
+  if (w->standby && !w->headless && w->priv.standby == NULL &&
+      w->priv.standby_source == 0) {
+    w->priv.standby_source = g_timeout_add_full(
+        G_PRIORITY_LOW, delay_ms, webview_standby_spawn_cb, w, NULL);
+  }
+}
+
+static void webview_standby_terminated_cb(
+    WebKitWebView *webview, WebKitWebProcessTerminationReason reason,
+    gpointer arg) {
+  (void)webview;
+  (void)reason;
+  struct webview *w = (struct webview *)arg;
+  webview_debug("standby web process terminated");
+  webview_standby_free(w);
+  webview_standby_schedule(w, 5000);
+}
+
+static gboolean webview_standby_spawn_cb(gpointer arg) {
+  struct webview *w = (struct webview *)arg;
+  WebKitWebView *page = WEBKIT_WEB_VIEW(w->priv.webview);
+  w->priv.standby_source = 0;
+  // Same content manager: same init scripts and invoke handler
+  w->priv.standby = webkit_web_view_new_with_user_content_manager(
+      webkit_web_view_get_user_content_manager(page));
+  g_object_ref_sink(w->priv.standby);
+  webkit_web_view_set_settings(WEBKIT_WEB_VIEW(w->priv.standby),
+                               webkit_web_view_get_settings(page));
+  g_signal_connect(G_OBJECT(w->priv.standby), "web-process-terminated",
+                   G_CALLBACK(webview_standby_terminated_cb), w);
+  webkit_web_view_load_uri(WEBKIT_WEB_VIEW(w->priv.standby), "about:blank");
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean webview_recover_cb(gpointer arg) {
+  struct webview *w = (struct webview *)arg;
+  GtkWidget *dead = w->priv.webview;
+  GtkWidget *view = w->priv.standby;
+  gchar *uri = g_strdup(
+      webview_check_url(webkit_web_view_get_uri(WEBKIT_WEB_VIEW(dead))));
+  GdkRGBA color;
+  w->priv.recover_source = 0;
+  if (view == NULL) {
+    // WebKit starts a new process for the same view
+    webkit_web_view_load_uri(WEBKIT_WEB_VIEW(dead), uri);
+    g_free(uri);
+    return G_SOURCE_REMOVE;
+  }
+
+  w->priv.standby = NULL;
+  g_signal_handlers_disconnect_by_data(view, w);
+  webkit_web_view_get_background_color(WEBKIT_WEB_VIEW(dead), &color);
+  webkit_web_view_set_background_color(WEBKIT_WEB_VIEW(view), &color);
+  webkit_web_view_set_zoom_level(
+      WEBKIT_WEB_VIEW(view),
+      webkit_web_view_get_zoom_level(WEBKIT_WEB_VIEW(dead)));
+  g_signal_connect(G_OBJECT(view), "load-changed",
+                   G_CALLBACK(webview_load_changed_cb), w);
+  g_signal_connect(G_OBJECT(view), "web-process-terminated",
+                   G_CALLBACK(webview_web_process_terminated_cb), w);
+  if (!w->debug) {
+    g_signal_connect(G_OBJECT(view), "context-menu",
+                     G_CALLBACK(webview_context_menu_cb), w);
+  }
+  if (w->priv.surfaces != NULL) {
+    struct webview_surface *primary =
+        (struct webview_surface *)g_ptr_array_index(w->priv.surfaces, 0);
+    g_signal_handlers_disconnect_by_data(dead, primary);
+    primary->webview = view;
+    g_signal_connect(G_OBJECT(view), "load-changed",
+                     G_CALLBACK(webview_surface_load_cb), primary);
+  }
+  gtk_container_remove(GTK_CONTAINER(w->priv.scroller), dead);
+  gtk_container_add(GTK_CONTAINER(w->priv.scroller), view);
+  g_object_unref(view); /* The scroller holds it now */
+  w->priv.webview = view;
+  gtk_widget_show(view);
+  webkit_web_view_load_uri(WEBKIT_WEB_VIEW(view), uri);
+  g_free(uri);
+  webview_standby_schedule(w, 1000);
+  return G_SOURCE_REMOVE;
+}
+
+static void webview_web_process_terminated_cb(
+    WebKitWebView *webview, WebKitWebProcessTerminationReason reason,
+    gpointer arg) {
+  (void)webview;
+  struct webview *w = (struct webview *)arg;
+  gint64 now = g_get_monotonic_time();
+  webview_debug("web process terminated (%s), reloading",
+                reason == WEBKIT_WEB_PROCESS_EXCEEDED_MEMORY_LIMIT
+                    ? "memory limit"
+                    : "crash");
+  w->priv.ready = 0;
+  w->priv.recovering = reason + 1;
+  if (now - w->priv.crash_us < 10 * G_USEC_PER_SEC) {
+    w->priv.crash_delay_ms = w->priv.crash_delay_ms > 0
+                                 ? MIN(w->priv.crash_delay_ms * 2, 30000)
+                                 : 250;
+  } else {
+    w->priv.crash_delay_ms = 0;
+  }
+  w->priv.crash_us = now;
+  // Not from inside the dead view's own signal: it is about to go
+  if (w->priv.recover_source == 0) {
+    w->priv.recover_source = g_timeout_add_full(
+        G_PRIORITY_HIGH_IDLE, w->priv.crash_delay_ms, webview_recover_cb, w,
+        NULL);
+  }
+}
+// ------------ END ADDED CODE ----------------- //
+
+// ------------ ADDED CODE ----------------- //
+/* Loads the page through the saved session, if it is a session of this page:
+ * history, scroll position and form data come back with it */
+static int webview_restore_session_state(struct webview *w) {
+  WebKitWebView *view = WEBKIT_WEB_VIEW(w->priv.webview);
+  if (w->session_state == NULL || w->session_state_len == 0) {
+    return -1;
+  }
+  GBytes *bytes = g_bytes_new(w->session_state, w->session_state_len);
+  WebKitWebViewSessionState *state = webkit_web_view_session_state_new(bytes);
+  g_bytes_unref(bytes);
+  if (state == NULL) {
+    return -1;
+  }
+  webkit_web_view_restore_session_state(view, state);
+  webkit_web_view_session_state_unref(state);
+  WebKitBackForwardListItem *item = webkit_back_forward_list_get_current_item(
+      webkit_web_view_get_back_forward_list(view));
+  if (item == NULL ||
+      strcmp(webkit_back_forward_list_item_get_original_uri(item),
+             webview_check_url(w->url)) != 0) {
+    return -1;
+  }
+  webkit_web_view_go_to_back_forward_list_item(view, item);
+  return 0;
+}
+// ------------ END ADDED CODE ----------------- //
+
 WEBVIEW_API int webview_init(struct webview *w) {
+  // ------------ ADDED CODE ----------------- //
+  webview_parse_render(w);
+  // ------------ END ADDED CODE ----------------- //
   if (gtk_init_check(0, NULL) == FALSE) {
     return -1;
   }
@@ -282,10 +1408,28 @@ WEBVIEW_API int webview_init(struct webview *w) {
   w->priv.ready = 0;
   w->priv.should_exit = 0;
   w->priv.queue = g_async_queue_new();
-  w->priv.window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+  // ------------ ADDED CODE ----------------- //
+  w->priv.wakeups = 0;
+  w->priv.wakeups_per_sec = 0;
+  w->priv.wakeup_window_us = g_get_monotonic_time();
+  webview_wakeup_owner = w;
+  if (webview_default_poll == NULL) {
+    webview_default_poll = g_main_context_get_poll_func(NULL);
+    g_main_context_set_poll_func(NULL, webview_counting_poll);
+  }
+  // ------------ END ADDED CODE ----------------- //
+  // ------------ ADDED CODE ----------------- //
+  // Headless mode renders into an offscreen window: no compositor, no WM,
+  // works on a bare Xvfb.
+  if (w->headless) {
+    w->priv.window = gtk_offscreen_window_new();
+  } else {
+    w->priv.window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+  }
+  // ------------ END ADDED CODE ----------------- //
   gtk_window_set_title(GTK_WINDOW(w->priv.window), w->title);
   
-  if (w->resizable) {
+  if (w->resizable && !w->headless) {
     gtk_window_set_default_size(GTK_WINDOW(w->priv.window), w->width,
                                 w->height);
   } else {
@@ -297,14 +1441,26 @@ WEBVIEW_API int webview_init(struct webview *w) {
   w->priv.scroller = gtk_scrolled_window_new(NULL, NULL);
   gtk_container_add(GTK_CONTAINER(w->priv.window), w->priv.scroller);
 
+  // ------------ ADDED CODE ----------------- //
+  // The standby needs a web process of its own, or it dies with the page
+  if (w->standby && !w->headless) {
+    webkit_web_context_set_process_model(
+        webkit_web_context_get_default(),
+        WEBKIT_PROCESS_MODEL_MULTIPLE_SECONDARY_PROCESSES);
+  }
+  // ------------ END ADDED CODE ----------------- //
   WebKitUserContentManager *m = webkit_user_content_manager_new();
   webkit_user_content_manager_register_script_message_handler(m, "external");
   g_signal_connect(m, "script-message-received::external",
                    G_CALLBACK(external_message_received_cb), w);
 
   w->priv.webview = webkit_web_view_new_with_user_content_manager(m);
-  webkit_web_view_load_uri(WEBKIT_WEB_VIEW(w->priv.webview),
-                           webview_check_url(w->url));
+  // ------------ ADDED CODE ----------------- //
+  if (webview_restore_session_state(w) != 0) {
+    webkit_web_view_load_uri(WEBKIT_WEB_VIEW(w->priv.webview),
+                             webview_check_url(w->url));
+  }
+  // ------------ END ADDED CODE ----------------- //
   g_signal_connect(G_OBJECT(w->priv.webview), "load-changed",
                    G_CALLBACK(webview_load_changed_cb), w);
   gtk_container_add(GTK_CONTAINER(w->priv.scroller), w->priv.webview);
@@ -320,22 +1476,80 @@ WEBVIEW_API int webview_init(struct webview *w) {
   }
 
   // ------------ ADDED CODE ----------------- //
-  // Make it "fullscreen" (maximized with no bar) and behind, on all desktops
-  gtk_window_set_hide_titlebar_when_maximized(GTK_WINDOW(w->priv.window), TRUE);
-  gtk_window_maximize(GTK_WINDOW(w->priv.window));
-  gtk_window_set_keep_below(GTK_WINDOW(w->priv.window), TRUE);
-  gtk_window_get_skip_taskbar_hint(GTK_WINDOW(w->priv.window));
-  gtk_window_stick(GTK_WINDOW(w->priv.window));
+  if (w->zoom > 0) {
+    webkit_web_view_set_zoom_level(WEBKIT_WEB_VIEW(w->priv.webview), w->zoom);
+  }
+  if (w->idle_slack_ms > 0) {
+    char js[sizeof(IDLE_TIMERS_FUNCTION) + 16];
+    snprintf(js, sizeof(js), "%s(%d)", IDLE_TIMERS_FUNCTION, w->idle_slack_ms);
+    webview_add_init_script(w, js);
+  }
+  if (w->hidden_interval_ms > 0 && !w->headless) {
+    webview_add_init_script(w, HOST_VISIBILITY_FUNCTION);
+  }
+  if (w->headless) {
+    // CI boxes have no GPU: keep the output deterministic and software-only
+    WebKitSettings *settings =
+        webkit_web_view_get_settings(WEBKIT_WEB_VIEW(w->priv.webview));
+    webkit_settings_set_hardware_acceleration_policy(
+        settings, WEBKIT_HARDWARE_ACCELERATION_POLICY_NEVER);
+  } else if (w->priv.accel >= 0) {
+    // Surfaces and the standby share these settings
+    WebKitSettings *settings =
+        webkit_web_view_get_settings(WEBKIT_WEB_VIEW(w->priv.webview));
+    webkit_settings_set_hardware_acceleration_policy(
+        settings, (WebKitHardwareAccelerationPolicy)w->priv.accel);
+  }
+  if (!w->headless && !w->per_monitor) { // per_monitor: webview_surfaces_init()
+    // Its role for the window manager, before it is mapped: by default
+    // "fullscreen" (maximized with no bar) and behind, on all desktops
+    webview_parse_window_hints(w);
+    webview_apply_window_hints(w, w->priv.window,
+                               w->priv.strut_edge != WEBVIEW_STRUT_NONE);
+  }
   
   // Needed to achieve transparency in GTK3
-  gtk_widget_set_app_paintable(GTK_WINDOW(w->priv.window), 1);
-  gtk_widget_set_opacity(GTK_WINDOW(w->priv.window), 1);
-
+  gtk_widget_set_app_paintable(GTK_WIDGET(w->priv.window), 1);
+  gtk_widget_set_opacity(GTK_WIDGET(w->priv.window), 1);
+
+  // Frame timing brackets the whole window paint, transparent background
+  // included: begin runs before draw(), end after the default handler.
+  w->priv.frames = 0;
+  w->priv.frame_min_us = G_MAXINT64;
+  w->priv.frame_max_us = w->priv.frame_last_us = w->priv.frame_total_us = 0;
+  w->priv.frame_log = NULL;
+  if (w->frame_log != NULL) {
+    w->priv.frame_log = fopen(w->frame_log, "w");
+    if (w->priv.frame_log != NULL) {
+      fprintf(w->priv.frame_log, "frame,start_us,paint_us\n");
+    }
+  }
+  g_signal_connect(G_OBJECT(w->priv.window), "draw",
+                   G_CALLBACK(webview_frame_begin_cb), w);
   g_signal_connect(G_OBJECT(w->priv.window), "draw", G_CALLBACK(draw), NULL);
-  g_signal_connect(G_OBJECT(w->priv.window), "screen-changed", G_CALLBACK(screen_changed), NULL);
+  g_signal_connect_after(G_OBJECT(w->priv.window), "draw",
+                         G_CALLBACK(webview_frame_end_cb), w);
+  g_signal_connect(G_OBJECT(w->priv.window), "screen-changed", G_CALLBACK(screen_changed), w);
+  webview_watch_visibility(w, w->priv.window);
   // ------------ END ADDED CODE ----------------- //
 
-  screen_changed(G_OBJECT(w->priv.window), NULL, NULL);
+  screen_changed(GTK_WIDGET(w->priv.window), NULL, w);
+  // ------------ ADDED CODE ----------------- //
+  w->priv.surfaces = NULL;
+  if (w->per_monitor && !w->headless) {
+    webview_parse_window_hints(w);
+    webview_surfaces_init(w);
+  } else if (!w->headless && w->priv.strut_edge != WEBVIEW_STRUT_NONE) {
+    GdkDisplay *display = gtk_widget_get_display(w->priv.window);
+    GdkMonitor *monitor = gdk_display_get_primary_monitor(display);
+    if (monitor == NULL) {
+      monitor = gdk_display_get_monitor(display, 0);
+    }
+    if (monitor != NULL) {
+      webview_place_window(w, w->priv.window, monitor);
+    }
+  }
+  // ------------ END ADDED CODE ----------------- //
   gtk_widget_show_all(w->priv.window);
   
   
@@ -388,14 +1602,28 @@ WEBVIEW_API int webview_init(struct webview *w) {
   
   // -------------- END ADDED CODE --------------//
   
+  // ----------- ADDED CODE -----------------------//
+  // Also at document start, so that page scripts can already use it and hang
+  // their own handlers (oncapture...) on window.external
+  webview_add_init_script(w, EXTERNAL_INVOKE_FUNCTION);
+  // -------------- END ADDED CODE --------------//
   webkit_web_view_run_javascript(
-      WEBKIT_WEB_VIEW(w->priv.webview),
-      "window.external={invoke:function(x){"
-      "window.webkit.messageHandlers.external.postMessage(x);}}",
+      WEBKIT_WEB_VIEW(w->priv.webview), EXTERNAL_INVOKE_FUNCTION,
       NULL, NULL, NULL);
 
   g_signal_connect(G_OBJECT(w->priv.window), "destroy",
                    G_CALLBACK(webview_destroy_cb), w);
+  // ------------ ADDED CODE ----------------- //
+  w->priv.standby = NULL;
+  w->priv.standby_source = w->priv.recover_source = 0;
+  w->priv.recovering = 0;
+  w->priv.crash_us = 0;
+  w->priv.crash_delay_ms = 0;
+  g_signal_connect(G_OBJECT(w->priv.webview), "web-process-terminated",
+                   G_CALLBACK(webview_web_process_terminated_cb), w);
+  // Once the page is up: the spare process must not slow down its start
+  webview_standby_schedule(w, 3000);
+  // ------------ END ADDED CODE ----------------- //
   return 0;
 }
 
@@ -406,7 +1634,31 @@ static void screen_changed(GtkWidget *widget, GdkScreen *old_screen, gpointer us
     /* To check if the display supports alpha channels, get the visual */
     GdkScreen *screen = gtk_widget_get_screen(widget);
     GdkVisual *visual = gdk_screen_get_rgba_visual(screen);
-    if (!visual)
+    // ------------ ADDED CODE ----------------- //
+    struct webview *w = (struct webview *)userdata;
+    int opaque = w != NULL ? w->priv.opaque : WEBVIEW_OPAQUE_NEVER;
+    int headless = w != NULL && w->headless;
+    /* An offscreen window paints into an ARGB surface of its own, composited
+     * or not: keep its transparency for the snapshots */
+    if (headless && opaque != WEBVIEW_OPAQUE_ALWAYS)
+    {
+        if (!visual)
+        {
+            visual = gdk_screen_get_system_visual(screen);
+        }
+        supports_alpha = TRUE;
+    }
+    /* Without a compositor an ARGB window only shows black where it is
+     * transparent: an opaque one is both right and cheaper */
+    else if (opaque == WEBVIEW_OPAQUE_ALWAYS ||
+             (opaque == WEBVIEW_OPAQUE_AUTO && !gdk_screen_is_composited(screen)))
+    {
+        webview_debug("webview: no compositor or opaque=always, opaque window");
+        visual = gdk_screen_get_system_visual(screen);
+        supports_alpha = FALSE;
+    }
+    // ------------ END ADDED CODE ----------------- //
+    else if (!visual)
     {
         printf("Your screen does not support alpha channels!\n");
         visual = gdk_screen_get_system_visual(screen);
@@ -442,9 +1694,242 @@ static gboolean draw(GtkWidget *widget, cairo_t *cr, gpointer userdata)
 
 WEBVIEW_API int webview_loop(struct webview *w, int blocking) {
   gtk_main_iteration_do(blocking);
+  // ---------- ADDED CODE --------------------------//
+  gint64 now = g_get_monotonic_time();
+  gint64 elapsed = now - w->priv.wakeup_window_us;
+  if (elapsed >= 10 * G_USEC_PER_SEC) {
+    w->priv.wakeups_per_sec = w->priv.wakeups * (double)G_USEC_PER_SEC / elapsed;
+    w->priv.wakeups = 0;
+    w->priv.wakeup_window_us = now;
+    if (w->debug && w->idle_slack_ms > 0) {
+      webview_debug("idle: %.2f wakeups/s", w->priv.wakeups_per_sec);
+    }
+  }
+  // -------------- END ADDED CODE -------------------//
   return w->priv.should_exit;
 }
 
+// ---------- ADDED CODE --------------------------//
+/* Into the primary view's manager, the surfaces' and those still to come */
+static void webview_user_script_add(struct webview *w,
+                                    WebKitUserScript *script) {
+  webkit_user_content_manager_add_script(
+      webkit_web_view_get_user_content_manager(
+          WEBKIT_WEB_VIEW(w->priv.webview)),
+      script);
+  for (guint i = 1; w->priv.surfaces != NULL && i < w->priv.surfaces->len;
+       i++) {
+    struct webview_surface *s =
+        (struct webview_surface *)g_ptr_array_index(w->priv.surfaces, i);
+    webkit_user_content_manager_add_script(s->manager, script);
+  }
+  if (w->priv.init_scripts == NULL) {
+    w->priv.init_scripts =
+        g_ptr_array_new_with_free_func((GDestroyNotify)webkit_user_script_unref);
+  }
+  g_ptr_array_add(w->priv.init_scripts, webkit_user_script_ref(script));
+}
+
+static void webview_user_script_remove(struct webview *w,
+                                       WebKitUserScript *script) {
+  webkit_user_content_manager_remove_script(
+      webkit_web_view_get_user_content_manager(
+          WEBKIT_WEB_VIEW(w->priv.webview)),
+      script);
+  for (guint i = 1; w->priv.surfaces != NULL && i < w->priv.surfaces->len;
+       i++) {
+    struct webview_surface *s =
+        (struct webview_surface *)g_ptr_array_index(w->priv.surfaces, i);
+    webkit_user_content_manager_remove_script(s->manager, script);
+  }
+  g_ptr_array_remove(w->priv.init_scripts, script);
+}
+
+WEBVIEW_API void webview_add_init_script(struct webview *w, const char *js) {
+  WebKitUserScript *script = webkit_user_script_new(
+      js, WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+      WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START, NULL, NULL);
+  webview_user_script_add(w, script);
+  webkit_user_script_unref(script);
+}
+
+WEBVIEW_API void webview_add_init_script_once(struct webview *w,
+                                              const char *js) {
+  WebKitUserScript *script = webkit_user_script_new(
+      js, WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+      WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START, NULL, NULL);
+  if (w->priv.once_scripts == NULL) {
+    w->priv.once_scripts =
+        g_ptr_array_new_with_free_func((GDestroyNotify)webkit_user_script_unref);
+    // Every view loading now shares these scripts
+    w->priv.once_pending =
+        w->priv.surfaces != NULL ? (int)w->priv.surfaces->len : 1;
+  }
+  webview_user_script_add(w, script);
+  g_ptr_array_add(w->priv.once_scripts, script);
+}
+
+WEBVIEW_API int webview_invoke_surface(struct webview *w) {
+  return w->priv.invoke_surface;
+}
+
+WEBVIEW_API int webview_request_surface(struct webview *w,
+                                        WebKitURISchemeRequest *request) {
+  WebKitWebView *view = webkit_uri_scheme_request_get_web_view(request);
+  if (view == WEBKIT_WEB_VIEW(w->priv.webview)) {
+    return 0;
+  }
+  for (guint i = 1; w->priv.surfaces != NULL && i < w->priv.surfaces->len;
+       i++) {
+    struct webview_surface *s =
+        (struct webview_surface *)g_ptr_array_index(w->priv.surfaces, i);
+    if (view == WEBKIT_WEB_VIEW(s->webview)) {
+      return s->id;
+    }
+  }
+  return -1;
+}
+
+struct webview_timer {
+  GSource source;
+  struct webview *w;
+  int interval_ms;
+  int flags;
+  webview_timer_fn fn;
+  void *arg;
+  gint64 last_us;  /* Added or last run */
+  int hidden_gen;  /* Of the pace it is set to */
+};
+
+static gint64 webview_timer_deadline(struct webview_timer *t, gint64 now) {
+  int interval_ms = t->interval_ms;
+  if (t->w->priv.hidden && !(t->flags & WEBVIEW_TIMER_URGENT) &&
+      t->w->hidden_interval_ms > interval_ms) {
+    interval_ms = t->w->hidden_interval_ms;
+  }
+  gint64 deadline = now + (gint64)interval_ms * 1000;
+  if (t->w->idle_slack_ms > 0 && !(t->flags & WEBVIEW_TIMER_URGENT)) {
+    gint64 grid = (gint64)t->w->idle_slack_ms * 1000;
+    deadline = (deadline + grid - 1) / grid * grid;
+  }
+  return deadline;
+}
+
+static gboolean webview_timer_dispatch(GSource *source, GSourceFunc callback,
+                                       gpointer userdata) {
+  (void)callback;
+  (void)userdata;
+  struct webview_timer *t = (struct webview_timer *)source;
+  if (t->fn(t->w, t->arg) == 0) {
+    return G_SOURCE_REMOVE;
+  }
+  t->last_us = g_source_get_time(source);
+  g_source_set_ready_time(source, webview_timer_deadline(t, t->last_us));
+  return G_SOURCE_CONTINUE;
+}
+
+/* Hidden mode came or went: due again from the last run, at the new pace.
+ * On reveal, that is at once for the ones held back. */
+static gboolean webview_timer_prepare(GSource *source, gint *timeout) {
+  struct webview_timer *t = (struct webview_timer *)source;
+  *timeout = -1;
+  if (t->hidden_gen != t->w->priv.hidden_gen) {
+    t->hidden_gen = t->w->priv.hidden_gen;
+    g_source_set_ready_time(source, webview_timer_deadline(t, t->last_us));
+  }
+  return FALSE;
+}
+
+static GSourceFuncs webview_timer_funcs = {webview_timer_prepare, NULL,
+                                           webview_timer_dispatch, NULL};
+
+WEBVIEW_API unsigned int webview_timer_add(struct webview *w, int interval_ms,
+                                           int flags, webview_timer_fn fn,
+                                           void *arg) {
+  GSource *source = g_source_new(&webview_timer_funcs,
+                                 sizeof(struct webview_timer));
+  struct webview_timer *t = (struct webview_timer *)source;
+  t->w = w;
+  t->interval_ms = interval_ms;
+  t->flags = flags;
+  t->fn = fn;
+  t->arg = arg;
+  t->last_us = g_get_monotonic_time();
+  t->hidden_gen = w->priv.hidden_gen;
+  g_source_set_priority(source, (flags & WEBVIEW_TIMER_URGENT)
+                                    ? G_PRIORITY_DEFAULT
+                                    : G_PRIORITY_LOW);
+  g_source_set_ready_time(source, webview_timer_deadline(t, t->last_us));
+  unsigned int id = g_source_attach(source, NULL);
+  g_source_unref(source);
+  return id;
+}
+
+WEBVIEW_API void webview_timer_remove(struct webview *w, unsigned int id) {
+  (void)w;
+  GSource *source = g_main_context_find_source_by_id(NULL, id);
+  if (source != NULL) {
+    g_source_destroy(source);
+  }
+}
+
+WEBVIEW_API double webview_wakeups_per_sec(struct webview *w) {
+  return w->priv.wakeups_per_sec;
+}
+
+WEBVIEW_API void webview_set_trace(struct webview *w, webview_trace_fn fn,
+                                   void *arg) {
+  (void)w;
+  webview_trace = fn;
+  webview_trace_arg = arg;
+}
+
+WEBVIEW_API void webview_set_recover(struct webview *w, webview_recover_fn fn,
+                                     void *arg) {
+  (void)w;
+  webview_recover = fn;
+  webview_recover_arg = arg;
+}
+
+WEBVIEW_API void webview_set_log(webview_log_fn fn, void *arg) {
+  webview_log = fn;
+  webview_log_arg = arg;
+}
+
+WEBVIEW_API void webview_set_hidden(struct webview *w, webview_hidden_fn fn,
+                                    void *arg) {
+  (void)w;
+  webview_hidden = fn;
+  webview_hidden_arg = arg;
+}
+
+WEBVIEW_API int webview_is_hidden(struct webview *w) {
+  return w->priv.hidden;
+}
+
+WEBVIEW_API void *webview_get_session_state(struct webview *w, size_t *len) {
+  WebKitWebViewSessionState *state =
+      webkit_web_view_get_session_state(WEBKIT_WEB_VIEW(w->priv.webview));
+  GBytes *bytes = webkit_web_view_session_state_serialize(state);
+  gsize size = 0;
+  void *data = g_bytes_unref_to_data(bytes, &size);
+  webkit_web_view_session_state_unref(state);
+  *len = size;
+  return data;
+}
+
+WEBVIEW_API void webview_register_uri_scheme(struct webview *w,
+                                             const char *scheme,
+                                             WebKitURISchemeRequestCallback cb,
+                                             void *arg) {
+  WebKitWebContext *context =
+      webkit_web_view_get_context(WEBKIT_WEB_VIEW(w->priv.webview));
+  webkit_web_context_register_uri_scheme(context, scheme, cb, arg, NULL);
+  webkit_security_manager_register_uri_scheme_as_cors_enabled(
+      webkit_web_context_get_security_manager(context), scheme);
+}
+// -------------- END ADDED CODE -------------------//
+
 WEBVIEW_API void webview_set_title(struct webview *w, const char *title) {
   gtk_window_set_title(GTK_WINDOW(w->priv.window), title);
 }
@@ -460,8 +1945,22 @@ WEBVIEW_API void webview_set_fullscreen(struct webview *w, int fullscreen) {
 WEBVIEW_API void webview_set_color(struct webview *w, uint8_t r, uint8_t g,
                                    uint8_t b, uint8_t a) {
   GdkRGBA color = {r / 255.0, g / 255.0, b / 255.0, a / 255.0};
+  // ------------ ADDED CODE ----------------- //
+  // An opaque window cannot show through: what is transparent would be black
+  if (!supports_alpha) {
+    color.alpha = 1;
+  }
+  // ------------ END ADDED CODE ----------------- //
   webkit_web_view_set_background_color(WEBKIT_WEB_VIEW(w->priv.webview),
                                        &color);
+  // ------------ ADDED CODE ----------------- //
+  for (guint i = 1; w->priv.surfaces != NULL && i < w->priv.surfaces->len;
+       i++) {
+    struct webview_surface *s =
+        (struct webview_surface *)g_ptr_array_index(w->priv.surfaces, i);
+    webkit_web_view_set_background_color(WEBKIT_WEB_VIEW(s->webview), &color);
+  }
+  // ------------ END ADDED CODE ----------------- //
 }
 
 WEBVIEW_API void webview_dialog(struct webview *w,
@@ -522,20 +2021,36 @@ static void webview_eval_finished(GObject *object, GAsyncResult *result,
                                   gpointer userdata) {
   (void)object;
   (void)result;
-  struct webview *w = (struct webview *)userdata;
-  w->priv.js_busy = 0;
+  // ------------ ADDED CODE ----------------- //
+  (*(int *)userdata)--; /* Of its webview_eval() call, one per surface */
+  // ------------ END ADDED CODE ----------------- //
 }
 
 WEBVIEW_API int webview_eval(struct webview *w, const char *js) {
   while (w->priv.ready == 0) {
     g_main_context_iteration(NULL, TRUE);
   }
-  w->priv.js_busy = 1;
+  // ------------ ADDED CODE ----------------- //
+  if (webview_trace != NULL) {
+    webview_trace(w, WEBVIEW_TRACE_EVAL, js, NULL, webview_trace_arg);
+  }
+  // Each call counts its own: invokes, dispatches and timers run in the
+  // loop below, and an eval of theirs must not touch the outer one's count
+  int pending = 1;
   webkit_web_view_run_javascript(WEBKIT_WEB_VIEW(w->priv.webview), js, NULL,
-                                 webview_eval_finished, w);
-  while (w->priv.js_busy) {
+                                 webview_eval_finished, &pending);
+  for (guint i = 1; w->priv.surfaces != NULL && i < w->priv.surfaces->len;
+       i++) {
+    struct webview_surface *s =
+        (struct webview_surface *)g_ptr_array_index(w->priv.surfaces, i);
+    pending++;
+    webkit_web_view_run_javascript(WEBKIT_WEB_VIEW(s->webview), js, NULL,
+                                   webview_eval_finished, &pending);
+  }
+  while (pending > 0) {
     g_main_context_iteration(NULL, TRUE);
   }
+  // ------------ END ADDED CODE ----------------- //
   return 0;
 }
 
@@ -547,6 +2062,12 @@ static gboolean webview_dispatch_wrapper(gpointer userdata) {
     if (arg == NULL) {
       break;
     }
+    // ------------ ADDED CODE ----------------- //
+    if (webview_trace != NULL) {
+      webview_trace(w, WEBVIEW_TRACE_DISPATCH, NULL, arg->fn,
+                    webview_trace_arg);
+    }
+    // ------------ END ADDED CODE ----------------- //
     (arg->fn)(w, arg->arg);
     g_free(arg);
   }
@@ -572,11 +2093,106 @@ WEBVIEW_API void webview_terminate(struct webview *w) {
   w->priv.should_exit = 1;
 }
 
-WEBVIEW_API void webview_exit(struct webview *w) { (void)w; }
+WEBVIEW_API void webview_exit(struct webview *w) {
+  // ------------ ADDED CODE ----------------- //
+  if (w->priv.frame_log != NULL) {
+    fclose(w->priv.frame_log);
+    w->priv.frame_log = NULL;
+  }
+  webview_surfaces_free(w);
+  if (w->priv.once_scripts != NULL) {
+    g_ptr_array_unref(w->priv.once_scripts);
+    w->priv.once_scripts = NULL;
+  }
+  if (w->priv.init_scripts != NULL) {
+    g_ptr_array_unref(w->priv.init_scripts);
+    w->priv.init_scripts = NULL;
+  }
+  if (w->priv.standby_source != 0) {
+    g_source_remove(w->priv.standby_source);
+    w->priv.standby_source = 0;
+  }
+  if (w->priv.recover_source != 0) {
+    g_source_remove(w->priv.recover_source);
+    w->priv.recover_source = 0;
+  }
+  webview_standby_free(w);
+  // ------------ END ADDED CODE ----------------- //
+}
 WEBVIEW_API void webview_print_log(const char *s) {
+  // ------------ ADDED CODE ----------------- //
+  if (webview_log != NULL) {
+    webview_log(s, webview_log_arg);
+    return;
+  }
+  // ------------ END ADDED CODE ----------------- //
   fprintf(stderr, "%s\n", s);
 }
 
+// ---------- ADDED CODE --------------------------//
+struct webview_snapshot_arg {
+  const char *path;
+  int done;
+  int result;
+};
+
+static void webview_snapshot_finished(GObject *object, GAsyncResult *result,
+                                      gpointer userdata) {
+  struct webview_snapshot_arg *arg = (struct webview_snapshot_arg *)userdata;
+  cairo_surface_t *surface = webkit_web_view_get_snapshot_finish(
+      WEBKIT_WEB_VIEW(object), result, NULL);
+  arg->result = -1;
+  if (surface != NULL) {
+    if (cairo_surface_write_to_png(surface, arg->path) == CAIRO_STATUS_SUCCESS) {
+      arg->result = 0;
+    }
+    cairo_surface_destroy(surface);
+  }
+  arg->done = 1;
+}
+
+/* Writes the next painted frame to png_path. In headless mode this is the
+ * offscreen window itself, so the transparent draw() background is part of
+ * the image; otherwise WebKit renders the visible region for us. */
+WEBVIEW_API int webview_snapshot(struct webview *w, const char *png_path) {
+  while (w->priv.ready == 0) {
+    g_main_context_iteration(NULL, TRUE);
+  }
+  if (w->headless) {
+    int frame = w->priv.frames;
+    gtk_widget_queue_draw(w->priv.window);
+    while (w->priv.frames == frame) {
+      g_main_context_iteration(NULL, TRUE);
+    }
+    cairo_surface_t *surface =
+        gtk_offscreen_window_get_surface(GTK_OFFSCREEN_WINDOW(w->priv.window));
+    if (surface == NULL ||
+        cairo_surface_write_to_png(surface, png_path) != CAIRO_STATUS_SUCCESS) {
+      return -1;
+    }
+    return 0;
+  }
+  struct webview_snapshot_arg arg = {png_path, 0, -1};
+  webkit_web_view_get_snapshot(WEBKIT_WEB_VIEW(w->priv.webview),
+                               WEBKIT_SNAPSHOT_REGION_VISIBLE,
+                               WEBKIT_SNAPSHOT_OPTIONS_TRANSPARENT_BACKGROUND,
+                               NULL, webview_snapshot_finished, &arg);
+  while (!arg.done) {
+    g_main_context_iteration(NULL, TRUE);
+  }
+  return arg.result;
+}
+
+WEBVIEW_API void webview_frame_stats(struct webview *w,
+                                     struct webview_frame_stats *stats) {
+  stats->frames = w->priv.frames;
+  stats->last_us = (long)w->priv.frame_last_us;
+  stats->min_us = w->priv.frames > 0 ? (long)w->priv.frame_min_us : 0;
+  stats->max_us = (long)w->priv.frame_max_us;
+  stats->total_us = (long)w->priv.frame_total_us;
+}
+// -------------- END ADDED CODE -------------------//
+
 #endif /* WEBVIEW_GTK */
 
 #if defined(WEBVIEW_COCOA)